@@ -14,24 +14,58 @@
 #include <stdbool.h>
 #include <stdio.h>
 
+/**
+ * Memory allocation callbacks, used instead of the compile time allocator selected
+ * through hdr_malloc.h for histograms created with one of the *_ex functions.
+ * Allows different histograms in the same process to live in different arenas.
+ *
+ * allocate is not required to return zeroed memory, unless zeroed is set.  An allocator
+ * returning demand-zero pages should set zeroed, so hdr_init_ex does not write (and so
+ * commit) the whole counts array.  release may be NULL, e.g. for a bump arena that is
+ * freed in one shot once all of its histograms are finished with.
+ * The allocator must outlive every histogram created with it.
+ */
+struct hdr_allocator
+{
+    void* (*allocate)(void* context, size_t size);
+    void (*release)(void* context, void* ptr);
+    void* context;
+    bool zeroed;
+};
+
+struct hdr_bucket_layout;
+struct hdr_moments;
+
+/**
+ * The fields read and written when recording a value are packed into the first 64 bytes,
+ * so with the cache line aligned header allocated by hdr_init recording touches a single
+ * line of the header.
+ */
 struct hdr_histogram
 {
-    int64_t lowest_discernible_value;
+    int64_t* counts;
     int64_t highest_trackable_value;
+    int64_t sub_bucket_mask;
     int32_t unit_magnitude;
-    int32_t significant_figures;
     int32_t sub_bucket_half_count_magnitude;
+    int32_t normalizing_index_offset;
+    int32_t counts_len;
+    int64_t total_count;
+    int64_t min_value;
+    int64_t max_value;
+    uint64_t* occupancy;
+    /* Per bucket slot geometry of a histogram created with hdr_init_tiered, otherwise NULL. */
+    const struct hdr_bucket_layout* layout;
+    /* Exact sum and sum of squares of the values, NULL unless hdr_enable_moments was called. */
+    struct hdr_moments* moments;
     int32_t sub_bucket_half_count;
-    int64_t sub_bucket_mask;
     int32_t sub_bucket_count;
     int32_t bucket_count;
-    int64_t min_value;
-    int64_t max_value;
-    int32_t normalizing_index_offset;
+    int32_t significant_figures;
+    int64_t lowest_discernible_value;
     double conversion_ratio;
-    int32_t counts_len;
-    int64_t total_count;
-    int64_t* counts;
+    const struct hdr_allocator* allocator;
+    void* allocation;
 };
 
 #ifdef __cplusplus
@@ -43,7 +77,12 @@ extern "C" {
  *
  * Due to the size of the histogram being the result of some reasonably
  * involved math on the input parameters this function it is tricky to stack allocate.
- * The histogram should be released with hdr_close
+ * The header and counts are placed in a single allocation, with the header aligned
+ * to a cache line and the counts directly after it.
+ * The histogram should be released with hdr_close.  Where posix_memalign is available
+ * the header starts the allocation, so free(h) still releases the header and counts,
+ * though not the occupancy bitmap or moments.  Elsewhere, or with a custom
+ * HDR_MALLOC_INCLUDE lacking hdr_aligned_alloc, free(h) is invalid.
  *
  * @param lowest_discernible_value The smallest possible value that is distinguishable from 0.
  * Must be a positive integer that is >= 1. May be internally rounded down to nearest power of 2.
@@ -64,6 +103,76 @@ int hdr_init(
     int significant_figures,
     struct hdr_histogram** result);
 
+/**
+ * Allocate the memory and initialise the hdr_histogram using the supplied allocator.
+ * The histogram remembers the allocator, which is used for any later allocation on
+ * its behalf (e.g. hdr_enable_occupancy_bitmap, hdr_clone) and to free it in hdr_close.
+ *
+ * @param lowest_discernible_value As for hdr_init.
+ * @param highest_trackable_value As for hdr_init.
+ * @param significant_figures As for hdr_init.
+ * @param allocator The allocator to use, NULL for the default allocator.
+ * @param result Output parameter to capture allocated histogram.
+ * @return As for hdr_init.
+ */
+int hdr_init_ex(
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    const struct hdr_allocator* allocator,
+    struct hdr_histogram** result);
+
+/**
+ * A range of values recorded with its own precision, see hdr_init_tiered.
+ */
+struct hdr_precision_tier
+{
+    /* The tier covers values from here up to the lowest_value of the next tier. */
+    int64_t lowest_value;
+    int32_t significant_figures;
+};
+
+/**
+ * Allocate and initialise a histogram whose precision varies with the value, e.g. 1
+ * significant figure below 1ms, 3 up to 10s and 2 above, rather than the finest of
+ * those over the whole range.  The power of two buckets are those of the coarsest
+ * tier, each gets as many sub-buckets as the finest tier overlapping it needs, so
+ * mapping a value to its counts index stays a shift and an add, looked up per bucket.
+ *
+ * The histogram is recorded into, queried, iterated, added and encoded through the
+ * usual functions.  The sub_bucket_* fields describe the coarsest tier, while
+ * significant_figures is that of the finest, which is the precision a tiered
+ * histogram is encoded with.  hdr_shift_values_left/right and hdr_downsample don't
+ * support tiered histograms.
+ *
+ * @param lowest_discernible_value As for hdr_init.
+ * @param highest_trackable_value As for hdr_init.
+ * @param tiers The tiers in ascending order of lowest_value, the first also covers
+ * any values below its lowest_value.
+ * @param tier_count Number of tiers, at least 1.
+ * @param result Output parameter to capture allocated histogram.
+ * @return 0 on success, EINVAL if the parameters are invalid or the tiers are not
+ * in order, ENOMEM if malloc failed.
+ */
+int hdr_init_tiered(
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    const struct hdr_precision_tier* tiers,
+    int32_t tier_count,
+    struct hdr_histogram** result);
+
+/**
+ * As hdr_init_tiered, but the histogram is taken from the supplied allocator, as for
+ * hdr_init_ex.
+ */
+int hdr_init_tiered_ex(
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    const struct hdr_precision_tier* tiers,
+    int32_t tier_count,
+    const struct hdr_allocator* allocator,
+    struct hdr_histogram** result);
+
 /**
  * Free the memory and close the hdr_histogram.
  *
@@ -86,11 +195,59 @@ int hdr_alloc(int64_t highest_trackable_value, int significant_figures, struct h
  * If you want to re-use an existing histogram, but reset everything back to zero, this
  * is the routine to use.
  *
+ * Only the region of the counts array up to the recorded max is cleared, so the cost
+ * follows what was recorded rather than the size of the histogram.  If the
+ * counts are modified directly hdr_reset_internal_counters must be called before reset.
+ *
  * @param h The histogram you want to reset to empty.
  *
  */
 void hdr_reset(struct hdr_histogram* h);
 
+/**
+ * Reset a histogram to zero, handing the whole pages of the touched counts region back
+ * to the operating system with madvise(MADV_DONTNEED) instead of writing zeros to them.
+ * Useful for very large histograms, the pages are re-populated with zeros on the next
+ * write.  Falls back to hdr_reset on platforms other than Linux.
+ *
+ * Must only be used when the counts are in private anonymous memory, e.g. allocated
+ * with the default allocator rather than one supplied to hdr_init_ex.
+ *
+ * @param h The histogram you want to reset to empty.
+ */
+void hdr_reset_release_pages(struct hdr_histogram* h);
+
+/**
+ * Enable the occupancy bitmap for the histogram.  The bitmap holds one bit per
+ * counts slot and is kept up to date when values are recorded, which allows
+ * iteration, encoding, hdr_add and hdr_reset to jump between non-zero slots
+ * rather than scanning the full counts array.  Worthwhile for histograms where
+ * the majority of slots are empty.  The bitmap is released by hdr_close.
+ *
+ * If the counts are modified directly hdr_reset_internal_counters must be called
+ * to rebuild the bitmap.
+ *
+ * @param h "This" pointer
+ * @return 0 on success, ENOMEM if the bitmap could not be allocated.
+ */
+int hdr_enable_occupancy_bitmap(struct hdr_histogram* h);
+
+/**
+ * Track the sum and the sum of squares of the recorded values, as 128 bit integers,
+ * so hdr_mean and hdr_stddev are exact and constant time instead of scanning the
+ * counts and using the median equivalent value of each bucket.  Recording updates
+ * them, including the atomic functions, as do hdr_add, hdr_copy_into, hdr_downsample
+ * and the value shifts.  Released by hdr_close.
+ *
+ * Values already recorded, values added from a histogram without moments and values
+ * dropped by hdr_add are accounted for with their median equivalent value.  The
+ * encoded form is unchanged, so a decoded histogram has no moments.
+ *
+ * @param h "This" pointer
+ * @return 0 on success, ENOMEM if the moments could not be allocated.
+ */
+int hdr_enable_moments(struct hdr_histogram* h);
+
 /**
  * Get the memory size of the hdr_histogram.
  *
@@ -99,6 +256,30 @@ void hdr_reset(struct hdr_histogram* h);
  */
 size_t hdr_get_memory_size(struct hdr_histogram* h);
 
+/**
+ * Copy the contents of one histogram into another, replacing anything previously recorded
+ * in 'dst'.  No memory is allocated.  If both histograms share the same bucket layout the
+ * counts are copied directly (including the normalizing_index_offset), otherwise each
+ * recorded value is re-mapped into the layout of 'dst'.  The conversion_ratio is carried
+ * across in both cases.
+ *
+ * @param dst The histogram to copy into.
+ * @param src The histogram to copy from.
+ * @return The number of values dropped because they could not be represented by 'dst'.
+ */
+int64_t hdr_copy_into(struct hdr_histogram* dst, const struct hdr_histogram* src);
+
+/**
+ * Allocate a new histogram that is an exact copy of 'src', with the same single
+ * allocation layout as hdr_init, taken from the allocator of 'src'.  The result
+ * should be released with hdr_close.
+ *
+ * @param src The histogram to copy.
+ * @param result Output parameter to capture the allocated histogram.
+ * @return 0 on success, ENOMEM if malloc failed.
+ */
+int hdr_clone(const struct hdr_histogram* src, struct hdr_histogram** result);
+
 /**
  * Records a value in the histogram, will round this value of to a precision at or better
  * than the significant_figure specified at construction time.
@@ -155,6 +336,20 @@ bool hdr_record_values(struct hdr_histogram* h, int64_t value, int64_t count);
  */
 bool hdr_record_values_atomic(struct hdr_histogram* h, int64_t value, int64_t count);
 
+/**
+ * Records a batch of values atomically, as hdr_record_value_atomic would each of them,
+ * but combining the values that fall into the same slot first.  The histogram then
+ * takes one atomic add per distinct slot, one to the total count and one update of
+ * min and max for the whole batch, rather than those per value.  Values recorded by
+ * the batch become visible a slot at a time.
+ *
+ * @param h "This" pointer
+ * @param values Values to add to the histogram
+ * @param length Number of values
+ * @return the number of values out of range that were not recorded.
+ */
+int64_t hdr_record_values_atomic_batch(struct hdr_histogram* h, const int64_t* values, int32_t length);
+
 /**
  * Record a value in the histogram and backfill based on an expected interval.
  *
@@ -248,6 +443,111 @@ int64_t hdr_add(struct hdr_histogram* h, const struct hdr_histogram* from);
 int64_t hdr_add_while_correcting_for_coordinated_omission(
     struct hdr_histogram* h, struct hdr_histogram* from, int64_t expected_interval);
 
+/**
+ * Adds the values from 'from' to 'h' with their counts multiplied by 'scale', e.g. to
+ * combine histograms sampled at different rates, scaling each by the inverse of its
+ * rate.  Counts are rounded to whole numbers carrying the remainder from one bucket
+ * to the next, so the total added is within one of the scaled total.
+ *
+ * @param h "This" pointer
+ * @param from Histogram to copy values from.
+ * @param scale Factor to multiply the counts by, finite and not negative.
+ * @return The number of values dropped when copying, after scaling.  If 'scale' is
+ * negative or not finite, or the scaled counts would overflow the total count of 'h',
+ * no values are added and all of those in 'from' are dropped.
+ */
+int64_t hdr_add_scaled(struct hdr_histogram* h, const struct hdr_histogram* from, double scale);
+
+/**
+ * Add the values from 'src' into 'dst', which has a coarser layout: the same or fewer
+ * significant figures and the same or a larger lowest_discernible_value.  Every slot
+ * of 'src' then falls within a single slot of 'dst', so the counts of each group of
+ * slots are summed without any further loss of precision.
+ *
+ * @param dst Histogram to add the values to.
+ * @param src Histogram to copy values from.
+ * @return 0 on success, EINVAL if 'dst' has a finer layout than 'src' or can't hold
+ * its max value, or either is tiered, in which case nothing is added.
+ */
+int hdr_downsample(struct hdr_histogram* dst, const struct hdr_histogram* src);
+
+/**
+ * Multiply every recorded value by 2^binary_orders_of_magnitude, e.g. to rebase a
+ * histogram from one unit to another.  The counts are rotated by adjusting the
+ * normalizing_index_offset, so the cost is constant apart from the values in the
+ * lowest half bucket, which are moved individually.  Matches Java's shiftValuesLeft.
+ *
+ * @return 0 on success, EINVAL if the shift is negative, the max value would
+ * overflow the highest_trackable_value or the histogram is tiered, in which case the
+ * histogram is unchanged.
+ */
+int hdr_shift_values_left(struct hdr_histogram* h, int32_t binary_orders_of_magnitude);
+
+/**
+ * Divide every recorded value by 2^binary_orders_of_magnitude, the inverse of
+ * hdr_shift_values_left.  Matches Java's shiftValuesRight.
+ *
+ * @return 0 on success, EINVAL if the shift is negative, would move a non-zero value
+ * into the lowest half bucket and so lose precision or the histogram is tiered, in
+ * which case the histogram is unchanged.
+ */
+int hdr_shift_values_right(struct hdr_histogram* h, int32_t binary_orders_of_magnitude);
+
+/**
+ * Copy 'src' into a new histogram of at most 'max_bytes', downsampling it with
+ * hdr_downsample if its own configuration would exceed the budget, e.g. for long
+ * term rollups.  The result should be released with hdr_close.
+ *
+ * @return 0 on success, EINVAL if no configuration of the range fits, ENOMEM if
+ * malloc failed.
+ */
+int hdr_downsample_to_budget(const struct hdr_histogram* src, size_t max_bytes, struct hdr_histogram** result);
+
+/**
+ * Export the recorded (non-zero) buckets of the histogram into caller supplied arrays,
+ * in ascending value order.  Each entry holds the lowest equivalent value of the bucket
+ * and its count.  No callbacks or iterators are involved, making it suitable for bulk
+ * transfer into columnar formats.
+ *
+ * @param h "This" pointer
+ * @param values Destination array for the values, must hold 'capacity' elements.
+ * @param counts Destination array for the counts, must hold 'capacity' elements.
+ * @param capacity Number of elements available in each destination array.
+ * @param length Output parameter set to the number of recorded buckets.  If this is
+ * larger than 'capacity' only the first 'capacity' entries are written.
+ * @return 0 on success, ERANGE if the arrays are too small to hold all of the recorded
+ * buckets, EINVAL if any of the required pointers are NULL.
+ */
+int hdr_export_recorded(
+    const struct hdr_histogram* h, int64_t* values, int64_t* counts, size_t capacity, size_t* length);
+
+/**
+ * As hdr_export_recorded, additionally filling in the lowest, highest and median
+ * equivalent values for each bucket.  Each of these arrays is optional and may be NULL.
+ */
+int hdr_export_recorded_equivalents(
+    const struct hdr_histogram* h,
+    int64_t* values,
+    int64_t* counts,
+    int64_t* lowest_equivalent_values,
+    int64_t* highest_equivalent_values,
+    int64_t* median_equivalent_values,
+    size_t capacity,
+    size_t* length);
+
+/**
+ * Bulk load (value, count) pairs into the histogram, e.g. those produced by
+ * hdr_export_recorded.  The counts are added to any already recorded.  Total count,
+ * min and max are updated once for the whole batch.
+ *
+ * @param h "This" pointer
+ * @param values The values to record.
+ * @param counts The count for each value.
+ * @param length Number of elements in the arrays.
+ * @return The number of values dropped because they are outside the trackable range.
+ */
+int64_t hdr_import_counts(struct hdr_histogram* h, const int64_t* values, const int64_t* counts, size_t length);
+
 /**
  * Get minimum value from the histogram.  Will return 2^63-1 if the histogram
  * is empty.
@@ -285,7 +585,8 @@ int64_t hdr_value_at_percentile(const struct hdr_histogram* h, double percentile
 int hdr_value_at_percentiles(const struct hdr_histogram *h, const double *percentiles, int64_t *values, size_t length);
 
 /**
- * Gets the standard deviation for the values in the histogram.
+ * Gets the standard deviation for the values in the histogram.  Exact and constant
+ * time if the histogram tracks its moments, see hdr_enable_moments.
  *
  * @param h "This" pointer
  * @return The standard deviation
@@ -293,7 +594,8 @@ int hdr_value_at_percentiles(const struct hdr_histogram *h, const double *percen
 double hdr_stddev(const struct hdr_histogram* h);
 
 /**
- * Gets the mean for the values in the histogram.
+ * Gets the mean for the values in the histogram.  Exact and constant time if the
+ * histogram tracks its moments, see hdr_enable_moments.
  *
  * @param h "This" pointer
  * @return The mean
@@ -393,6 +695,9 @@ struct hdr_iter
     int64_t median_equivalent_value;
     int64_t value_iterated_from;
     int64_t value_iterated_to;
+    /** bucket and sub bucket for the current counts_index, tracked incrementally */
+    int32_t bucket_index;
+    int32_t sub_bucket_index;
 
     union
     {
@@ -424,6 +729,27 @@ void hdr_iter_percentile_init(struct hdr_iter* iter, const struct hdr_histogram*
  */
 void hdr_iter_recorded_init(struct hdr_iter* iter, const struct hdr_histogram* h);
 
+/**
+ * Initialise the iterator for use with recorded values, starting at the bucket
+ * that contains 'value'.  Only the counts from 'value' up to the max are
+ * visited, cumulative_count still includes the counts below 'value'.
+ */
+void hdr_iter_recorded_init_at_value(struct hdr_iter* iter, const struct hdr_histogram* h, int64_t value);
+
+/**
+ * Initialise the iterator for use with recorded values, starting at the bucket
+ * that contains the value at the given percentile.  The start is found by walking
+ * down from the max, so the cost is proportional to the size of the tail.
+ */
+void hdr_iter_recorded_init_at_percentile(struct hdr_iter* iter, const struct hdr_histogram* h, double percentile);
+
+/**
+ * Initialise the iterator for use with recorded values in reverse order, walking
+ * down from the bucket containing max_value.  cumulative_count is the sum of the
+ * counts at or above the current value.
+ */
+void hdr_iter_reverse_init(struct hdr_iter* iter, const struct hdr_histogram* h);
+
 /**
  * Initialise the iterator for use with linear values.
  */
@@ -497,6 +823,40 @@ int hdr_calculate_bucket_config(
 
 void hdr_init_preallocated(struct hdr_histogram* h, struct hdr_histogram_bucket_config* cfg);
 
+/**
+ * The size of the single allocation hdr_init_ex makes from an allocator for a
+ * histogram with the supplied configuration, e.g. for sizing an arena.  hdr_init
+ * allocates at most this much.
+ */
+size_t hdr_calculate_allocation_size(const struct hdr_histogram_bucket_config* cfg);
+
+/**
+ * Calculate the most precise bucket configuration for which
+ * hdr_calculate_allocation_size, alignment slack included, stays within
+ * 'max_bytes'.  Significant figures are dropped first, down to 1, then the
+ * lowest_discernible_value is doubled until the configuration fits.
+ *
+ * @return 0 on success, EINVAL if the parameters are invalid or no configuration of
+ * the range fits.
+ */
+int hdr_calculate_budgeted_config(
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    size_t max_bytes,
+    struct hdr_histogram_bucket_config* cfg);
+
+/**
+ * As hdr_init, downsampling the configuration as necessary for its allocation to fit
+ * within 'max_bytes', see hdr_calculate_budgeted_config.
+ */
+int hdr_init_budgeted(
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    size_t max_bytes,
+    struct hdr_histogram** result);
+
 int64_t hdr_size_of_equivalent_value_range(const struct hdr_histogram* h, int64_t value);
 
 int64_t hdr_next_non_equivalent_value(const struct hdr_histogram* h, int64_t value);
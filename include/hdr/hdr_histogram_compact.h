@@ -0,0 +1,152 @@
+/**
+ * hdr_histogram_compact.h
+ * Released to the public domain, as explained at
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * A recording-side histogram storing one byte per counts slot.  The rare slots
+ * whose count exceeds 8 bits keep their high part in an overflow table, so the
+ * counts take an eighth of the memory of an hdr_histogram with the same bucket
+ * configuration and random recording touches far fewer cache lines.  Counts and
+ * percentiles are queried in place, or the values can be added into an
+ * hdr_histogram with hdr_compact_add for the full query API.
+ */
+
+#ifndef HDR_HISTOGRAM_COMPACT_H
+#define HDR_HISTOGRAM_COMPACT_H 1
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <hdr/hdr_histogram.h>
+
+struct hdr_compact_histogram
+{
+    /* Bucket geometry, min/max and total count.  Its counts are not used. */
+    struct hdr_histogram shape;
+    uint8_t* counts;
+    /* Open addressing table of slot index (-1 if free) to (count - 1) / 255, the */
+    /* byte of a slot holding the rest, so it is only zero for an empty slot. */
+    int32_t* overflow_indexes;
+    int64_t* overflow_counts;
+    int32_t overflow_capacity;
+};
+
+struct hdr_compact_iter
+{
+    const struct hdr_compact_histogram* h;
+    /** index of the current slot, -1 before the first */
+    int32_t counts_index;
+    /** snapshot of the total count at the time the iterator is initialised */
+    int64_t total_count;
+    /** count of the current slot, its byte plus any overflow */
+    int64_t count;
+    /** sum of the counts up to and including the current slot */
+    int64_t cumulative_count;
+    /** lowest value of the current slot */
+    int64_t value;
+    int64_t lowest_equivalent_value;
+    int64_t highest_equivalent_value;
+    int64_t median_equivalent_value;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Allocate and initialise a compact histogram, the parameters are as for hdr_init.
+ * The histogram should be released with hdr_compact_close.
+ *
+ * @return 0 on success, EINVAL if the parameters are invalid, ENOMEM if malloc failed.
+ */
+int hdr_compact_init(
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    struct hdr_compact_histogram** result);
+
+void hdr_compact_close(struct hdr_compact_histogram* h);
+
+/**
+ * Reset the histogram to empty, keeping the overflow table's capacity.
+ */
+void hdr_compact_reset(struct hdr_compact_histogram* h);
+
+/**
+ * Grow the overflow table so that at least 'slots' slots can exceed a count of 255
+ * without it filling.  Must not be called concurrently with recording.
+ *
+ * @return 0 on success, EINVAL if 'slots' is out of range, ENOMEM if malloc failed.
+ */
+int hdr_compact_reserve_overflow(struct hdr_compact_histogram* h, int32_t slots);
+
+/**
+ * Record 'count' occurrences of 'value'.  'count' must not be negative.  The
+ * overflow table grows as needed.
+ *
+ * @return false if the value is out of range, 'count' is negative or the
+ * overflow table could not be grown.
+ */
+bool hdr_compact_record_value(struct hdr_compact_histogram* h, int64_t value);
+bool hdr_compact_record_values(struct hdr_compact_histogram* h, int64_t value, int64_t count);
+
+/**
+ * Atomically record 'count' occurrences of 'value', safe to call concurrently with
+ * other atomic records.  Slots are updated with a byte CAS, spilling into the
+ * overflow table, which can not be grown by an atomic record, so reserve room
+ * for the slots expected to exceed 255 with hdr_compact_reserve_overflow first.
+ *
+ * @return false if the value is out of range, 'count' is negative or the
+ * overflow table is full.  Nothing is recorded when false is returned.
+ */
+bool hdr_compact_record_value_atomic(struct hdr_compact_histogram* h, int64_t value);
+bool hdr_compact_record_values_atomic(struct hdr_compact_histogram* h, int64_t value, int64_t count);
+
+/**
+ * Get the count of recorded values equivalent to 'value'.
+ */
+int64_t hdr_compact_count_at_value(const struct hdr_compact_histogram* h, int64_t value);
+
+/**
+ * Add the values recorded in a compact histogram into 'h', e.g. to query them.
+ *
+ * @return The number of values dropped because they were out of range for 'h'.
+ */
+int64_t hdr_compact_add(struct hdr_histogram* h, const struct hdr_compact_histogram* from);
+
+/**
+ * Get the value at a given percentile, as for hdr_value_at_percentile, walking the
+ * byte counts without a dense copy.
+ */
+int64_t hdr_compact_value_at_percentile(const struct hdr_compact_histogram* h, double percentile);
+
+/**
+ * Gets the mean of the recorded values, from the median equivalent value of each slot.
+ */
+double hdr_compact_mean(const struct hdr_compact_histogram* h);
+
+/**
+ * Initialise an iterator over the recorded values, in increasing order of value.
+ * Empty slots are skipped eight at a time and the overflow table is consulted for
+ * each non-empty slot, so reporting needs no dense copy.  Atomic recording while
+ * iterating is safe, but the counts seen are not a consistent snapshot.
+ */
+void hdr_compact_iter_init(struct hdr_compact_iter* iter, const struct hdr_compact_histogram* h);
+
+/**
+ * Move to the next slot with a non-zero count.
+ *
+ * @return false once all the recorded values have been visited.
+ */
+bool hdr_compact_iter_next(struct hdr_compact_iter* iter);
+
+/**
+ * Get the memory size of the compact histogram, including the overflow table.
+ */
+size_t hdr_compact_get_memory_size(const struct hdr_compact_histogram* h);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
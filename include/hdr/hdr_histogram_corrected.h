@@ -0,0 +1,106 @@
+/**
+ * hdr_histogram_corrected.h
+ * Released to the public domain, as explained at
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * A read-only view of a histogram corrected for coordinated omission, answering
+ * queries as hdr_add_while_correcting_for_coordinated_omission into an empty copy
+ * would, without allocating or populating that copy.  The counts of the missing
+ * values are derived per bucket when queried: each recorded bucket contributes an
+ * arithmetic sequence of values, so how many of them fall at or below any value is
+ * closed form.
+ */
+
+#ifndef HDR_HISTOGRAM_CORRECTED_H
+#define HDR_HISTOGRAM_CORRECTED_H 1
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <hdr/hdr_histogram.h>
+
+struct hdr_corrected_slot;
+struct hdr_corrected_sequence;
+
+struct hdr_corrected_view
+{
+    const struct hdr_histogram* histogram;
+    int64_t expected_interval;
+    int64_t total_count;
+    int32_t length;
+    /* The recorded buckets of the histogram, with the values each one implies. */
+    struct hdr_corrected_slot* slots;
+};
+
+struct hdr_corrected_iter
+{
+    const struct hdr_corrected_view* view;
+    int32_t counts_index;
+    int64_t count;
+    int64_t cumulative_count;
+    int64_t value;
+    int64_t lowest_equivalent_value;
+    int64_t highest_equivalent_value;
+    /* The next recorded bucket, and the missing-value sequences not yet exhausted. */
+    int32_t next_slot;
+    int32_t pending_length;
+    struct hdr_corrected_sequence* pending;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Initialise a view of 'h' corrected for the 'expected_interval' between values, as
+ * for hdr_record_corrected_values.  The view takes a snapshot of the recorded buckets,
+ * one entry per non-zero bucket rather than a second counts array, and must be
+ * initialised again to see values recorded later.  'h' must outlive the view.
+ *
+ * @return 0 on success, ENOMEM if the snapshot could not be allocated.
+ */
+int hdr_corrected_view_init(struct hdr_corrected_view* view, const struct hdr_histogram* h, int64_t expected_interval);
+
+void hdr_corrected_view_close(struct hdr_corrected_view* view);
+
+int64_t hdr_corrected_total_count(const struct hdr_corrected_view* view);
+int64_t hdr_corrected_min(const struct hdr_corrected_view* view);
+int64_t hdr_corrected_max(const struct hdr_corrected_view* view);
+
+/**
+ * Get the mean of the corrected values.  The missing values are summed exactly
+ * rather than at the median of their bucket, so it can differ from hdr_mean of a
+ * corrected copy by a fraction of the bucket width.
+ */
+double hdr_corrected_mean(const struct hdr_corrected_view* view);
+
+/**
+ * Get the value at the percentile, as hdr_value_at_percentile of a corrected copy.
+ * Each evaluation of the cumulative count costs one step per recorded bucket, and a
+ * binary search over the buckets needs a logarithmic number of them.
+ */
+int64_t hdr_corrected_value_at_percentile(const struct hdr_corrected_view* view, double percentile);
+
+/**
+ * Get the corrected count of the values equivalent to 'value'.
+ */
+int64_t hdr_corrected_count_at_value(const struct hdr_corrected_view* view, int64_t value);
+
+/**
+ * Iterate the buckets of the corrected histogram with a non-zero count in ascending
+ * order, as hdr_iter_recorded_init does.  The iterator carries the cumulative count
+ * and a heap of the missing-value sequences still pending, so each step only touches
+ * the sequences with values in its bucket.  It must be released with
+ * hdr_corrected_iter_close.
+ *
+ * @return 0 on success, ENOMEM if the pending sequences could not be allocated.
+ */
+int hdr_corrected_iter_init(struct hdr_corrected_iter* iter, const struct hdr_corrected_view* view);
+bool hdr_corrected_iter_next(struct hdr_corrected_iter* iter);
+void hdr_corrected_iter_close(struct hdr_corrected_iter* iter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
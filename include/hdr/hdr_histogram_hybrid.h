@@ -0,0 +1,97 @@
+/**
+ * hdr_histogram_hybrid.h
+ * Released to the public domain, as explained at
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * A histogram for sparse series that keeps up to a fixed number of raw values in a
+ * small sorted buffer and only allocates an hdr_histogram once that overflows.  While
+ * the values fit the histogram is a few hundred bytes, recording and queries touch
+ * only the buffer, and percentiles are exact.
+ */
+
+#ifndef HDR_HISTOGRAM_HYBRID_H
+#define HDR_HISTOGRAM_HYBRID_H 1
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <hdr/hdr_histogram.h>
+
+struct hdr_hybrid_histogram
+{
+    int64_t lowest_discernible_value;
+    int64_t highest_trackable_value;
+    int32_t significant_figures;
+    int32_t capacity;
+    int32_t length;
+    /* The recorded values in ascending order, until promoted. */
+    int64_t* values;
+    /* NULL until more than 'capacity' values have been recorded. */
+    struct hdr_histogram* histogram;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Allocate and initialise a hybrid histogram holding up to 'capacity' raw values
+ * before it is promoted to an hdr_histogram with the given configuration.  The
+ * histogram should be released with hdr_hybrid_close.
+ *
+ * @return 0 on success, EINVAL if the parameters are invalid, ENOMEM if malloc failed.
+ */
+int hdr_hybrid_init(
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    int32_t capacity,
+    struct hdr_hybrid_histogram** result);
+
+void hdr_hybrid_close(struct hdr_hybrid_histogram* h);
+
+/**
+ * Reset to empty.  A promoted histogram stays promoted, so a series that was busy in
+ * one interval does not pay the promotion again in the next.
+ */
+void hdr_hybrid_reset(struct hdr_hybrid_histogram* h);
+
+/**
+ * Record 'count' occurrences of 'value', promoting the histogram if the buffer
+ * would overflow.
+ *
+ * @return false if the value is out of range or 'count' negative, or the promotion
+ * failed to allocate.
+ */
+bool hdr_hybrid_record_value(struct hdr_hybrid_histogram* h, int64_t value);
+bool hdr_hybrid_record_values(struct hdr_hybrid_histogram* h, int64_t value, int64_t count);
+
+int64_t hdr_hybrid_total_count(const struct hdr_hybrid_histogram* h);
+int64_t hdr_hybrid_min(const struct hdr_hybrid_histogram* h);
+int64_t hdr_hybrid_max(const struct hdr_hybrid_histogram* h);
+double hdr_hybrid_mean(const struct hdr_hybrid_histogram* h);
+
+/**
+ * Get the value at the percentile.  Exact while the values are buffered, otherwise
+ * as for hdr_value_at_percentile.
+ */
+int64_t hdr_hybrid_value_at_percentile(const struct hdr_hybrid_histogram* h, double percentile);
+
+/**
+ * Add the values recorded in a hybrid histogram into 'h', e.g. to merge series.
+ *
+ * @return The number of values dropped because they were out of range for 'h'.
+ */
+int64_t hdr_hybrid_add(struct hdr_histogram* h, const struct hdr_hybrid_histogram* from);
+
+/**
+ * Get the memory size of the hybrid histogram, including the promoted histogram.
+ */
+size_t hdr_hybrid_get_memory_size(const struct hdr_hybrid_histogram* h);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
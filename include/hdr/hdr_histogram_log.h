@@ -222,6 +222,22 @@ int hdr_log_read(
 int hdr_log_read_entry(
     struct hdr_log_reader* reader, FILE* file, struct hdr_log_entry *entry, struct hdr_histogram** histogram);
 
+/**
+ * As hdr_log_read_entry, but any histogram allocated while reading the entry is taken
+ * from the supplied allocator.  When merging into an existing histogram the temporary
+ * decoded histogram is also taken from, and returned to, the allocator.
+ *
+ * @param reader 'This' pointer
+ * @param file The stream to read the histogram from.
+ * @param entry Contains all of the information from the log line that is not the histogram.
+ * @param allocator The allocator to use, NULL for the default allocator.
+ * @param histogram Pointer to allocate a histogram to or merge into.
+ * @return As for hdr_log_read_entry.
+ */
+int hdr_log_read_entry_ex(
+    struct hdr_log_reader* reader, FILE* file, struct hdr_log_entry *entry,
+    const struct hdr_allocator* allocator, struct hdr_histogram** histogram);
+
 /**
  * Returns a string representation of the error number.
  *
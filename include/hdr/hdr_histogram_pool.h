@@ -0,0 +1,78 @@
+/**
+ * hdr_histogram_pool.h
+ * Released to the public domain, as explained at
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * A pool of histogram memory for a single bucket configuration.  Histograms are
+ * taken from the pool through its allocator, so any API accepting an
+ * hdr_allocator (hdr_init_ex, hdr_log_read_entry_ex,
+ * hdr_interval_recorder_init_all_ex) can use the pool, and hdr_close returns
+ * the memory to the pool rather than the system.
+ *
+ * Memory is zeroed when it is returned, clearing only the counts up to the
+ * histogram's max, so acquiring a histogram does not write its counts.
+ */
+
+#ifndef HDR_HISTOGRAM_POOL_H
+#define HDR_HISTOGRAM_POOL_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <hdr/hdr_histogram.h>
+#include <hdr/hdr_thread.h>
+
+struct hdr_histogram_pool
+{
+    struct hdr_allocator allocator;
+    struct hdr_histogram_bucket_config cfg;
+    size_t block_size;
+    void* free_blocks;
+    hdr_mutex* mutex;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Initialise a pool for histograms with the given configuration.  Memory
+ * requests for any other configuration are passed through to the default
+ * allocator.
+ *
+ * @return 0 on success, EINVAL if the configuration is invalid, ENOMEM if
+ * the pool's lock could not be allocated.
+ */
+int hdr_histogram_pool_init(
+    struct hdr_histogram_pool* pool,
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures);
+
+/**
+ * Free all of the memory held by the pool.  Every histogram taken from the
+ * pool must have been closed first.
+ */
+void hdr_histogram_pool_destroy(struct hdr_histogram_pool* pool);
+
+/**
+ * Populate the pool with memory for 'count' histograms up front, so that
+ * neither the allocator nor page faults are hit when they are acquired.
+ *
+ * @return 0 on success, ENOMEM if the memory could not be allocated.
+ */
+int hdr_histogram_pool_preallocate(struct hdr_histogram_pool* pool, int count);
+
+/**
+ * Take a zeroed histogram with the pool's configuration from the pool.  The
+ * histogram should be released with hdr_close, which returns it to the pool.
+ *
+ * @return 0 on success, ENOMEM if the memory could not be allocated.
+ */
+int hdr_histogram_pool_acquire(struct hdr_histogram_pool* pool, struct hdr_histogram** result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,71 @@
+/**
+ * hdr_histogram_sampler.h
+ * Released to the public domain, as explained at
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * Records a sample of the values offered to it into a histogram, with each sampled
+ * value counted as the number of values it stands for, for event rates where even
+ * hdr_record_value is too expensive to call on every value.  Values that are not
+ * sampled cost a decrement and a branch.
+ *
+ * A sampler is owned by a single thread, it holds that thread's random state.  To
+ * record into a histogram shared between threads, use one sampler per thread and
+ * hdr_sampler_record_value_atomic.
+ */
+
+#ifndef HDR_HISTOGRAM_SAMPLER_H
+#define HDR_HISTOGRAM_SAMPLER_H 1
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <hdr/hdr_histogram.h>
+
+struct hdr_sampler
+{
+    struct hdr_histogram* histogram;
+    /* Values left to skip, the value offered when it reaches zero is sampled. */
+    int64_t countdown;
+    /* Every Nth value, or 0 when sampling with a probability. */
+    int64_t interval;
+    double rate;
+    uint64_t random_state;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Initialise a sampler recording every Nth value into 'h', with a count of N.
+ *
+ * @return 0 on success, EINVAL if 'interval' is less than 1.
+ */
+int hdr_sampler_init_interval(struct hdr_sampler* s, struct hdr_histogram* h, int64_t interval);
+
+/**
+ * Initialise a sampler recording each value into 'h' with probability 'rate', with a
+ * count of 1 / rate.  When that is not a whole number the count is rounded up or down
+ * at random, keeping the expected count exact.  The gap to the next sampled value is
+ * drawn from the geometric distribution when a value is sampled, so the random
+ * number generator (xorshift64*) runs once per sample rather than once per value.
+ *
+ * @param seed Seed of the random number generator, which should differ per thread.
+ * @return 0 on success, EINVAL if 'rate' is not in (0, 1] or is smaller than
+ * 1 / INT64_MAX, whose count of 1 / rate would not fit in an int64_t.
+ */
+int hdr_sampler_init_bernoulli(struct hdr_sampler* s, struct hdr_histogram* h, double rate, uint64_t seed);
+
+/**
+ * Offer a value to the sampler.
+ *
+ * @return false if the value was sampled and is out of range for the histogram.
+ */
+bool hdr_sampler_record_value(struct hdr_sampler* s, int64_t value);
+bool hdr_sampler_record_value_atomic(struct hdr_sampler* s, int64_t value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,198 @@
+/**
+ * hdr_histogram_shared.h
+ * Released to the public domain, as explained at
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * Histograms laid out in caller supplied memory using offsets only, so the same
+ * bytes can be mapped at different addresses by several processes, e.g. pre-fork
+ * workers recording into one histogram per service, or persisted in a mapped file
+ * that survives restarts.  Each process works through its own struct hdr_histogram
+ * view of the buffer.
+ */
+
+#ifndef HDR_HISTOGRAM_SHARED_H
+#define HDR_HISTOGRAM_SHARED_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <hdr/hdr_histogram.h>
+
+struct hdr_shared_recorder
+{
+    void* segment;
+    size_t size;
+    /* Views of the two interval histograms in the segment. */
+    struct hdr_histogram histograms[2];
+};
+
+struct hdr_file_histogram
+{
+    /* View of the histogram in the file, record into and query this. */
+    struct hdr_histogram histogram;
+    void* mapping;
+    size_t size;
+    /* Set by hdr_open_file if values were recorded after the last hdr_sync_file. */
+    bool recovered;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Get the size of the buffer needed by hdr_init_in_buffer for the bucket
+ * configuration.
+ */
+size_t hdr_calculate_buffer_size(const struct hdr_histogram_bucket_config* cfg);
+
+/**
+ * Lay out an empty histogram in 'buffer', which must be 8 byte aligned and at least
+ * hdr_calculate_buffer_size bytes, and initialise 'view' to refer to it.  The buffer
+ * holds the bucket configuration and the counts, and no pointers, so it can be
+ * copied, persisted or mapped into other processes and opened there with
+ * hdr_attach_buffer.
+ *
+ * Only the counts are shared, total_count, min_value and max_value of a view cover
+ * what was recorded through that view.  Call hdr_reset_internal_counters on a view
+ * to recompute them from the shared counts (to bucket precision for the min and max)
+ * before querying it.  Values recorded from several processes at once must use the
+ * atomic recording functions.
+ *
+ * The view does not own the buffer and must not be passed to hdr_close.
+ *
+ * @return 0 on success, EINVAL if the parameters are invalid or the buffer too small.
+ */
+int hdr_init_in_buffer(
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    void* buffer,
+    size_t size,
+    struct hdr_histogram* view);
+
+/**
+ * Initialise 'view' to refer to a histogram previously laid out with
+ * hdr_init_in_buffer, recomputing its total, min and max from the counts.
+ *
+ * @return 0 on success, EINVAL if the buffer does not hold a histogram.
+ */
+int hdr_attach_buffer(void* buffer, size_t size, struct hdr_histogram* view);
+
+/**
+ * Open the POSIX shared memory object 'name', creating and initialising it with the
+ * given bucket configuration if it does not exist.  The segment holds two interval
+ * histograms and the state of the writer reader phaser that switches between them,
+ * as for hdr_interval_recorder.
+ *
+ * Any number of processes can record through hdr_shared_record_value(s), a single
+ * process at a time samples with hdr_shared_sample.  The phaser lives in the segment,
+ * so a writer killed while recording (SIGKILL, the OOM killer, a crash) never leaves
+ * its critical section and hdr_shared_sample then waits forever.  Where workers can
+ * die, sample with hdr_shared_sample_with_timeout.
+ *
+ * @return 0 on success, EINVAL if an existing segment has a different configuration,
+ * ENOSYS on platforms without shm_open, otherwise the errno of the failed call.
+ */
+int hdr_open_shared(
+    const char* name,
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    struct hdr_shared_recorder* r);
+
+/**
+ * Unmap the segment from this process, it remains until hdr_unlink_shared.
+ */
+void hdr_close_shared(struct hdr_shared_recorder* r);
+
+/**
+ * Remove the shared memory object 'name'.
+ *
+ * @return 0 on success, otherwise the errno of shm_unlink.
+ */
+int hdr_unlink_shared(const char* name);
+
+/**
+ * Atomically record values into the active interval histogram of the segment.
+ *
+ * @return false if the value is larger than the highest_trackable_value and can't be
+ * recorded.
+ */
+bool hdr_shared_record_value(struct hdr_shared_recorder* r, int64_t value);
+bool hdr_shared_record_values(struct hdr_shared_recorder* r, int64_t value, int64_t count);
+
+/**
+ * Switch recording to the other interval histogram, add the values recorded since the
+ * previous sample into 'into' and clear them.  The min and max of the interval are
+ * only known to bucket precision.
+ *
+ * Waits for every writer of the interval to finish, which never happens if one died
+ * while recording, see hdr_shared_sample_with_timeout.
+ *
+ * @return The number of values dropped because they were out of range for 'into'.
+ */
+int64_t hdr_shared_sample(struct hdr_shared_recorder* r, struct hdr_histogram* into);
+
+/**
+ * As hdr_shared_sample, but give up waiting for the writers after 'timeout_ns'.
+ * Recording has switched histograms either way.  On a timeout nothing is added to
+ * 'into', the interval's values stay in the segment and are reported by the sample
+ * after next, and later samples succeed unless another writer is stuck.  A caller
+ * that times out repeatedly can recover by unlinking and re-creating the segment.
+ *
+ * @param dropped Set to the number of values out of range for 'into'.
+ * @return 0 on success, ETIMEDOUT if a writer did not leave the interval in time.
+ */
+int hdr_shared_sample_with_timeout(
+    struct hdr_shared_recorder* r, struct hdr_histogram* into, int64_t timeout_ns, int64_t* dropped);
+
+/**
+ * Open the histogram persisted in the file at 'path', creating it empty with the
+ * given bucket configuration if it does not exist.  The counts are recorded straight
+ * into the mapped file, so the values recorded survive the process crashing or being
+ * restarted without being replayed from a log.  Creating and attaching hold an
+ * exclusive flock on the file, so processes opening it at the same time all attach
+ * to the one histogram, and a file left zeroed by a creator that died is recreated.
+ *
+ * The file has a versioned layout, a checksum written by hdr_sync_file and a dirty
+ * flag set while the file is open and cleared by hdr_close_file.  The configuration
+ * of an existing file is validated with hdr_calculate_bucket_config and must match
+ * the one given.  If the checksum does not match a dirty file, values were recorded
+ * after the last sync: they are kept, the total, min and max are recomputed from the
+ * counts and 'recovered' is set.  A closed file must match its checksum.
+ *
+ * @return 0 on success, EINVAL if the file is not a histogram, has a different
+ * configuration or was closed and does not match its checksum, ENOSYS on platforms
+ * without mmap, otherwise the errno of the failed call.
+ */
+int hdr_open_file(
+    const char* path,
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    struct hdr_file_histogram* f);
+
+/**
+ * Store the total, min, max and checksum in the file and msync it.  Recording never
+ * syncs, call this at the end of each interval or as often as the data must be
+ * durable against the machine failing.  It must not run concurrently with recording
+ * for the checksum to be valid.  The file stays dirty, values may still be recorded
+ * after the sync.
+ *
+ * @return 0 on success, otherwise the errno of msync.
+ */
+int hdr_sync_file(struct hdr_file_histogram* f);
+
+/**
+ * Sync the file, clear its dirty flag and unmap it.
+ *
+ * @return As for hdr_sync_file.
+ */
+int hdr_close_file(struct hdr_file_histogram* f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -19,6 +19,20 @@ struct hdr_interval_recorder
 }
 HDR_ALIGN_SUFFIX(8);
 
+#define HDR_INTERVAL_RECORDER_BUFFER_LENGTH 256
+
+/**
+ * Values recorded by a single thread, appended with a plain store and drained into
+ * the recorder a buffer at a time, so the phaser is entered once per buffer rather
+ * than once per value.  Each thread owns its own buffer, typically thread local.
+ */
+struct hdr_interval_recorder_buffer
+{
+    struct hdr_interval_recorder* recorder;
+    int32_t length;
+    int64_t values[HDR_INTERVAL_RECORDER_BUFFER_LENGTH];
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -31,6 +45,17 @@ int hdr_interval_recorder_init_all(
     int64_t highest_trackable_value,
     int significant_figures);
 
+/**
+ * As hdr_interval_recorder_init_all, but the active histogram is taken from the
+ * supplied allocator, as are any histograms created by the recorder when sampling.
+ */
+int hdr_interval_recorder_init_all_ex(
+    struct hdr_interval_recorder* r,
+    int64_t lowest_trackable_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    const struct hdr_allocator* allocator);
+
 void hdr_interval_recorder_destroy(struct hdr_interval_recorder* r);
 
 int64_t hdr_interval_recorder_record_value(
@@ -81,6 +106,46 @@ int64_t hdr_interval_recorder_record_corrected_values_atomic(
     int64_t expected_interval
 );
 
+void hdr_interval_recorder_buffer_init(
+    struct hdr_interval_recorder_buffer* b,
+    struct hdr_interval_recorder* r);
+
+/**
+ * Append a value to the buffer, draining it into the recorder when it is full.  The
+ * _atomic variant drains with hdr_interval_recorder_buffer_flush_atomic.
+ *
+ * @return false if draining the buffer dropped values out of the histogram's range.
+ */
+bool hdr_interval_recorder_buffer_record_value(
+    struct hdr_interval_recorder_buffer* b,
+    int64_t value
+);
+
+bool hdr_interval_recorder_buffer_record_value_atomic(
+    struct hdr_interval_recorder_buffer* b,
+    int64_t value
+);
+
+/**
+ * Drain the buffer into the recorder within a single phaser critical section, with
+ * hdr_record_values for each value.  Like hdr_interval_recorder_record_values this
+ * must not race with other writers.
+ *
+ * The sampling thread cannot see into the buffers, so values not yet drained are
+ * reported in a later interval; the owning thread flushes its buffer before the
+ * interval is sampled when that matters.
+ *
+ * @return the number of values dropped as out of the histogram's range.
+ */
+int64_t hdr_interval_recorder_buffer_flush(struct hdr_interval_recorder_buffer* b);
+
+/**
+ * As hdr_interval_recorder_buffer_flush, but safe with concurrent writers.  The values
+ * are recorded with hdr_record_values_atomic_batch, so the shared counts take one
+ * atomic add per distinct slot.
+ */
+int64_t hdr_interval_recorder_buffer_flush_atomic(struct hdr_interval_recorder_buffer* b);
+
 /**
  * This is generally the preferred approach for recycling histograms through
  * the recorder as it is safe when used from callers in multiple threads and
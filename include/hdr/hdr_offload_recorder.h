@@ -0,0 +1,134 @@
+/**
+ * hdr_offload_recorder.h
+ * Released to the public domain, as explained at
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * A recorder that moves the histogram work off the recording threads.  Producers
+ * enqueue (value, count) entries on a bounded lock-free multi-producer single-consumer
+ * ring, touching no histogram memory, and a consumer thread drains the ring into the
+ * active histogram with the non-atomic recording path.  A producer never waits: when
+ * the ring is full the entry is dropped and counted.
+ *
+ * Compared to hdr_interval_recorder, which has each producer update the histogram
+ * itself, a producer here costs a compare and swap on the ring's tail and a store.
+ */
+
+#ifndef HDR_OFFLOAD_RECORDER_H
+#define HDR_OFFLOAD_RECORDER_H 1
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <hdr/hdr_histogram.h>
+#include <hdr/hdr_thread.h>
+
+struct hdr_offload_cell;
+
+HDR_ALIGN_PREFIX(8)
+struct hdr_offload_recorder
+{
+    struct hdr_offload_cell* cells;
+    int64_t mask;
+
+    /* Written by the producers. */
+    int64_t tail;
+    int64_t overflow_entries;
+    int64_t overflow_count;
+    /* Keeps the consumer's fields off the producers' cache line. */
+    char padding[64];
+
+    /* Written by the consumer, under the mutex. */
+    int64_t head;
+    int64_t drained_entries;
+    int64_t out_of_range_count;
+    struct hdr_histogram* active;
+    struct hdr_histogram* inactive;
+    hdr_mutex* mutex;
+}
+HDR_ALIGN_SUFFIX(8);
+
+struct hdr_offload_recorder_stats
+{
+    /* Entries taken off the ring and recorded, or found out of range. */
+    int64_t drained_entries;
+    /* Entries, and the sum of their counts, dropped because the ring was full. */
+    int64_t overflow_entries;
+    int64_t overflow_count;
+    /* Sum of the counts of drained entries out of range for the histogram. */
+    int64_t out_of_range_count;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Initialise the recorder with a ring of 'capacity' entries and an active histogram
+ * as for hdr_init.
+ *
+ * @return 0 on success, EINVAL if 'capacity' is not a power of two of at least 2 or
+ * the histogram parameters are invalid, ENOMEM if the allocation fails.
+ */
+int hdr_offload_recorder_init(
+    struct hdr_offload_recorder* r,
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    int32_t capacity);
+
+/**
+ * As hdr_offload_recorder_init, but the active histogram is taken from the supplied
+ * allocator, as are any histograms created by the recorder when sampling.
+ */
+int hdr_offload_recorder_init_ex(
+    struct hdr_offload_recorder* r,
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    int32_t capacity,
+    const struct hdr_allocator* allocator);
+
+void hdr_offload_recorder_destroy(struct hdr_offload_recorder* r);
+
+/**
+ * Enqueue a value, safe to call from any number of threads.
+ *
+ * @return false if the ring was full and the entry was dropped.
+ */
+bool hdr_offload_recorder_record_value(struct hdr_offload_recorder* r, int64_t value);
+bool hdr_offload_recorder_record_values(struct hdr_offload_recorder* r, int64_t value, int64_t count);
+
+/**
+ * Record the entries on the ring into the active histogram.  Called in a loop by the
+ * thread dedicated to consuming the ring; calls from several threads are serialised.
+ *
+ * @return the number of entries drained.
+ */
+int64_t hdr_offload_recorder_drain(struct hdr_offload_recorder* r);
+
+/**
+ * Drain the ring, then swap the active histogram for 'histogram_to_recycle', as
+ * hdr_interval_recorder_sample_and_recycle does.  If 'histogram_to_recycle' is NULL a
+ * new histogram is created with the active histogram's allocator.  Entries enqueued
+ * while sampling go to the next interval.
+ *
+ * @return the histogram that was previously being recorded to, or NULL if a new
+ * histogram could not be allocated, in which case the active histogram is kept.
+ */
+struct hdr_histogram* hdr_offload_recorder_sample_and_recycle(
+    struct hdr_offload_recorder* r,
+    struct hdr_histogram* histogram_to_recycle);
+
+/**
+ * @deprecated Prefer hdr_offload_recorder_sample_and_recycle
+ * @return the histogram that was previously being recorded to.
+ */
+struct hdr_histogram* hdr_offload_recorder_sample(struct hdr_offload_recorder* r);
+
+void hdr_offload_recorder_get_stats(struct hdr_offload_recorder* r, struct hdr_offload_recorder_stats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,77 @@
+/**
+ * hdr_page_allocator.h
+ * Released to the public domain, as explained at
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * An hdr_allocator that maps histograms directly from the operating system,
+ * optionally backed by huge pages and bound to a NUMA node.  For large
+ * histograms (e.g. 5 significant figures over a ns to hour range) this cuts the
+ * TLB misses taken when recording widely spread values.
+ *
+ * The mapped counts are demand-zero, so only the pages holding recorded values
+ * are ever committed, see hdr_init_lazy.
+ */
+
+#ifndef HDR_PAGE_ALLOCATOR_H
+#define HDR_PAGE_ALLOCATOR_H 1
+
+#include <stdbool.h>
+
+#include <hdr/hdr_histogram.h>
+
+#define HDR_NO_NUMA_NODE (-1)
+
+struct hdr_page_allocator
+{
+    struct hdr_allocator allocator;
+    bool huge_pages;
+    int numa_node;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Initialise a page allocator, pass &allocator->allocator to hdr_init_ex.
+ *
+ * With huge_pages set each allocation is first tried with MAP_HUGETLB, then as 2MB
+ * aligned memory advised with MADV_HUGEPAGE, so at least 2MB is used per histogram.
+ * Allocations smaller than that, or than a page without huge_pages, such as the
+ * occupancy bitmap and moments, come from hdr_calloc instead.
+ * If numa_node is not HDR_NO_NUMA_NODE the memory is bound to that node with mbind.
+ * Both are hints, the allocation falls back to normal pages and the default policy
+ * when they are unavailable.  On platforms other than Linux the default allocator is
+ * used.
+ *
+ * @param allocator The allocator to initialise.
+ * @param huge_pages Whether to try to back allocations with huge pages.
+ * @param numa_node The node to bind allocations to, or HDR_NO_NUMA_NODE.
+ */
+void hdr_page_allocator_init(struct hdr_page_allocator* allocator, bool huge_pages, int numa_node);
+
+/**
+ * Allocate a histogram whose counts are committed lazily, a page (512 counts) at a
+ * time on the first write into it, so memory follows the range of values actually
+ * recorded rather than highest_trackable_value.  Pages never written read as zero.
+ * The occupancy bitmap is enabled, so queries, iterators, hdr_add and the encoders
+ * skip the untouched ranges without reading them.
+ *
+ * Operations that write the whole counts array (hdr_copy_into with a matching
+ * layout, hdr_clone) produce a fully committed histogram.  On platforms other than
+ * Linux this is equivalent to hdr_init followed by hdr_enable_occupancy_bitmap.
+ * The histogram should be released with hdr_close.
+ *
+ * @return As for hdr_init.
+ */
+int hdr_init_lazy(
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    struct hdr_histogram** result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -44,6 +44,17 @@ extern "C" {
     void hdr_phaser_flip_phase(
     struct hdr_writer_reader_phaser* p, int64_t sleep_time_ns);
 
+    /**
+     * As hdr_phaser_flip_phase, but give up waiting for the writers of the previous
+     * phase after 'timeout_ns', e.g. when one of them may have died in its critical
+     * section.  The phase has flipped either way, and a writer that never exits
+     * only holds back the phase it entered, so later flips complete.
+     *
+     * @return 0 once the writers have caught up, ETIMEDOUT otherwise.
+     */
+    int hdr_phaser_flip_phase_with_timeout(
+    struct hdr_writer_reader_phaser* p, int64_t sleep_time_ns, int64_t timeout_ns);
+
 #ifdef __cplusplus
 }
 #endif
@@ -79,6 +79,34 @@ static bool __inline hdr_atomic_compare_exchange_64(volatile int64_t* field, int
     return *expected == _InterlockedCompareExchange64(field, desired, *expected);
 }
 
+static int64_t __inline hdr_atomic_or_fetch_64(volatile int64_t* field, int64_t value)
+{
+#if defined(_WIN64)
+    return _InterlockedOr64(field, value) | value;
+#else
+    int64_t comparand;
+    int64_t initial_value = *field;
+    do
+    {
+        comparand = initial_value;
+        initial_value = _InterlockedCompareExchange64(field, comparand | value, comparand);
+    }
+    while (comparand != initial_value);
+
+    return initial_value | value;
+#endif
+}
+
+static bool __inline hdr_atomic_compare_exchange_32(volatile int32_t* field, int32_t* expected, int32_t desired)
+{
+    return *expected == (int32_t) _InterlockedCompareExchange((volatile long*) field, desired, *expected);
+}
+
+static bool __inline hdr_atomic_compare_exchange_8(volatile uint8_t* field, uint8_t* expected, uint8_t desired)
+{
+    return *expected == (uint8_t) _InterlockedCompareExchange8((volatile char*) field, (char) desired, (char) *expected);
+}
+
 #elif defined(__ATOMIC_SEQ_CST)
 
 #define hdr_atomic_load_pointer(x) __atomic_load_n(x, __ATOMIC_SEQ_CST)
@@ -88,6 +116,9 @@ static bool __inline hdr_atomic_compare_exchange_64(volatile int64_t* field, int
 #define hdr_atomic_exchange_64(f,i) __atomic_exchange_n(f,i, __ATOMIC_SEQ_CST)
 #define hdr_atomic_add_fetch_64(field, value) __atomic_add_fetch(field, value, __ATOMIC_SEQ_CST)
 #define hdr_atomic_compare_exchange_64(field, expected, desired) __atomic_compare_exchange_n(field, expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+#define hdr_atomic_or_fetch_64(field, value) __atomic_or_fetch(field, value, __ATOMIC_SEQ_CST)
+#define hdr_atomic_compare_exchange_32(field, expected, desired) __atomic_compare_exchange_n(field, expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+#define hdr_atomic_compare_exchange_8(field, expected, desired) __atomic_compare_exchange_n(field, expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
 
 #elif defined(__x86_64__)
 
@@ -137,6 +168,25 @@ static inline bool hdr_atomic_compare_exchange_64(volatile int64_t* field, int64
     return original == *expected;
 }
 
+static inline int64_t hdr_atomic_or_fetch_64(volatile int64_t* field, int64_t value)
+{
+    return __sync_or_and_fetch(field, value);
+}
+
+static inline bool hdr_atomic_compare_exchange_32(volatile int32_t* field, int32_t* expected, int32_t desired)
+{
+    int32_t original;
+    asm volatile( "lock; cmpxchgl %2, %1" : "=a"(original), "+m"(*field) : "q"(desired), "0"(*expected));
+    return original == *expected;
+}
+
+static inline bool hdr_atomic_compare_exchange_8(volatile uint8_t* field, uint8_t* expected, uint8_t desired)
+{
+    uint8_t original;
+    asm volatile( "lock; cmpxchgb %2, %1" : "=a"(original), "+m"(*field) : "q"(desired), "0"(*expected));
+    return original == *expected;
+}
+
 #else
 
 #error "Unable to determine atomic operations for your platform"
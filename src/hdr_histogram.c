@@ -7,12 +7,18 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <math.h>
+#include <float.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
 #include <errno.h>
 #include <inttypes.h>
 
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
 #include <hdr/hdr_histogram.h>
 #include "hdr_tests.h"
 #include "hdr_atomic.h"
@@ -83,6 +89,32 @@ static int64_t counts_get_normalised(const struct hdr_histogram* h, int32_t inde
     return counts_get_direct(h, normalize_index(h, index));
 }
 
+static uint64_t occupancy_bit(int32_t index)
+{
+    return UINT64_C(1) << (index & 63);
+}
+
+static void mark_occupied(struct hdr_histogram* h, int32_t index)
+{
+    if (h->occupancy)
+    {
+        h->occupancy[index >> 6] |= occupancy_bit(index);
+    }
+}
+
+static void mark_occupied_atomic(struct hdr_histogram* h, int32_t index)
+{
+    if (h->occupancy)
+    {
+        uint64_t* word = &h->occupancy[index >> 6];
+        /* Avoid the locked operation when the bit is already set, which is the common case. */
+        if (0 == (*word & occupancy_bit(index)))
+        {
+            hdr_atomic_or_fetch_64((int64_t*) word, (int64_t) occupancy_bit(index));
+        }
+    }
+}
+
 static void counts_inc_normalised(
     struct hdr_histogram* h, int32_t index, int64_t value)
 {
@@ -90,30 +122,40 @@ static void counts_inc_normalised(
     {
         HDR_PREFETCH_WRITE(&h->counts[index]);
         h->counts[index] += value;
+        mark_occupied(h, index);
     }
     else
     {
         int32_t normalised_index = normalize_index(h, index);
         HDR_PREFETCH_WRITE(&h->counts[normalised_index]);
         h->counts[normalised_index] += value;
+        mark_occupied(h, normalised_index);
     }
     h->total_count += value;
 }
 
-static void counts_inc_normalised_atomic(
+static void counts_inc_slot_atomic(
     struct hdr_histogram* h, int32_t index, int64_t value)
 {
     if (HDR_LIKELY(h->normalizing_index_offset == 0))
     {
         HDR_PREFETCH_WRITE(&h->counts[index]);
         hdr_atomic_add_fetch_64(&h->counts[index], value);
+        mark_occupied_atomic(h, index);
     }
     else
     {
         int32_t normalised_index = normalize_index(h, index);
         HDR_PREFETCH_WRITE(&h->counts[normalised_index]);
         hdr_atomic_add_fetch_64(&h->counts[normalised_index], value);
+        mark_occupied_atomic(h, normalised_index);
     }
+}
+
+static void counts_inc_normalised_atomic(
+    struct hdr_histogram* h, int32_t index, int64_t value)
+{
+    counts_inc_slot_atomic(h, index, value);
     hdr_atomic_add_fetch_64(&h->total_count, value);
 }
 
@@ -130,7 +172,7 @@ static void update_min_max(struct hdr_histogram* h, int64_t value)
     }
 }
 
-static void update_min_max_atomic(struct hdr_histogram* h, int64_t value)
+void update_min_max_atomic(struct hdr_histogram* h, int64_t value)
 {
     int64_t current_min_value;
     int64_t current_max_value;
@@ -179,8 +221,10 @@ static int64_t power(int64_t base, int64_t exp)
 #if defined(_MSC_VER) && !(defined(__clang__) && (defined(_M_ARM) || defined(_M_ARM64)))
 #   if defined(_WIN64)
 #       pragma intrinsic(_BitScanReverse64)
+#       pragma intrinsic(_BitScanForward64)
 #   else
 #       pragma intrinsic(_BitScanReverse)
+#       pragma intrinsic(_BitScanForward)
 #   endif
 #endif
 
@@ -208,6 +252,27 @@ static int32_t count_leading_zeros_64(int64_t value)
 #endif
 }
 
+static int32_t count_trailing_zeros_64(uint64_t value)
+{
+#if defined(_MSC_VER) && !(defined(__clang__) && (defined(_M_ARM) || defined(_M_ARM64)))
+    uint32_t trailing_zero = 0;
+#if defined(_WIN64)
+    _BitScanForward64(&trailing_zero, value);
+#else
+    uint32_t low = value & 0x00000000FFFFFFFF;
+    if (!_BitScanForward(&trailing_zero, low))
+    {
+        uint32_t high = value >> 32;
+        _BitScanForward(&trailing_zero, high);
+        trailing_zero += 32;
+    }
+#endif
+    return (int32_t) trailing_zero;
+#else
+    return __builtin_ctzll(value);
+#endif
+}
+
 static int32_t get_bucket_index(const struct hdr_histogram* h, int64_t value)
 {
     int32_t pow2ceiling = 64 - count_leading_zeros_64(value | h->sub_bucket_mask); /* smallest power of 2 containing value */
@@ -235,18 +300,93 @@ static int64_t value_from_index(int32_t bucket_index, int32_t sub_bucket_index,
     return ((int64_t) sub_bucket_index) << (bucket_index + unit_magnitude);
 }
 
+/* ######## #### ######## ########   ######  */
+/*    ##     ##  ##       ##     ## ##    ## */
+/*    ##     ##  ##       ##     ## ##       */
+/*    ##     ##  ######   ########   ######  */
+/*    ##     ##  ##       ##   ##         ## */
+/*    ##     ##  ##       ##    ##  ##    ## */
+/*    ##    #### ######## ##     ##  ######  */
+
+/* A tiered histogram keeps the bucket boundaries of its coarsest tier, but a bucket may */
+/* have more, narrower slots.  A value in the bucket lands in slot (value >> shift), */
+/* which is counted at (index_offset + slot). */
+struct hdr_bucket_layout
+{
+    int32_t shift;
+    int32_t index_offset;
+    int32_t first_index;
+};
+
+/* Buckets past the last one extend the last bucket's slot width, as the standard */
+/* layout does, so the equivalent ranges of out of range values stay well defined. */
+static int32_t layout_shift(const struct hdr_histogram* h, int32_t bucket_index)
+{
+    int32_t last = h->bucket_count - 1;
+    return bucket_index <= last ? h->layout[bucket_index].shift : h->layout[last].shift + bucket_index - last;
+}
+
+/* The bucket holding a counts index, a binary search over the first index of each. */
+static int32_t layout_bucket_for_index(const struct hdr_histogram* h, int32_t index)
+{
+    int32_t lo = 0;
+    int32_t hi = h->bucket_count - 1;
+
+    while (lo < hi)
+    {
+        int32_t mid = lo + ((hi - lo + 1) >> 1);
+        if (h->layout[mid].first_index <= index)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+
+    return lo;
+}
+
+static size_t layout_size(const struct hdr_histogram* h)
+{
+    return h->layout ? sizeof(struct hdr_bucket_layout) * (size_t) h->bucket_count : 0;
+}
+
 int32_t counts_index_for(const struct hdr_histogram* h, int64_t value)
 {
     int32_t bucket_index     = get_bucket_index(h, value);
-    int32_t sub_bucket_index = get_sub_bucket_index(value, bucket_index, h->unit_magnitude);
+    int32_t sub_bucket_index;
+
+    if (h->layout)
+    {
+        const struct hdr_bucket_layout* bucket;
+        if (bucket_index >= h->bucket_count)
+        {
+            return h->counts_len;
+        }
+        bucket = &h->layout[bucket_index];
+        return bucket->index_offset + (int32_t) (value >> bucket->shift);
+    }
+
+    sub_bucket_index = get_sub_bucket_index(value, bucket_index, h->unit_magnitude);
 
     return counts_index(h, bucket_index, sub_bucket_index);
 }
 
 int64_t hdr_value_at_index(const struct hdr_histogram *h, int32_t index)
 {
-    int32_t bucket_index = (index >> h->sub_bucket_half_count_magnitude) - 1;
-    int32_t sub_bucket_index = (index & (h->sub_bucket_half_count - 1)) + h->sub_bucket_half_count;
+    int32_t bucket_index;
+    int32_t sub_bucket_index;
+
+    if (h->layout)
+    {
+        const struct hdr_bucket_layout* bucket = &h->layout[layout_bucket_for_index(h, index)];
+        return ((int64_t) (index - bucket->index_offset)) << bucket->shift;
+    }
+
+    bucket_index = (index >> h->sub_bucket_half_count_magnitude) - 1;
+    sub_bucket_index = (index & (h->sub_bucket_half_count - 1)) + h->sub_bucket_half_count;
 
     if (bucket_index < 0)
     {
@@ -260,32 +400,31 @@ int64_t hdr_value_at_index(const struct hdr_histogram *h, int32_t index)
 int64_t hdr_size_of_equivalent_value_range(const struct hdr_histogram* h, int64_t value)
 {
     int32_t bucket_index     = get_bucket_index(h, value);
-    int32_t sub_bucket_index = get_sub_bucket_index(value, bucket_index, h->unit_magnitude);
-    int32_t adjusted_bucket  = (sub_bucket_index >= h->sub_bucket_count) ? (bucket_index + 1) : bucket_index;
-    return INT64_C(1) << (h->unit_magnitude + adjusted_bucket);
-}
+    int32_t sub_bucket_index;
+    int32_t adjusted_bucket;
 
-static int64_t size_of_equivalent_value_range_given_bucket_indices(
-    const struct hdr_histogram *h,
-    int32_t bucket_index,
-    int32_t sub_bucket_index)
-{
-    const int32_t adjusted_bucket  = (sub_bucket_index >= h->sub_bucket_count) ? (bucket_index + 1) : bucket_index;
+    if (h->layout)
+    {
+        return INT64_C(1) << layout_shift(h, bucket_index);
+    }
+
+    sub_bucket_index = get_sub_bucket_index(value, bucket_index, h->unit_magnitude);
+    adjusted_bucket  = (sub_bucket_index >= h->sub_bucket_count) ? (bucket_index + 1) : bucket_index;
     return INT64_C(1) << (h->unit_magnitude + adjusted_bucket);
 }
 
 static int64_t lowest_equivalent_value(const struct hdr_histogram* h, int64_t value)
 {
     int32_t bucket_index     = get_bucket_index(h, value);
-    int32_t sub_bucket_index = get_sub_bucket_index(value, bucket_index, h->unit_magnitude);
-    return value_from_index(bucket_index, sub_bucket_index, h->unit_magnitude);
-}
+    int32_t sub_bucket_index;
 
-static int64_t lowest_equivalent_value_given_bucket_indices(
-    const struct hdr_histogram *h,
-    int32_t bucket_index,
-    int32_t sub_bucket_index)
-{
+    if (h->layout)
+    {
+        int32_t shift = layout_shift(h, bucket_index);
+        return (value >> shift) << shift;
+    }
+
+    sub_bucket_index = get_sub_bucket_index(value, bucket_index, h->unit_magnitude);
     return value_from_index(bucket_index, sub_bucket_index, h->unit_magnitude);
 }
 
@@ -304,6 +443,237 @@ int64_t hdr_median_equivalent_value(const struct hdr_histogram *h, int64_t value
     return lowest_equivalent_value(h, value) + (hdr_size_of_equivalent_value_range(h, value) >> 1);
 }
 
+/* ##     ##  #######  ##     ## ######## ##    ## ########  ######  */
+/* ###   ### ##     ## ###   ### ##       ###   ##    ##    ##    ## */
+/* #### #### ##     ## #### #### ##       ####  ##    ##    ##       */
+/* ## ### ## ##     ## ## ### ## ######   ## ## ##    ##     ######  */
+/* ##     ## ##     ## ##     ## ##       ##  ####    ##          ## */
+/* ##     ## ##     ## ##     ## ##       ##   ###    ##    ##    ## */
+/* ##     ##  #######  ##     ## ######## ##    ##    ##     ######  */
+
+/* 128 bit two's complement integers, wide enough that the sum of squares of any */
+/* realistic series can't overflow, so adding and merging them is exact. */
+struct hdr_int128
+{
+    uint64_t low;
+    uint64_t high;
+};
+
+struct hdr_moments
+{
+    struct hdr_int128 sum;
+    struct hdr_int128 sum_of_squares;
+};
+
+static struct hdr_int128 int128_add(struct hdr_int128 a, struct hdr_int128 b)
+{
+    struct hdr_int128 r;
+    r.low = a.low + b.low;
+    r.high = a.high + b.high + (r.low < b.low);
+    return r;
+}
+
+static struct hdr_int128 int128_negate(struct hdr_int128 a)
+{
+    struct hdr_int128 r;
+    r.low = ~a.low + 1;
+    r.high = ~a.high + (0 == r.low);
+    return r;
+}
+
+/* The low 128 bits of a * b, from 32 bit partial products. */
+static struct hdr_int128 int128_multiply(struct hdr_int128 a, uint64_t b)
+{
+    const uint64_t a0 = a.low & 0xFFFFFFFF, a1 = a.low >> 32;
+    const uint64_t b0 = b & 0xFFFFFFFF, b1 = b >> 32;
+    const uint64_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+    const uint64_t middle = (p00 >> 32) + (p01 & 0xFFFFFFFF) + (p10 & 0xFFFFFFFF);
+    struct hdr_int128 r;
+
+    r.low = (middle << 32) | (p00 & 0xFFFFFFFF);
+    r.high = p11 + (p01 >> 32) + (p10 >> 32) + (middle >> 32) + a.high * b;
+    return r;
+}
+
+/* Arithmetic shift, 0 < shift < 64. */
+static struct hdr_int128 int128_shift_right(struct hdr_int128 a, int32_t shift)
+{
+    struct hdr_int128 r;
+    r.low = (a.low >> shift) | (a.high << (64 - shift));
+    r.high = (uint64_t) ((int64_t) a.high >> shift);
+    return r;
+}
+
+static struct hdr_int128 int128_from(int64_t value)
+{
+    struct hdr_int128 r;
+    r.low = (uint64_t) value;
+    r.high = value < 0 ? UINT64_MAX : 0;
+    return r;
+}
+
+static long double int128_to_long_double(struct hdr_int128 a)
+{
+    return ldexpl((long double) (int64_t) a.high, 64) + (long double) a.low;
+}
+
+static void moments_of(int64_t value, int64_t count, struct hdr_int128* sum, struct hdr_int128* sum_of_squares)
+{
+    *sum = int128_multiply(int128_from(count), (uint64_t) value);
+    *sum_of_squares = int128_multiply(*sum, (uint64_t) value);
+}
+
+static void moments_add(struct hdr_moments* m, int64_t value, int64_t count)
+{
+    struct hdr_int128 sum, sum_of_squares;
+
+    moments_of(value, count, &sum, &sum_of_squares);
+    m->sum = int128_add(m->sum, sum);
+    m->sum_of_squares = int128_add(m->sum_of_squares, sum_of_squares);
+}
+
+/* The low word is added first, its carry is then added to the high word along with */
+/* the high part, so concurrent additions are all accounted for once recording stops. */
+static void int128_add_atomic(struct hdr_int128* a, struct hdr_int128 b)
+{
+    const uint64_t low = (uint64_t) hdr_atomic_add_fetch_64((int64_t*) &a->low, (int64_t) b.low);
+    const uint64_t high = b.high + (low < b.low);
+    if (0 != high)
+    {
+        hdr_atomic_add_fetch_64((int64_t*) &a->high, (int64_t) high);
+    }
+}
+
+static void moments_add_atomic(struct hdr_moments* m, int64_t value, int64_t count)
+{
+    struct hdr_int128 sum, sum_of_squares;
+
+    moments_of(value, count, &sum, &sum_of_squares);
+    int128_add_atomic(&m->sum, sum);
+    int128_add_atomic(&m->sum_of_squares, sum_of_squares);
+}
+
+static void moments_add_equivalents(struct hdr_moments* m, const struct hdr_histogram* from)
+{
+    struct hdr_iter iter;
+
+    hdr_iter_recorded_init(&iter, from);
+    while (hdr_iter_next(&iter))
+    {
+        moments_add(m, iter.median_equivalent_value, iter.count);
+    }
+}
+
+/* Moments of 'count' of each of the 'n' values first, first + interval, ..., using */
+/* n(n-1)/2 and n(n-1)(2n-1)/6 for the sums of the steps and of their squares. */
+static void moments_add_sequence(
+    struct hdr_moments* m, int64_t first, int64_t interval, int64_t n, int64_t count, bool atomic)
+{
+    uint64_t x = (uint64_t) n, y = (uint64_t) n - 1, z = 2 * (uint64_t) n - 1;
+    struct hdr_int128 steps, squared_steps, sum, sum_of_squares;
+    const uint64_t magnitude = count < 0 ? (uint64_t) -count : (uint64_t) count;
+
+    /* Divide the factors rather than the products, so the products stay exact. */
+    if (0 == x % 2)
+    {
+        x /= 2;
+    }
+    else
+    {
+        y /= 2;
+    }
+    steps = int128_multiply(int128_from((int64_t) x), y);
+    if (0 == x % 3)
+    {
+        x /= 3;
+    }
+    else if (0 == y % 3)
+    {
+        y /= 3;
+    }
+    else
+    {
+        z /= 3;
+    }
+    squared_steps = int128_multiply(int128_multiply(int128_from((int64_t) x), y), z);
+
+    sum = int128_add(
+        int128_multiply(int128_from(first), (uint64_t) n),
+        int128_multiply(steps, (uint64_t) interval));
+    sum_of_squares = int128_add(
+        int128_multiply(int128_multiply(int128_from(first), (uint64_t) first), (uint64_t) n),
+        int128_add(
+            int128_multiply(int128_multiply(int128_multiply(steps, (uint64_t) first), (uint64_t) interval), 2),
+            int128_multiply(int128_multiply(squared_steps, (uint64_t) interval), (uint64_t) interval)));
+
+    sum = int128_multiply(sum, magnitude);
+    sum_of_squares = int128_multiply(sum_of_squares, magnitude);
+    if (count < 0)
+    {
+        sum = int128_negate(sum);
+        sum_of_squares = int128_negate(sum_of_squares);
+    }
+
+    if (atomic)
+    {
+        int128_add_atomic(&m->sum, sum);
+        int128_add_atomic(&m->sum_of_squares, sum_of_squares);
+    }
+    else
+    {
+        m->sum = int128_add(m->sum, sum);
+        m->sum_of_squares = int128_add(m->sum_of_squares, sum_of_squares);
+    }
+}
+
+/* Add the moments of the values in 'from' to those of 'h', exactly if 'from' tracks */
+/* them, otherwise from the median equivalent value of each recorded bucket. */
+static void moments_add_histogram(struct hdr_histogram* h, const struct hdr_histogram* from)
+{
+    if (NULL == h->moments)
+    {
+        return;
+    }
+    if (NULL == from->moments)
+    {
+        moments_add_equivalents(h->moments, from);
+        return;
+    }
+
+    h->moments->sum = int128_add(h->moments->sum, from->moments->sum);
+    h->moments->sum_of_squares = int128_add(h->moments->sum_of_squares, from->moments->sum_of_squares);
+}
+
+/* Scale the moments for every value being multiplied by 2^shift, or divided by */
+/* 2^-shift, 0 < |shift| < 64. */
+static void moments_shift(struct hdr_histogram* h, int32_t shift)
+{
+    struct hdr_moments* m = h->moments;
+
+    if (NULL == m)
+    {
+        return;
+    }
+    if (shift > 0)
+    {
+        m->sum = int128_multiply(m->sum, UINT64_C(1) << shift);
+        m->sum_of_squares = int128_multiply(int128_multiply(m->sum_of_squares, UINT64_C(1) << shift), UINT64_C(1) << shift);
+    }
+    else
+    {
+        m->sum = int128_shift_right(m->sum, -shift);
+        m->sum_of_squares = int128_shift_right(int128_shift_right(m->sum_of_squares, -shift), -shift);
+    }
+}
+
+static void moments_reset(struct hdr_histogram* h)
+{
+    if (h->moments)
+    {
+        memset(h->moments, 0, sizeof(struct hdr_moments));
+    }
+}
+
 static int64_t non_zero_min(const struct hdr_histogram* h)
 {
     if (INT64_MAX == h->min_value)
@@ -314,6 +684,72 @@ static int64_t non_zero_min(const struct hdr_histogram* h)
     return lowest_equivalent_value(h, h->min_value);
 }
 
+static int32_t occupancy_len(const struct hdr_histogram* h)
+{
+    return (h->counts_len + 63) >> 6;
+}
+
+static void rebuild_occupancy(struct hdr_histogram* h)
+{
+    int32_t i;
+
+    memset(h->occupancy, 0, sizeof(uint64_t) * (size_t) occupancy_len(h));
+    for (i = 0; i < h->counts_len; i++)
+    {
+        if (0 != h->counts[i])
+        {
+            mark_occupied(h, i);
+        }
+    }
+}
+
+int32_t counts_next_non_zero_index(const struct hdr_histogram* h, int32_t index, int32_t end)
+{
+    const int64_t* counts = h->counts;
+
+    if (h->occupancy)
+    {
+        while (index < end)
+        {
+            int32_t word_index = index >> 6;
+            uint64_t word = h->occupancy[word_index] & (~UINT64_C(0) << (index & 63));
+
+            while (0 == word)
+            {
+                word_index++;
+                if ((word_index << 6) >= end)
+                {
+                    return end;
+                }
+                word = h->occupancy[word_index];
+            }
+
+            index = (word_index << 6) + count_trailing_zeros_64(word);
+            if (index >= end || 0 != counts[index])
+            {
+                break;
+            }
+
+            /* Bits are never cleared by recording, so skip slots that have returned to zero. */
+            index++;
+        }
+
+        return index < end ? index : end;
+    }
+
+    while (index + 4 <= end && 0 == (counts[index] | counts[index + 1] | counts[index + 2] | counts[index + 3]))
+    {
+        index += 4;
+    }
+
+    while (index < end && 0 == counts[index])
+    {
+        index++;
+    }
+
+    return index;
+}
+
 void hdr_reset_internal_counters(struct hdr_histogram* h)
 {
     int min_non_zero_index = -1;
@@ -325,7 +761,7 @@ void hdr_reset_internal_counters(struct hdr_histogram* h)
     {
         int64_t count_at_index;
 
-        if ((count_at_index = counts_get_direct(h, i)) > 0)
+        if ((count_at_index = counts_get_normalised(h, i)) > 0)
         {
             observed_total_count += count_at_index;
             max_index = i;
@@ -356,6 +792,11 @@ void hdr_reset_internal_counters(struct hdr_histogram* h)
     }
 
     h->total_count = observed_total_count;
+
+    if (h->occupancy)
+    {
+        rebuild_occupancy(h);
+    }
 }
 
 static int32_t buckets_needed_to_cover_value(int64_t value, int32_t sub_bucket_count, int32_t unit_magnitude)
@@ -375,6 +816,13 @@ static int32_t buckets_needed_to_cover_value(int64_t value, int32_t sub_bucket_c
     return buckets_needed;
 }
 
+static int32_t sub_bucket_half_count_magnitude_for(int significant_figures)
+{
+    int64_t largest_value_with_single_unit_resolution = 2 * power(10, significant_figures);
+    int32_t sub_bucket_count_magnitude = (int32_t) ceil(log((double)largest_value_with_single_unit_resolution) / log(2));
+    return ((sub_bucket_count_magnitude > 1) ? sub_bucket_count_magnitude : 1) - 1;
+}
+
 /* ##     ## ######## ##     ##  #######  ########  ##    ## */
 /* ###   ### ##       ###   ### ##     ## ##     ##  ##  ##  */
 /* #### #### ##       #### #### ##     ## ##     ##   ####   */
@@ -389,9 +837,6 @@ int hdr_calculate_bucket_config(
     int significant_figures,
     struct hdr_histogram_bucket_config* cfg)
 {
-    int32_t sub_bucket_count_magnitude;
-    int64_t largest_value_with_single_unit_resolution;
-
     if (lowest_discernible_value < 1 ||
             significant_figures < 1 || 5 < significant_figures ||
             lowest_discernible_value * 2 > highest_trackable_value)
@@ -403,9 +848,7 @@ int hdr_calculate_bucket_config(
     cfg->significant_figures = significant_figures;
     cfg->highest_trackable_value = highest_trackable_value;
 
-    largest_value_with_single_unit_resolution = 2 * power(10, significant_figures);
-    sub_bucket_count_magnitude = (int32_t) ceil(log((double)largest_value_with_single_unit_resolution) / log(2));
-    cfg->sub_bucket_half_count_magnitude = ((sub_bucket_count_magnitude > 1) ? sub_bucket_count_magnitude : 1) - 1;
+    cfg->sub_bucket_half_count_magnitude = sub_bucket_half_count_magnitude_for(significant_figures);
 
     double unit_magnitude = log((double)lowest_discernible_value) / log(2);
     if (INT32_MAX < unit_magnitude)
@@ -446,70 +889,570 @@ void hdr_init_preallocated(struct hdr_histogram* h, struct hdr_histogram_bucket_
     h->bucket_count                    = cfg->bucket_count;
     h->counts_len                      = cfg->counts_len;
     h->total_count                     = 0;
+    h->occupancy                       = NULL;
+    h->layout                          = NULL;
+    h->moments                         = NULL;
+    h->allocator                       = NULL;
+    h->allocation                      = h;
 }
 
-int hdr_init(
-    int64_t lowest_discernible_value,
-    int64_t highest_trackable_value,
-    int significant_figures,
-    struct hdr_histogram** result)
+#define HDR_CACHE_LINE_SIZE 64
+
+static size_t allocation_size(int32_t counts_len)
 {
-    int64_t* counts;
-    struct hdr_histogram_bucket_config cfg;
-    struct hdr_histogram* histogram;
+    return HDR_CACHE_LINE_SIZE - 1 + sizeof(struct hdr_histogram) + sizeof(int64_t) * (size_t) counts_len;
+}
 
-    int r = hdr_calculate_bucket_config(lowest_discernible_value, highest_trackable_value, significant_figures, &cfg);
-    if (r)
-    {
-        return r;
-    }
+size_t hdr_calculate_allocation_size(const struct hdr_histogram_bucket_config* cfg)
+{
+    return allocation_size(cfg->counts_len);
+}
+
+/* The header goes on the first cache line boundary in the allocation, the counts directly follow it. */
+static struct hdr_histogram* histogram_in_allocation(void* allocation)
+{
+    uintptr_t address = (uintptr_t) allocation + HDR_CACHE_LINE_SIZE - 1;
+    return (struct hdr_histogram*) (address & ~(uintptr_t) (HDR_CACHE_LINE_SIZE - 1));
+}
+
+static int64_t* inline_counts(const struct hdr_histogram* h)
+{
+    return (int64_t*) (h + 1);
+}
+
+static void* allocator_malloc(const struct hdr_allocator* allocator, size_t size)
+{
+    return allocator ? allocator->allocate(allocator->context, size) : hdr_malloc(size);
+}
+
+static void* allocator_calloc(const struct hdr_allocator* allocator, size_t count, size_t size)
+{
+    void* ptr;
 
-    counts = (int64_t*) hdr_calloc((size_t) cfg.counts_len, sizeof(int64_t));
-    if (!counts)
+    if (!allocator)
     {
-        return ENOMEM;
+        return hdr_calloc(count, size);
     }
 
-    histogram = (struct hdr_histogram*) hdr_calloc(1, sizeof(struct hdr_histogram));
-    if (!histogram)
+    ptr = allocator->allocate(allocator->context, count * size);
+    if (ptr)
     {
-        hdr_free(counts);
-        return ENOMEM;
+        memset(ptr, 0, count * size);
     }
 
-    histogram->counts = counts;
-
-    hdr_init_preallocated(histogram, &cfg);
-    *result = histogram;
-
-    return 0;
+    return ptr;
 }
 
-void hdr_close(struct hdr_histogram* h)
+static void allocator_free(const struct hdr_allocator* allocator, void* ptr)
 {
-    if (h) {
-	hdr_free(h->counts);
-	hdr_free(h);
+    if (!allocator)
+    {
+        hdr_free(ptr);
+    }
+    else if (ptr && allocator->release)
+    {
+        allocator->release(allocator->context, ptr);
     }
 }
 
-int hdr_alloc(int64_t highest_trackable_value, int significant_figures, struct hdr_histogram** result)
+/* Allocate a histogram header followed by 'size' bytes.  Without an allocator the */
+/* allocation is aligned where the platform allows, so the header starts it and */
+/* free(h) releases the header and counts as it did before they shared an allocation. */
+static void* allocate_histogram(const struct hdr_allocator* allocator, size_t size)
 {
-    return hdr_init(1, highest_trackable_value, significant_figures, result);
-}
+#if defined(hdr_aligned_alloc)
+    if (!allocator)
+    {
+        void* allocation;
+        return 0 == hdr_aligned_alloc(&allocation, HDR_CACHE_LINE_SIZE, sizeof(struct hdr_histogram) + size) ?
+            allocation : NULL;
+    }
+#endif
+
+    return allocator_malloc(allocator, HDR_CACHE_LINE_SIZE - 1 + sizeof(struct hdr_histogram) + size);
+}
+
+int hdr_init(
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    struct hdr_histogram** result)
+{
+    return hdr_init_ex(lowest_discernible_value, highest_trackable_value, significant_figures, NULL, result);
+}
+
+int hdr_init_ex(
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    const struct hdr_allocator* allocator,
+    struct hdr_histogram** result)
+{
+    void* allocation;
+    struct hdr_histogram_bucket_config cfg;
+    struct hdr_histogram* histogram;
+
+    int r = hdr_calculate_bucket_config(lowest_discernible_value, highest_trackable_value, significant_figures, &cfg);
+    if (r)
+    {
+        return r;
+    }
+
+    allocation = allocate_histogram(allocator, sizeof(int64_t) * (size_t) cfg.counts_len);
+    if (!allocation)
+    {
+        return ENOMEM;
+    }
+
+    histogram = histogram_in_allocation(allocation);
+    memset(histogram, 0, sizeof(struct hdr_histogram));
+    histogram->counts = inline_counts(histogram);
+    if (!allocator || !allocator->zeroed)
+    {
+        memset(histogram->counts, 0, sizeof(int64_t) * (size_t) cfg.counts_len);
+    }
+
+    hdr_init_preallocated(histogram, &cfg);
+    histogram->allocator = allocator;
+    histogram->allocation = allocation;
+    *result = histogram;
+
+    return 0;
+}
+
+/* The bucket boundaries are those of the coarsest tier.  The sub-bucket half count */
+/* magnitude of a bucket is that of the finest tier overlapping the values it covers, */
+/* up to the magnitude giving single unit slots. */
+static int32_t tiered_bucket_magnitude(
+    const struct hdr_histogram_bucket_config* cfg,
+    const struct hdr_precision_tier* tiers,
+    int32_t tier_count,
+    int32_t bucket_index)
+{
+    int32_t first_magnitude = cfg->unit_magnitude + cfg->sub_bucket_half_count_magnitude + bucket_index;
+    int64_t bucket_first = INT64_C(1) << first_magnitude;
+    int64_t bucket_last = first_magnitude + 1 < 63 ? (INT64_C(1) << (first_magnitude + 1)) - 1 : INT64_MAX;
+    int significant_figures = 0;
+    int32_t magnitude;
+    int32_t i;
+
+    /* Bucket 0 already has single unit slots. */
+    if (0 == bucket_index)
+    {
+        return cfg->sub_bucket_half_count_magnitude;
+    }
+
+    for (i = 0; i < tier_count; i++)
+    {
+        int64_t tier_first = 0 == i ? 0 : tiers[i].lowest_value;
+        int64_t tier_last = i + 1 < tier_count ? tiers[i + 1].lowest_value - 1 : INT64_MAX;
+
+        if (tier_first <= bucket_last && bucket_first <= tier_last && tiers[i].significant_figures > significant_figures)
+        {
+            significant_figures = tiers[i].significant_figures;
+        }
+    }
+
+    magnitude = sub_bucket_half_count_magnitude_for(significant_figures);
+
+    return magnitude < cfg->sub_bucket_half_count_magnitude + bucket_index ?
+        magnitude : cfg->sub_bucket_half_count_magnitude + bucket_index;
+}
+
+int hdr_init_tiered(
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    const struct hdr_precision_tier* tiers,
+    int32_t tier_count,
+    struct hdr_histogram** result)
+{
+    return hdr_init_tiered_ex(lowest_discernible_value, highest_trackable_value, tiers, tier_count, NULL, result);
+}
+
+int hdr_init_tiered_ex(
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    const struct hdr_precision_tier* tiers,
+    int32_t tier_count,
+    const struct hdr_allocator* allocator,
+    struct hdr_histogram** result)
+{
+    void* allocation;
+    struct hdr_histogram_bucket_config cfg;
+    struct hdr_histogram* histogram;
+    struct hdr_bucket_layout* layout;
+    int lowest_significant_figures = 5;
+    int highest_significant_figures = 1;
+    int32_t counts_len = 0;
+    int32_t i;
+    int r;
+
+    if (NULL == tiers || tier_count < 1)
+    {
+        return EINVAL;
+    }
+    for (i = 0; i < tier_count; i++)
+    {
+        if (tiers[i].significant_figures < 1 || 5 < tiers[i].significant_figures ||
+            (i > 0 && tiers[i].lowest_value <= tiers[i - 1].lowest_value))
+        {
+            return EINVAL;
+        }
+        if (tiers[i].significant_figures < lowest_significant_figures)
+        {
+            lowest_significant_figures = tiers[i].significant_figures;
+        }
+        if (tiers[i].significant_figures > highest_significant_figures)
+        {
+            highest_significant_figures = tiers[i].significant_figures;
+        }
+    }
+
+    r = hdr_calculate_bucket_config(
+        lowest_discernible_value, highest_trackable_value, lowest_significant_figures, &cfg);
+    if (r)
+    {
+        return r;
+    }
+
+    for (i = 0; i < cfg.bucket_count; i++)
+    {
+        int32_t magnitude = tiered_bucket_magnitude(&cfg, tiers, tier_count, i);
+        counts_len += (0 == i ? 2 : 1) << magnitude;
+    }
+
+    /* The layout table follows the counts in the same allocation. */
+    allocation = allocate_histogram(
+        allocator,
+        sizeof(int64_t) * (size_t) counts_len + sizeof(struct hdr_bucket_layout) * (size_t) cfg.bucket_count);
+    if (!allocation)
+    {
+        return ENOMEM;
+    }
+
+    histogram = histogram_in_allocation(allocation);
+    memset(histogram, 0, sizeof(struct hdr_histogram));
+    histogram->counts = inline_counts(histogram);
+    if (!allocator || !allocator->zeroed)
+    {
+        memset(histogram->counts, 0, sizeof(int64_t) * (size_t) counts_len);
+    }
+    layout = (struct hdr_bucket_layout*) (histogram->counts + counts_len);
+
+    counts_len = 0;
+    for (i = 0; i < cfg.bucket_count; i++)
+    {
+        int32_t magnitude = tiered_bucket_magnitude(&cfg, tiers, tier_count, i);
+
+        /* Slots of bucket 0 start from zero, those of later buckets from the half count. */
+        layout[i].shift = cfg.unit_magnitude + i + cfg.sub_bucket_half_count_magnitude - magnitude;
+        layout[i].first_index = counts_len;
+        layout[i].index_offset = 0 == i ? 0 : counts_len - (1 << magnitude);
+        counts_len += (0 == i ? 2 : 1) << magnitude;
+    }
+
+    hdr_init_preallocated(histogram, &cfg);
+    histogram->significant_figures = highest_significant_figures;
+    histogram->counts_len = counts_len;
+    histogram->layout = layout;
+    histogram->allocator = allocator;
+    histogram->allocation = allocation;
+    *result = histogram;
+
+    return 0;
+}
+
+void hdr_close(struct hdr_histogram* h)
+{
+    if (h) {
+	if (h->counts != inline_counts(h))
+	{
+	    allocator_free(h->allocator, h->counts);
+	}
+	allocator_free(h->allocator, h->occupancy);
+	allocator_free(h->allocator, h->moments);
+	allocator_free(h->allocator, h->allocation);
+    }
+}
+
+/* Zero the inline counts of the histogram in 'allocation' that can have been written, */
+/* the slots up to its max, for allocators handing the memory out again as zeroed. */
+/* Called from the release of 'allocation' by hdr_close, the header is still intact. */
+void clear_counts_in_allocation(void* allocation, int32_t counts_len)
+{
+    struct hdr_histogram* h = histogram_in_allocation(allocation);
+    int64_t* counts = inline_counts(h);
+    int32_t hi = counts_len - 1;
+
+    if (h->counts == counts && 0 == h->normalizing_index_offset && counts_len == h->counts_len)
+    {
+        hi = counts_index_for(h, h->max_value);
+        hi = hi < counts_len ? hi : counts_len - 1;
+    }
+
+    memset(counts, 0, sizeof(int64_t) * (size_t) (hi + 1));
+}
+
+int hdr_alloc(int64_t highest_trackable_value, int significant_figures, struct hdr_histogram** result)
+{
+    return hdr_init(1, highest_trackable_value, significant_figures, result);
+}
+
+int hdr_enable_occupancy_bitmap(struct hdr_histogram* h)
+{
+    if (h->occupancy)
+    {
+        return 0;
+    }
+
+    h->occupancy = (uint64_t*) allocator_calloc(h->allocator, (size_t) occupancy_len(h), sizeof(uint64_t));
+    if (!h->occupancy)
+    {
+        return ENOMEM;
+    }
+
+    /* An empty histogram has nothing to mark, don't read (and so map) all of its counts. */
+    if (0 != h->total_count)
+    {
+        rebuild_occupancy(h);
+    }
+
+    return 0;
+}
+
+int hdr_enable_moments(struct hdr_histogram* h)
+{
+    if (h->moments)
+    {
+        return 0;
+    }
+
+    h->moments = (struct hdr_moments*) allocator_calloc(h->allocator, 1, sizeof(struct hdr_moments));
+    if (!h->moments)
+    {
+        return ENOMEM;
+    }
+
+    if (0 != h->total_count)
+    {
+        moments_add_equivalents(h->moments, h);
+    }
+
+    return 0;
+}
+
+static void reset_occupied_counts(struct hdr_histogram* h)
+{
+    int32_t i;
+    const int32_t len = occupancy_len(h);
+
+    for (i = 0; i < len; i++)
+    {
+        uint64_t word = h->occupancy[i];
+        while (0 != word)
+        {
+            h->counts[(i << 6) + count_trailing_zeros_64(word)] = 0;
+            word &= word - 1;
+        }
+        h->occupancy[i] = 0;
+    }
+}
+
+/* Recording always maintains max, so only the slots up to it can have been written. */
+/* The min is not relied on: several paths (adding, shifting, values below the unit */
+/* in slot 0) only keep it to bucket precision, and the slots below it are few. */
+static bool touched_counts_range(const struct hdr_histogram* h, int32_t* lo, int32_t* hi)
+{
+    if (h->normalizing_index_offset != 0)
+    {
+        return false;
+    }
+
+    *hi = counts_index_for(h, h->max_value);
+    *hi = *hi < h->counts_len ? *hi : h->counts_len - 1;
+    *lo = 0;
+
+    return true;
+}
+
+static void reset_counts_range(struct hdr_histogram* h, int32_t lo, int32_t hi)
+{
+    memset(&h->counts[lo], 0, sizeof(int64_t) * (size_t) (hi - lo + 1));
+}
 
 /* reset a histogram to zero. */
 void hdr_reset(struct hdr_histogram *h)
 {
+     int32_t lo, hi;
+
+     if (h->occupancy)
+     {
+         reset_occupied_counts(h);
+     }
+     else if (touched_counts_range(h, &lo, &hi))
+     {
+         reset_counts_range(h, lo, hi);
+     }
+     else
+     {
+         memset(h->counts, 0, (sizeof(int64_t) * h->counts_len));
+     }
+
      h->total_count=0;
      h->min_value = INT64_MAX;
      h->max_value = 0;
-     memset(h->counts, 0, (sizeof(int64_t) * h->counts_len));
+     h->normalizing_index_offset = 0;
+     moments_reset(h);
+}
+
+void hdr_reset_release_pages(struct hdr_histogram* h)
+{
+#if defined(__linux__)
+    int32_t lo, hi;
+    const uintptr_t page_size = (uintptr_t) sysconf(_SC_PAGESIZE);
+    uintptr_t start, end, page_start, page_end;
+
+    if (!touched_counts_range(h, &lo, &hi))
+    {
+        lo = 0;
+        hi = h->counts_len - 1;
+    }
+
+    start = (uintptr_t) &h->counts[lo];
+    end = (uintptr_t) &h->counts[hi + 1];
+    page_start = (start + page_size - 1) & ~(page_size - 1);
+    page_end = end & ~(page_size - 1);
+
+    if (page_start < page_end &&
+        0 == madvise((void*) page_start, page_end - page_start, MADV_DONTNEED))
+    {
+        /* Whole pages are handed back and will read as zero, only the edges need clearing. */
+        h->counts[0] = 0;
+        memset((void*) start, 0, page_start - start);
+        memset((void*) page_end, 0, end - page_end);
+
+        if (h->occupancy)
+        {
+            memset(h->occupancy, 0, sizeof(uint64_t) * (size_t) occupancy_len(h));
+        }
+
+        h->total_count = 0;
+        h->min_value = INT64_MAX;
+        h->max_value = 0;
+        h->normalizing_index_offset = 0;
+        moments_reset(h);
+        return;
+    }
+#endif
+
+    hdr_reset(h);
 }
 
 size_t hdr_get_memory_size(struct hdr_histogram *h)
 {
-    return sizeof(struct hdr_histogram) + h->counts_len * sizeof(int64_t);
+    size_t size = sizeof(struct hdr_histogram) + h->counts_len * sizeof(int64_t) + layout_size(h);
+    if (h->occupancy)
+    {
+        size += sizeof(uint64_t) * (size_t) occupancy_len(h);
+    }
+    if (h->moments)
+    {
+        size += sizeof(struct hdr_moments);
+    }
+    return size;
+}
+
+static bool has_same_counts_layout(const struct hdr_histogram* a, const struct hdr_histogram* b)
+{
+    return a->counts_len == b->counts_len &&
+        a->unit_magnitude == b->unit_magnitude &&
+        a->sub_bucket_half_count_magnitude == b->sub_bucket_half_count_magnitude &&
+        (a->layout == b->layout ||
+            (a->layout && b->layout && a->bucket_count == b->bucket_count &&
+                0 == memcmp(a->layout, b->layout, layout_size(a))));
+}
+
+int64_t hdr_copy_into(struct hdr_histogram* dst, const struct hdr_histogram* src)
+{
+    int64_t dropped;
+
+    if (dst == src)
+    {
+        return 0;
+    }
+
+    if (has_same_counts_layout(dst, src) && src->max_value <= dst->highest_trackable_value)
+    {
+        /* Identical geometry, so the raw (un-normalised) counts and the offset can be taken as is. */
+        memcpy(dst->counts, src->counts, sizeof(int64_t) * src->counts_len);
+        if (dst->occupancy && src->occupancy)
+        {
+            memcpy(dst->occupancy, src->occupancy, sizeof(uint64_t) * (size_t) occupancy_len(src));
+        }
+        else if (dst->occupancy)
+        {
+            rebuild_occupancy(dst);
+        }
+        dst->normalizing_index_offset = src->normalizing_index_offset;
+        dst->conversion_ratio         = src->conversion_ratio;
+        dst->min_value                = src->min_value;
+        dst->max_value                = src->max_value;
+        dst->total_count              = src->total_count;
+        moments_reset(dst);
+        moments_add_histogram(dst, src);
+
+        return 0;
+    }
+
+    hdr_reset(dst);
+    dst->normalizing_index_offset = 0;
+    dst->conversion_ratio         = src->conversion_ratio;
+
+    dropped = hdr_add(dst, src);
+
+    return dropped;
+}
+
+int hdr_clone(const struct hdr_histogram* src, struct hdr_histogram** result)
+{
+    void* allocation;
+    struct hdr_histogram* histogram;
+    size_t counts_size = sizeof(int64_t) * (size_t) src->counts_len;
+
+    allocation = allocate_histogram(src->allocator, counts_size + layout_size(src));
+    if (!allocation)
+    {
+        return ENOMEM;
+    }
+
+    histogram = histogram_in_allocation(allocation);
+    memcpy(histogram, src, sizeof(struct hdr_histogram));
+    histogram->counts = inline_counts(histogram);
+    histogram->occupancy = NULL;
+    histogram->moments = NULL;
+    histogram->allocation = allocation;
+    memcpy(histogram->counts, src->counts, counts_size);
+    if (src->layout)
+    {
+        struct hdr_bucket_layout* layout = (struct hdr_bucket_layout*) (histogram->counts + src->counts_len);
+        memcpy(layout, src->layout, layout_size(src));
+        histogram->layout = layout;
+    }
+
+    if ((src->occupancy && 0 != hdr_enable_occupancy_bitmap(histogram)) ||
+        (src->moments && 0 != hdr_enable_moments(histogram)))
+    {
+        hdr_close(histogram);
+        return ENOMEM;
+    }
+    if (src->moments)
+    {
+        *histogram->moments = *src->moments;
+    }
+
+    *result = histogram;
+
+    return 0;
 }
 
 /* ##     ## ########  ########     ###    ######## ########  ######  */
@@ -531,7 +1474,8 @@ bool hdr_record_value_atomic(struct hdr_histogram* h, int64_t value)
     return hdr_record_values_atomic(h, value, 1);
 }
 
-bool hdr_record_values(struct hdr_histogram* h, int64_t value, int64_t count)
+/* Records into the counts only, the callers account for the moments. */
+static bool record_values(struct hdr_histogram* h, int64_t value, int64_t count)
 {
     int32_t counts_index;
 
@@ -552,6 +1496,21 @@ bool hdr_record_values(struct hdr_histogram* h, int64_t value, int64_t count)
     return true;
 }
 
+bool hdr_record_values(struct hdr_histogram* h, int64_t value, int64_t count)
+{
+    if (!record_values(h, value, count))
+    {
+        return false;
+    }
+
+    if (h->moments)
+    {
+        moments_add(h->moments, value, count);
+    }
+
+    return true;
+}
+
 bool hdr_record_values_atomic(struct hdr_histogram* h, int64_t value, int64_t count)
 {
     int32_t counts_index;
@@ -570,115 +1529,747 @@ bool hdr_record_values_atomic(struct hdr_histogram* h, int64_t value, int64_t co
 
     counts_inc_normalised_atomic(h, counts_index, count);
     update_min_max_atomic(h, value);
+    if (h->moments)
+    {
+        moments_add_atomic(h->moments, value, count);
+    }
 
     return true;
 }
 
-bool hdr_record_corrected_value(struct hdr_histogram* h, int64_t value, int64_t expected_interval)
-{
-    return hdr_record_corrected_values(h, value, 1, expected_interval);
-}
+/* Values are combined per slot a chunk at a time, in an open addressed table on the */
+/* stack at most half full. */
+#define HDR_BATCH_CHUNK_LENGTH 256
+#define HDR_BATCH_TABLE_MAGNITUDE 9
 
-bool hdr_record_corrected_value_atomic(struct hdr_histogram* h, int64_t value, int64_t expected_interval)
+static void flush_batch_slots(struct hdr_histogram* h, int32_t* indexes, int64_t* counts)
+{
+    int32_t i;
+
+    for (i = 0; i < (1 << HDR_BATCH_TABLE_MAGNITUDE); i++)
+    {
+        if (indexes[i] >= 0)
+        {
+            counts_inc_slot_atomic(h, indexes[i], counts[i]);
+            indexes[i] = -1;
+        }
+    }
+}
+
+int64_t hdr_record_values_atomic_batch(struct hdr_histogram* h, const int64_t* values, int32_t length)
+{
+    int32_t indexes[1 << HDR_BATCH_TABLE_MAGNITUDE];
+    int64_t counts[1 << HDR_BATCH_TABLE_MAGNITUDE];
+    struct hdr_moments moments;
+    int64_t min = INT64_MAX;
+    int64_t max = 0;
+    int64_t recorded = 0;
+    int32_t chunk = 0;
+    int32_t i;
+
+    memset(&moments, 0, sizeof(moments));
+    for (i = 0; i < (1 << HDR_BATCH_TABLE_MAGNITUDE); i++)
+    {
+        indexes[i] = -1;
+    }
+
+    for (i = 0; i < length; i++)
+    {
+        const int64_t value = values[i];
+        int32_t counts_index;
+        uint32_t slot;
+
+        if (value < 0 || h->highest_trackable_value < value)
+        {
+            continue;
+        }
+
+        counts_index = counts_index_for(h, value);
+        if ((uint32_t)counts_index >= (uint32_t)h->counts_len)
+        {
+            continue;
+        }
+
+        slot = ((uint32_t) counts_index * UINT32_C(2654435769)) >> (32 - HDR_BATCH_TABLE_MAGNITUDE);
+        while (indexes[slot] >= 0 && indexes[slot] != counts_index)
+        {
+            slot = (slot + 1) & ((1 << HDR_BATCH_TABLE_MAGNITUDE) - 1);
+        }
+        if (indexes[slot] < 0)
+        {
+            indexes[slot] = counts_index;
+            counts[slot] = 0;
+        }
+        counts[slot]++;
+
+        min = (0 != value && value < min) ? value : min;
+        max = value > max ? value : max;
+        if (h->moments)
+        {
+            moments_add(&moments, value, 1);
+        }
+        recorded++;
+
+        if (++chunk == HDR_BATCH_CHUNK_LENGTH)
+        {
+            flush_batch_slots(h, indexes, counts);
+            chunk = 0;
+        }
+    }
+
+    if (0 == recorded)
+    {
+        return length;
+    }
+
+    flush_batch_slots(h, indexes, counts);
+    hdr_atomic_add_fetch_64(&h->total_count, recorded);
+    update_min_max_atomic(h, max);
+    if (INT64_MAX != min && min != max)
+    {
+        update_min_max_atomic(h, min);
+    }
+    if (h->moments)
+    {
+        int128_add_atomic(&h->moments->sum, moments.sum);
+        int128_add_atomic(&h->moments->sum_of_squares, moments.sum_of_squares);
+    }
+
+    return length - recorded;
+}
+
+bool hdr_record_corrected_value(struct hdr_histogram* h, int64_t value, int64_t expected_interval)
+{
+    return hdr_record_corrected_values(h, value, 1, expected_interval);
+}
+
+bool hdr_record_corrected_value_atomic(struct hdr_histogram* h, int64_t value, int64_t expected_interval)
 {
     return hdr_record_corrected_values_atomic(h, value, 1, expected_interval);
 }
 
+/* The values missed while 'value' stalled recording form the arithmetic sequence */
+/* value - expected_interval, value - 2 * expected_interval, ... down to expected_interval. */
+/* The run of them falling in each slot is counted in one step, so the cost is one */
+/* update per slot touched rather than one per missing value. */
+static void record_missing_values(
+    struct hdr_histogram* h, int64_t value, int64_t count, int64_t expected_interval, bool atomic)
+{
+    const int64_t n = value / expected_interval - 1;
+    const int64_t first = value - n * expected_interval;
+    const int64_t last = value - expected_interval;
+    int64_t missing_value = first;
+
+    while (missing_value <= last)
+    {
+        const int64_t slot_last = highest_equivalent_value(h, missing_value);
+        const int64_t run = ((slot_last < last ? slot_last : last) - missing_value) / expected_interval + 1;
+        const int32_t counts_index = counts_index_for(h, missing_value);
+
+        if (atomic)
+        {
+            counts_inc_normalised_atomic(h, counts_index, run * count);
+        }
+        else
+        {
+            counts_inc_normalised(h, counts_index, run * count);
+        }
+        missing_value += run * expected_interval;
+    }
+
+    if (atomic)
+    {
+        update_min_max_atomic(h, first);
+    }
+    else
+    {
+        update_min_max(h, first);
+    }
+    if (h->moments)
+    {
+        moments_add_sequence(h->moments, first, expected_interval, n, count, atomic);
+    }
+}
+
 bool hdr_record_corrected_values(struct hdr_histogram* h, int64_t value, int64_t count, int64_t expected_interval)
 {
-    int64_t missing_value;
+    if (!hdr_record_values(h, value, count))
+    {
+        return false;
+    }
+
+    if (expected_interval <= 0 || value / expected_interval < 2)
+    {
+        return true;
+    }
+
+    /* Every missing value is below 'value', so in range. */
+    record_missing_values(h, value, count, expected_interval, false);
+
+    return true;
+}
+
+bool hdr_record_corrected_values_atomic(struct hdr_histogram* h, int64_t value, int64_t count, int64_t expected_interval)
+{
+    if (!hdr_record_values_atomic(h, value, count))
+    {
+        return false;
+    }
+
+    if (expected_interval <= 0 || value / expected_interval < 2)
+    {
+        return true;
+    }
+
+    record_missing_values(h, value, count, expected_interval, true);
+
+    return true;
+}
+
+static void add_counts_with_same_layout(struct hdr_histogram* h, const struct hdr_histogram* from)
+{
+    int32_t i;
+    int64_t* counts = h->counts;
+    const int64_t* from_counts = from->counts;
+
+    if (from->occupancy)
+    {
+        const int32_t len = occupancy_len(from);
+        for (i = 0; i < len; i++)
+        {
+            uint64_t word = from->occupancy[i];
+            while (0 != word)
+            {
+                const int32_t index = (i << 6) + count_trailing_zeros_64(word);
+                counts[index] += from_counts[index];
+                mark_occupied(h, index);
+                word &= word - 1;
+            }
+        }
+    }
+    else if (h->occupancy)
+    {
+        /* Only write the non-zero slots, untouched pages of a lazily committed histogram stay untouched. */
+        i = counts_next_non_zero_index(from, 0, from->counts_len);
+        while (i < from->counts_len)
+        {
+            counts[i] += from_counts[i];
+            mark_occupied(h, i);
+            i = counts_next_non_zero_index(from, i + 1, from->counts_len);
+        }
+    }
+    else
+    {
+        for (i = 0; i < h->counts_len; i++)
+        {
+            counts[i] += from_counts[i];
+        }
+    }
+
+    h->total_count += from->total_count;
+
+    /* Match the min/max that recording the lowest equivalent value of each bucket would give. */
+    if (from->max_value != 0)
+    {
+        update_min_max(h, lowest_equivalent_value(from, from->max_value));
+    }
+    if (from->min_value != INT64_MAX)
+    {
+        int64_t min = lowest_equivalent_value(from, from->min_value);
+
+        /* Values below 1 << unit_magnitude share slot 0, which records as 0 and leaves */
+        /* the min alone, so the min comes from the next non-zero slot. */
+        if (0 == min)
+        {
+            const int32_t index = counts_next_non_zero_index(from, 1, from->counts_len);
+            min = index < from->counts_len ? hdr_value_at_index(from, index) : 0;
+        }
+        update_min_max(h, min);
+    }
+}
+
+int64_t hdr_add(struct hdr_histogram* h, const struct hdr_histogram* from)
+{
+    struct hdr_iter iter;
+    int64_t dropped = 0;
+
+    if (has_same_counts_layout(h, from) &&
+        h->normalizing_index_offset == 0 && from->normalizing_index_offset == 0 &&
+        from->max_value <= h->highest_trackable_value)
+    {
+        add_counts_with_same_layout(h, from);
+        moments_add_histogram(h, from);
+        return 0;
+    }
+
+    hdr_iter_recorded_init(&iter, from);
+
+    while (hdr_iter_next(&iter))
+    {
+        int64_t value = iter.value;
+        int64_t count = iter.count;
+        bool recorded = record_values(h, value, count);
+
+        if (!recorded)
+        {
+            dropped += count;
+        }
+        /* The exact moments of 'from' are added below, less an estimate of those dropped. */
+        if (h->moments && recorded != (NULL != from->moments))
+        {
+            moments_add(h->moments, iter.median_equivalent_value, recorded ? count : -count);
+        }
+    }
+
+    if (h->moments && from->moments)
+    {
+        moments_add_histogram(h, from);
+    }
+
+    return dropped;
+}
+
+int64_t hdr_add_while_correcting_for_coordinated_omission(
+        struct hdr_histogram* h, struct hdr_histogram* from, int64_t expected_interval)
+{
+    struct hdr_iter iter;
+    int64_t dropped = 0;
+    hdr_iter_recorded_init(&iter, from);
+
+    while (hdr_iter_next(&iter))
+    {
+        int64_t value = iter.value;
+        int64_t count = iter.count;
+
+        if (!hdr_record_corrected_values(h, value, count, expected_interval))
+        {
+            dropped += count;
+        }
+    }
+
+    return dropped;
+}
+
+int64_t hdr_add_scaled(struct hdr_histogram* h, const struct hdr_histogram* from, double scale)
+{
+    struct hdr_iter iter;
+    int64_t dropped = 0;
+    double remainder = 0.0;
+
+    /* A negative count would take values away, there's no count to add for NaN, and */
+    /* the scaled counts must not overflow the total count of 'h'. */
+    if (!(scale >= 0.0 && scale <= DBL_MAX) ||
+        (double) from->total_count * scale + 1.0 >= (double) (INT64_MAX - h->total_count))
+    {
+        return from->total_count;
+    }
+
+    hdr_iter_recorded_init(&iter, from);
+
+    while (hdr_iter_next(&iter))
+    {
+        double scaled = (double) iter.count * scale + remainder;
+        int64_t count = (int64_t) floor(scaled + 0.5);
+
+        remainder = scaled - (double) count;
+        if (0 == count)
+        {
+            continue;
+        }
+        if (!record_values(h, iter.value, count))
+        {
+            dropped += count;
+        }
+        else if (h->moments)
+        {
+            /* As hdr_add does for a histogram without moments. */
+            moments_add(h->moments, iter.median_equivalent_value, count);
+        }
+    }
+
+    return dropped;
+}
+
+int hdr_downsample(struct hdr_histogram* dst, const struct hdr_histogram* src)
+{
+    struct hdr_iter iter;
+
+    /* Slot widths are powers of two aligned to themselves, so a wider slot at every */
+    /* value means each slot of src lies within one slot of dst. */
+    if (dst->layout || src->layout ||
+        dst->unit_magnitude < src->unit_magnitude ||
+        dst->sub_bucket_half_count_magnitude > src->sub_bucket_half_count_magnitude ||
+        (src->max_value != 0 && lowest_equivalent_value(src, src->max_value) > dst->highest_trackable_value))
+    {
+        return EINVAL;
+    }
+
+    hdr_iter_recorded_init(&iter, src);
+    while (hdr_iter_next(&iter))
+    {
+        record_values(dst, iter.value, iter.count);
+    }
+    moments_add_histogram(dst, src);
+
+    return 0;
+}
+
+int hdr_calculate_budgeted_config(
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    size_t max_bytes,
+    struct hdr_histogram_bucket_config* cfg)
+{
+    int r = hdr_calculate_bucket_config(lowest_discernible_value, highest_trackable_value, significant_figures, cfg);
+
+    while (0 == r && hdr_calculate_allocation_size(cfg) > max_bytes && significant_figures > 1)
+    {
+        significant_figures--;
+        r = hdr_calculate_bucket_config(lowest_discernible_value, highest_trackable_value, significant_figures, cfg);
+    }
+
+    while (0 == r && hdr_calculate_allocation_size(cfg) > max_bytes)
+    {
+        if (lowest_discernible_value > highest_trackable_value / 4)
+        {
+            return EINVAL;
+        }
+        lowest_discernible_value *= 2;
+        r = hdr_calculate_bucket_config(lowest_discernible_value, highest_trackable_value, significant_figures, cfg);
+    }
+
+    return r;
+}
+
+int hdr_init_budgeted(
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    size_t max_bytes,
+    struct hdr_histogram** result)
+{
+    struct hdr_histogram_bucket_config cfg;
+
+    int r = hdr_calculate_budgeted_config(
+        lowest_discernible_value, highest_trackable_value, significant_figures, max_bytes, &cfg);
+    if (r)
+    {
+        return r;
+    }
+
+    return hdr_init(cfg.lowest_discernible_value, cfg.highest_trackable_value, (int) cfg.significant_figures, result);
+}
+
+int hdr_downsample_to_budget(const struct hdr_histogram* src, size_t max_bytes, struct hdr_histogram** result)
+{
+    struct hdr_histogram* h;
+
+    int r = hdr_init_budgeted(
+        src->lowest_discernible_value, src->highest_trackable_value, src->significant_figures, max_bytes, &h);
+    if (r)
+    {
+        return r;
+    }
+
+    r = hdr_downsample(h, src);
+    if (r)
+    {
+        hdr_close(h);
+        return r;
+    }
+
+    *result = h;
+
+    return 0;
+}
+
+/* Unlike every other half bucket, the values in the lowest one (bar zero) do not scale */
+/* by moving the offset, so each is moved to its scaled slot.  The half buckets below */
+/* are empty, or the shift would have overflowed, and each scaled slot is lower than */
+/* the slots still to be moved, so a single pass works. */
+static void shift_lowest_half_bucket_left(struct hdr_histogram* h, int32_t binary_orders, int32_t pre_shift_zero_index)
+{
+    int32_t from_index;
+
+    for (from_index = 1; from_index < h->sub_bucket_half_count; from_index++)
+    {
+        const int32_t from_normalised = pre_shift_zero_index + from_index;
+        const int64_t count = h->counts[from_normalised];
+        int32_t to_normalised;
+
+        if (0 == count)
+        {
+            continue;
+        }
+
+        to_normalised = normalize_index(h, counts_index_for(h, hdr_value_at_index(h, from_index) << binary_orders));
+        h->counts[from_normalised] = 0;
+        h->counts[to_normalised] += count;
+        mark_occupied(h, to_normalised);
+    }
+}
+
+static void shift_normalizing_index(struct hdr_histogram* h, int32_t shift_amount, bool lowest_half_bucket_populated)
+{
+    const int32_t pre_shift_zero_index = normalize_index(h, 0);
+    const int64_t zero_value_count = h->counts[pre_shift_zero_index];
+    int32_t zero_index;
+
+    h->counts[pre_shift_zero_index] = 0;
+    h->normalizing_index_offset += shift_amount;
+
+    if (lowest_half_bucket_populated)
+    {
+        shift_lowest_half_bucket_left(h, shift_amount >> h->sub_bucket_half_count_magnitude, pre_shift_zero_index);
+    }
+
+    zero_index = normalize_index(h, 0);
+    h->counts[zero_index] = zero_value_count;
+    if (0 != zero_value_count)
+    {
+        mark_occupied(h, zero_index);
+    }
+}
+
+int hdr_shift_values_left(struct hdr_histogram* h, int32_t binary_orders_of_magnitude)
+{
+    int32_t shift_amount;
+    int64_t max_value, min_value;
+
+    if (h->layout || binary_orders_of_magnitude < 0 || binary_orders_of_magnitude >= h->bucket_count)
+    {
+        return EINVAL;
+    }
+    /* Nothing moves if every value recorded is zero. */
+    if (0 == binary_orders_of_magnitude || h->total_count == counts_get_normalised(h, 0))
+    {
+        return 0;
+    }
+
+    shift_amount = binary_orders_of_magnitude << h->sub_bucket_half_count_magnitude;
+    if (counts_index_for(h, h->max_value) >= h->counts_len - shift_amount)
+    {
+        return EINVAL;
+    }
+
+    max_value = h->max_value;
+    min_value = h->min_value;
+    shift_normalizing_index(
+        h, shift_amount, min_value < ((int64_t) h->sub_bucket_half_count << h->unit_magnitude));
+
+    h->max_value = 0;
+    h->min_value = INT64_MAX;
+    update_min_max(h, max_value << binary_orders_of_magnitude);
+    if (INT64_MAX != min_value)
+    {
+        update_min_max(h, min_value << binary_orders_of_magnitude);
+    }
+    moments_shift(h, binary_orders_of_magnitude);
+
+    return 0;
+}
+
+int hdr_shift_values_right(struct hdr_histogram* h, int32_t binary_orders_of_magnitude)
+{
+    int32_t shift_amount;
+    int64_t max_value, min_value;
 
-    if (!hdr_record_values(h, value, count))
+    if (h->layout || binary_orders_of_magnitude < 0 || binary_orders_of_magnitude >= h->bucket_count)
     {
-        return false;
+        return EINVAL;
     }
-
-    if (expected_interval <= 0 || value <= expected_interval)
+    if (0 == binary_orders_of_magnitude || h->total_count == counts_get_normalised(h, 0))
     {
-        return true;
+        return 0;
     }
 
-    missing_value = value - expected_interval;
-    for (; missing_value >= expected_interval; missing_value -= expected_interval)
+    /* Shifting values into the lowest half bucket would lose precision irreversibly. */
+    shift_amount = binary_orders_of_magnitude << h->sub_bucket_half_count_magnitude;
+    if (counts_index_for(h, h->min_value) < shift_amount + h->sub_bucket_half_count)
     {
-        if (!hdr_record_values(h, missing_value, count))
-        {
-            return false;
-        }
+        return EINVAL;
     }
 
-    return true;
+    max_value = h->max_value;
+    min_value = h->min_value;
+    shift_normalizing_index(h, -shift_amount, false);
+
+    h->max_value = 0;
+    h->min_value = INT64_MAX;
+    update_min_max(h, max_value >> binary_orders_of_magnitude);
+    update_min_max(h, min_value >> binary_orders_of_magnitude);
+    moments_shift(h, -binary_orders_of_magnitude);
+
+    return 0;
 }
 
-bool hdr_record_corrected_values_atomic(struct hdr_histogram* h, int64_t value, int64_t count, int64_t expected_interval)
-{
-    int64_t missing_value;
 
-    if (!hdr_record_values_atomic(h, value, count))
-    {
-        return false;
-    }
 
-    if (expected_interval <= 0 || value <= expected_interval)
+static size_t gather_recorded_indexes(
+    const struct hdr_histogram* h, int64_t* indexes, int64_t* counts, size_t capacity)
+{
+    size_t n = 0;
+    int32_t i;
+
+    if (HDR_LIKELY(h->normalizing_index_offset == 0))
     {
-        return true;
+        for (i = counts_next_non_zero_index(h, 0, h->counts_len);
+             i < h->counts_len;
+             i = counts_next_non_zero_index(h, i + 1, h->counts_len))
+        {
+            if (n < capacity)
+            {
+                indexes[n] = i;
+                counts[n] = h->counts[i];
+            }
+            n++;
+        }
     }
-
-    missing_value = value - expected_interval;
-    for (; missing_value >= expected_interval; missing_value -= expected_interval)
+    else
     {
-        if (!hdr_record_values_atomic(h, missing_value, count))
+        for (i = 0; i < h->counts_len; i++)
         {
-            return false;
+            int64_t count = counts_get_normalised(h, i);
+            if (0 != count)
+            {
+                if (n < capacity)
+                {
+                    indexes[n] = i;
+                    counts[n] = count;
+                }
+                n++;
+            }
         }
     }
 
-    return true;
+    return n;
 }
 
-int64_t hdr_add(struct hdr_histogram* h, const struct hdr_histogram* from)
+int hdr_export_recorded_equivalents(
+    const struct hdr_histogram* h,
+    int64_t* values,
+    int64_t* counts,
+    int64_t* lowest_equivalent_values,
+    int64_t* highest_equivalent_values,
+    int64_t* median_equivalent_values,
+    size_t capacity,
+    size_t* length)
 {
-    struct hdr_iter iter;
-    int64_t dropped = 0;
-    hdr_iter_recorded_init(&iter, from);
+    size_t n, written, i;
+    const int64_t half_count = h->sub_bucket_half_count;
+    const int64_t half_count_magnitude = h->sub_bucket_half_count_magnitude;
+    const int64_t unit_magnitude = h->unit_magnitude;
 
-    while (hdr_iter_next(&iter))
+    if (NULL == length || (capacity > 0 && (NULL == values || NULL == counts)))
     {
-        int64_t value = iter.value;
-        int64_t count = iter.count;
+        return EINVAL;
+    }
+
+    /* First pass collects the indexes into 'values', the second converts them without */
+    /* data dependent branches or calls so the compiler is free to vectorise it.  The */
+    /* layout test is loop invariant, only tiered histograms take the lookup path. */
+    n = gather_recorded_indexes(h, values, counts, capacity);
+    written = n < capacity ? n : capacity;
 
-        if (!hdr_record_values(h, value, count))
+    for (i = 0; i < written; i++)
+    {
+        const int64_t index = values[i];
+        int64_t value, size;
+
+        if (NULL == h->layout)
         {
-            dropped += count;
+            const int64_t bucket_index = (index >> half_count_magnitude) - 1;
+            const int64_t in_first_bucket = bucket_index < 0;
+            const int64_t shift = (in_first_bucket ? 0 : bucket_index) + unit_magnitude;
+            const int64_t sub_bucket_index = (index & (half_count - 1)) + (in_first_bucket ? 0 : half_count);
+            value = sub_bucket_index << shift;
+            size = INT64_C(1) << shift;
+        }
+        else
+        {
+            value = hdr_value_at_index(h, (int32_t) index);
+            size = hdr_size_of_equivalent_value_range(h, value);
+        }
+
+        values[i] = value;
+        if (NULL != lowest_equivalent_values)
+        {
+            lowest_equivalent_values[i] = value;
+        }
+        if (NULL != highest_equivalent_values)
+        {
+            highest_equivalent_values[i] = value + size - 1;
+        }
+        if (NULL != median_equivalent_values)
+        {
+            median_equivalent_values[i] = value + (size >> 1);
         }
     }
 
-    return dropped;
+    *length = n;
+
+    return n <= capacity ? 0 : ERANGE;
 }
 
-int64_t hdr_add_while_correcting_for_coordinated_omission(
-        struct hdr_histogram* h, struct hdr_histogram* from, int64_t expected_interval)
+int hdr_export_recorded(
+    const struct hdr_histogram* h, int64_t* values, int64_t* counts, size_t capacity, size_t* length)
 {
-    struct hdr_iter iter;
+    return hdr_export_recorded_equivalents(h, values, counts, NULL, NULL, NULL, capacity, length);
+}
+
+int64_t hdr_import_counts(struct hdr_histogram* h, const int64_t* values, const int64_t* counts, size_t length)
+{
+    size_t i;
     int64_t dropped = 0;
-    hdr_iter_recorded_init(&iter, from);
+    int64_t added = 0;
+    int64_t min_value = INT64_MAX;
+    int64_t max_value = 0;
 
-    while (hdr_iter_next(&iter))
+    for (i = 0; i < length; i++)
     {
-        int64_t value = iter.value;
-        int64_t count = iter.count;
+        const int64_t value = values[i];
+        int32_t index;
 
-        if (!hdr_record_corrected_values(h, value, count, expected_interval))
+        if (value < 0 || h->highest_trackable_value < value ||
+            (uint32_t) (index = counts_index_for(h, value)) >= (uint32_t) h->counts_len)
         {
-            dropped += count;
+            dropped += counts[i];
+            continue;
+        }
+
+        if (HDR_LIKELY(h->normalizing_index_offset == 0))
+        {
+            h->counts[index] += counts[i];
+            mark_occupied(h, index);
+        }
+        else
+        {
+            const int32_t normalised_index = normalize_index(h, index);
+            h->counts[normalised_index] += counts[i];
+            mark_occupied(h, normalised_index);
+        }
+
+        if (h->moments)
+        {
+            moments_add(h->moments, value, counts[i]);
         }
+        added += counts[i];
+        max_value = value > max_value ? value : max_value;
+        min_value = (value != 0 && value < min_value) ? value : min_value;
+    }
+
+    /* Totals and the min/max are updated once for the whole batch. */
+    h->total_count += added;
+    update_min_max(h, max_value);
+    if (min_value != INT64_MAX)
+    {
+        update_min_max(h, min_value);
     }
 
     return dropped;
 }
 
-
-
 /* ##     ##    ###    ##       ##     ## ########  ######  */
 /* ##     ##   ## ##   ##       ##     ## ##       ##    ## */
 /* ##     ##  ##   ##  ##       ##     ## ##       ##       */
@@ -758,9 +2349,41 @@ static int64_t get_value_from_idx_up_to_count_avx2(
 }
 #endif
 
+static int64_t get_value_from_idx_up_to_count_occupied(
+    const struct hdr_histogram* h, int64_t count_at_percentile)
+{
+    int64_t count_to_idx = 0;
+    int32_t idx = counts_next_non_zero_index(h, 0, h->counts_len);
+
+    for (; idx < h->counts_len; idx = counts_next_non_zero_index(h, idx + 1, h->counts_len)) {
+        count_to_idx += h->counts[idx];
+        if (count_to_idx >= count_at_percentile)
+            return hdr_value_at_index(h, idx);
+    }
+    return 0;
+}
+
+/* The scans above read the counts array in storage order, which is only value order */
+/* while the histogram is unshifted. */
+static int64_t get_value_from_idx_up_to_count_normalised(
+    const struct hdr_histogram* h, int64_t count_at_percentile)
+{
+    int64_t count_to_idx = 0;
+    for (int32_t idx = 0; idx < h->counts_len; idx++) {
+        count_to_idx += counts_get_normalised(h, idx);
+        if (count_to_idx >= count_at_percentile)
+            return hdr_value_at_index(h, idx);
+    }
+    return 0;
+}
+
 static int64_t get_value_from_idx_up_to_count(const struct hdr_histogram* h, int64_t count_at_percentile)
 {
     count_at_percentile = count_at_percentile > 0 ? count_at_percentile : 1;
+    if (HDR_UNLIKELY(h->normalizing_index_offset != 0))
+        return get_value_from_idx_up_to_count_normalised(h, count_at_percentile);
+    if (h->occupancy)
+        return get_value_from_idx_up_to_count_occupied(h, count_at_percentile);
 #ifdef HDR_HAS_AVX2_DISPATCH
     if (__builtin_cpu_supports("avx2"))
         return get_value_from_idx_up_to_count_avx2(h, count_at_percentile);
@@ -801,15 +2424,13 @@ int hdr_value_at_percentiles(const struct hdr_histogram *h, const double *percen
         values[i] = count_at_percentile > 1 ? count_at_percentile : 1;
     }
 
-    hdr_iter_init(&iter, h);
-    int64_t total = 0;
+    hdr_iter_recorded_init(&iter, h);
     size_t at_pos = 0;
-    while (hdr_iter_next(&iter) && at_pos < length)
+    while (at_pos < length && hdr_iter_next(&iter))
     {
-        total += iter.count;
-        while (at_pos < length && total >= values[at_pos])
+        while (at_pos < length && iter.cumulative_count >= values[at_pos])
         {
-            values[at_pos] = highest_equivalent_value(h, iter.value);
+            values[at_pos] = iter.highest_equivalent_value;
             at_pos++;
         }
     }
@@ -822,35 +2443,57 @@ double hdr_mean(const struct hdr_histogram* h)
     int64_t total = 0, count = 0;
     int64_t total_count = h->total_count;
 
-    hdr_iter_init(&iter, h);
+    if (h->moments && 0 != total_count)
+    {
+        return (double) (int128_to_long_double(h->moments->sum) / total_count);
+    }
 
-    while (hdr_iter_next(&iter) && count < total_count)
+    hdr_iter_recorded_init(&iter, h);
+
+    while (count < total_count && hdr_iter_next(&iter))
     {
-        if (0 != iter.count)
-        {
-            count += iter.count;
-            total += iter.count * hdr_median_equivalent_value(h, iter.value);
-        }
+        count += iter.count;
+        total += iter.count * iter.median_equivalent_value;
     }
 
     return (total * 1.0) / total_count;
 }
 
+/* The sum of squared deviations from an integer near the mean is computed exactly, */
+/* so the only cancellation left is of the (small) remainder of the mean. */
+static double moments_stddev(const struct hdr_moments* m, int64_t total_count)
+{
+    const int64_t centre = (int64_t) (int128_to_long_double(m->sum) / total_count);
+    const struct hdr_int128 centre_total = int128_multiply(int128_from(total_count), (uint64_t) centre);
+    const struct hdr_int128 remainder = int128_add(m->sum, int128_negate(centre_total));
+    struct hdr_int128 deviation = int128_add(
+        m->sum_of_squares, int128_negate(int128_multiply(int128_multiply(m->sum, (uint64_t) centre), 2)));
+    long double r;
+
+    deviation = int128_add(deviation, int128_multiply(centre_total, (uint64_t) centre));
+    r = int128_to_long_double(remainder);
+
+    return sqrt((double) ((int128_to_long_double(deviation) - r * r / total_count) / total_count));
+}
+
 double hdr_stddev(const struct hdr_histogram* h)
 {
-    double mean = hdr_mean(h);
+    double mean;
     double geometric_dev_total = 0.0;
-
     struct hdr_iter iter;
-    hdr_iter_init(&iter, h);
+
+    if (h->moments && 0 != h->total_count)
+    {
+        return moments_stddev(h->moments, h->total_count);
+    }
+
+    mean = hdr_mean(h);
+    hdr_iter_recorded_init(&iter, h);
 
     while (hdr_iter_next(&iter))
     {
-        if (0 != iter.count)
-        {
-            double dev = (hdr_median_equivalent_value(h, iter.value) * 1.0) - mean;
-            geometric_dev_total += (dev * dev) * iter.count;
-        }
+        double dev = (iter.median_equivalent_value * 1.0) - mean;
+        geometric_dev_total += (dev * dev) * iter.count;
     }
 
     return sqrt(geometric_dev_total / h->total_count);
@@ -896,6 +2539,49 @@ static bool has_next(struct hdr_iter* iter)
     return iter->cumulative_count < iter->total_count;
 }
 
+static void set_position(struct hdr_iter* iter, int32_t index)
+{
+    const struct hdr_histogram* h = iter->h;
+    int32_t bucket_index;
+    int32_t sub_bucket_index;
+
+    if (h->layout)
+    {
+        bucket_index = layout_bucket_for_index(h, index);
+        sub_bucket_index = index - h->layout[bucket_index].index_offset;
+    }
+    else
+    {
+        bucket_index = (index >> h->sub_bucket_half_count_magnitude) - 1;
+        sub_bucket_index = (index & (h->sub_bucket_half_count - 1)) + h->sub_bucket_half_count;
+
+        if (bucket_index < 0)
+        {
+            sub_bucket_index -= h->sub_bucket_half_count;
+            bucket_index = 0;
+        }
+    }
+
+    iter->counts_index = index;
+    iter->bucket_index = bucket_index;
+    iter->sub_bucket_index = sub_bucket_index;
+}
+
+/* The equivalent value range only changes size at a bucket boundary, so it is derived */
+/* from the tracked bucket/sub-bucket position rather than from the value. */
+static void update_equivalent_values(struct hdr_iter* iter)
+{
+    const int32_t shift = iter->h->layout ?
+        iter->h->layout[iter->bucket_index].shift : iter->bucket_index + iter->h->unit_magnitude;
+    const int64_t leq = ((int64_t) iter->sub_bucket_index) << shift;
+    const int64_t size_of_equivalent_value_range = INT64_C(1) << shift;
+
+    iter->value = leq;
+    iter->lowest_equivalent_value = leq;
+    iter->highest_equivalent_value = leq + size_of_equivalent_value_range - 1;
+    iter->median_equivalent_value = leq + (size_of_equivalent_value_range >> 1);
+}
+
 static bool move_next(struct hdr_iter* iter)
 {
     iter->counts_index++;
@@ -905,18 +2591,94 @@ static bool move_next(struct hdr_iter* iter)
         return false;
     }
 
+    iter->sub_bucket_index++;
+    if (iter->h->layout)
+    {
+        const struct hdr_bucket_layout* layout = iter->h->layout;
+        if (iter->bucket_index + 1 < iter->h->bucket_count &&
+            iter->counts_index == layout[iter->bucket_index + 1].first_index)
+        {
+            iter->bucket_index++;
+            iter->sub_bucket_index = iter->counts_index - layout[iter->bucket_index].index_offset;
+        }
+    }
+    else if (iter->sub_bucket_index == iter->h->sub_bucket_count)
+    {
+        iter->bucket_index++;
+        iter->sub_bucket_index = iter->h->sub_bucket_half_count;
+    }
+
     iter->count = counts_get_normalised(iter->h, iter->counts_index);
     iter->cumulative_count += iter->count;
-    const int64_t value = hdr_value_at_index(iter->h, iter->counts_index);
-    const int32_t bucket_index = get_bucket_index(iter->h, value);
-    const int32_t sub_bucket_index = get_sub_bucket_index(value, bucket_index, iter->h->unit_magnitude);
-    const int64_t leq = lowest_equivalent_value_given_bucket_indices(iter->h, bucket_index, sub_bucket_index);
-    const int64_t size_of_equivalent_value_range = size_of_equivalent_value_range_given_bucket_indices(
-        iter->h, bucket_index, sub_bucket_index);
-    iter->lowest_equivalent_value = leq;
-    iter->value = value;
-    iter->highest_equivalent_value = leq + size_of_equivalent_value_range - 1;
-    iter->median_equivalent_value = leq + (size_of_equivalent_value_range >> 1);
+    update_equivalent_values(iter);
+
+    return true;
+}
+
+static bool move_prev(struct hdr_iter* iter)
+{
+    if (iter->counts_index <= 0)
+    {
+        return false;
+    }
+
+    iter->counts_index--;
+    iter->sub_bucket_index--;
+    if (iter->h->layout)
+    {
+        const struct hdr_bucket_layout* layout = iter->h->layout;
+        if (iter->counts_index < layout[iter->bucket_index].first_index)
+        {
+            iter->bucket_index--;
+            iter->sub_bucket_index = iter->counts_index - layout[iter->bucket_index].index_offset;
+        }
+    }
+    else if (iter->bucket_index > 0 && iter->sub_bucket_index < iter->h->sub_bucket_half_count)
+    {
+        iter->bucket_index--;
+        iter->sub_bucket_index = iter->h->sub_bucket_count - 1;
+    }
+
+    iter->count = counts_get_normalised(iter->h, iter->counts_index);
+    iter->cumulative_count += iter->count;
+    update_equivalent_values(iter);
+
+    return true;
+}
+
+static int32_t find_non_zero_index(const struct hdr_histogram* h, int32_t index, int32_t end)
+{
+    if (HDR_LIKELY(h->normalizing_index_offset == 0))
+    {
+        return counts_next_non_zero_index(h, index, end);
+    }
+
+    while (index < end && 0 == counts_get_normalised(h, index))
+    {
+        index++;
+    }
+
+    return index;
+}
+
+/* Skip over a run of zero counts, stopping at the first non-zero count or at */
+/* limit_index, whichever comes first. */
+static bool move_next_non_zero(struct hdr_iter* iter, int32_t limit_index)
+{
+    const struct hdr_histogram* h = iter->h;
+    const int32_t end = limit_index < h->counts_len ? limit_index : h->counts_len;
+    const int32_t index = find_non_zero_index(h, iter->counts_index + 1, end);
+
+    if (index == iter->counts_index + 1 || index >= h->counts_len)
+    {
+        return move_next(iter);
+    }
+
+    set_position(iter, index);
+
+    iter->count = counts_get_normalised(h, index);
+    iter->cumulative_count += iter->count;
+    update_equivalent_values(iter);
 
     return true;
 }
@@ -944,9 +2706,7 @@ static bool basic_iter_next(struct hdr_iter *iter)
         return false;
     }
 
-    move_next(iter);
-
-    return true;
+    return move_next_non_zero(iter, iter->h->counts_len);
 }
 
 static void update_iterated_values(struct hdr_iter* iter, int64_t new_value_iterated_to)
@@ -979,12 +2739,26 @@ void hdr_iter_init(struct hdr_iter* iter, const struct hdr_histogram* h)
     iter->highest_equivalent_value = 0;
     iter->value_iterated_from = 0;
     iter->value_iterated_to = 0;
+    iter->bucket_index = 0;
+    iter->sub_bucket_index = -1;
 
     iter->_next_fp = all_values_iter_next;
 }
 
+static bool recorded_iter_next(struct hdr_iter* iter);
+
 bool hdr_iter_next(struct hdr_iter* iter)
 {
+    /* Call the most common iterators directly, so the step can be inlined. */
+    if (iter->_next_fp == recorded_iter_next)
+    {
+        return recorded_iter_next(iter);
+    }
+    else if (iter->_next_fp == all_values_iter_next)
+    {
+        return all_values_iter_next(iter);
+    }
+
     return iter->_next_fp(iter);
 }
 
@@ -1026,7 +2800,7 @@ static bool percentile_iter_next(struct hdr_iter* iter)
         if (iter->count != 0 &&
                 percentiles->percentile_to_iterate_to <= current_percentile)
         {
-            update_iterated_values(iter, highest_equivalent_value(iter->h, iter->value));
+            update_iterated_values(iter, iter->highest_equivalent_value);
 
             percentiles->percentile = percentiles->percentile_to_iterate_to;
             temp = (int64_t)(log(100 / (100.0 - (percentiles->percentile_to_iterate_to))) / log(2)) + 1;
@@ -1117,6 +2891,112 @@ void hdr_iter_recorded_init(struct hdr_iter* iter, const struct hdr_histogram* h
     iter->_next_fp = recorded_iter_next;
 }
 
+static int32_t max_value_index(const struct hdr_histogram* h)
+{
+    int32_t max_index = counts_index_for(h, h->max_value);
+    return max_index < h->counts_len ? max_index : h->counts_len - 1;
+}
+
+/* Position the iterator just before 'index' so the next step lands on it. */
+static void start_recorded_iter_at(struct hdr_iter* iter, int32_t index, int64_t cumulative_count_below)
+{
+    set_position(iter, index);
+    iter->counts_index--;
+    iter->sub_bucket_index--;
+    iter->cumulative_count = cumulative_count_below;
+    iter->value_iterated_to = hdr_value_at_index(iter->h, index);
+}
+
+void hdr_iter_recorded_init_at_value(struct hdr_iter* iter, const struct hdr_histogram* h, int64_t value)
+{
+    int32_t start_index, max_index, i;
+    int64_t count_from_start = 0;
+
+    hdr_iter_recorded_init(iter, h);
+
+    if (h->total_count == 0 || h->max_value < value)
+    {
+        iter->cumulative_count = iter->total_count;
+        return;
+    }
+
+    start_index = value > 0 ? counts_index_for(h, value) : 0;
+    max_index = max_value_index(h);
+
+    for (i = start_index; i <= max_index; i++)
+    {
+        count_from_start += counts_get_normalised(h, i);
+    }
+
+    start_recorded_iter_at(iter, start_index, iter->total_count - count_from_start);
+}
+
+void hdr_iter_recorded_init_at_percentile(struct hdr_iter* iter, const struct hdr_histogram* h, double percentile)
+{
+    double requested_percentile = percentile < 100.0 ? percentile : 100.0;
+    int64_t count_at_percentile = (int64_t) (((requested_percentile / 100) * h->total_count) + 0.5);
+    int64_t count_above = 0;
+    int32_t i;
+
+    hdr_iter_recorded_init(iter, h);
+
+    if (h->total_count == 0)
+    {
+        return;
+    }
+
+    count_at_percentile = count_at_percentile > 0 ? count_at_percentile : 1;
+
+    /* Walk down from the max, stopping at the index where the cumulative count first */
+    /* reaches the requested percentile, so the cost is proportional to the tail. */
+    i = max_value_index(h);
+    while (i > 0)
+    {
+        int64_t count = counts_get_normalised(h, i);
+        if (h->total_count - count_above - count < count_at_percentile)
+        {
+            break;
+        }
+
+        count_above += count;
+        i--;
+    }
+
+    start_recorded_iter_at(iter, i, h->total_count - count_above - counts_get_normalised(h, i));
+}
+
+static bool reverse_iter_next(struct hdr_iter* iter)
+{
+    while (has_next(iter) && move_prev(iter))
+    {
+        if (iter->count != 0)
+        {
+            update_iterated_values(iter, iter->value);
+
+            iter->specifics.recorded.count_added_in_this_iteration_step = iter->count;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void hdr_iter_reverse_init(struct hdr_iter* iter, const struct hdr_histogram* h)
+{
+    hdr_iter_recorded_init(iter, h);
+
+    if (h->total_count == 0)
+    {
+        return;
+    }
+
+    /* Position the iterator just after the max so the first step lands on it. */
+    set_position(iter, max_value_index(h) + 1);
+    iter->value_iterated_to = hdr_max(h);
+
+    iter->_next_fp = reverse_iter_next;
+}
+
 /* ##       #### ##    ## ########    ###    ########  */
 /* ##        ##  ###   ## ##         ## ##   ##     ## */
 /* ##        ##  ####  ## ##        ##   ##  ##     ## */
@@ -1149,7 +3029,8 @@ static bool iter_linear_next(struct hdr_iter* iter)
                 return true;
             }
 
-            if (!move_next(iter))
+            if (!move_next_non_zero(
+                    iter, counts_index_for(iter->h, linear->next_value_reporting_level_lowest_equivalent)))
             {
                 return true;
             }
@@ -1205,7 +3086,8 @@ static bool log_iter_next(struct hdr_iter *iter)
                 return true;
             }
 
-            if (!move_next(iter))
+            if (!move_next_non_zero(
+                    iter, counts_index_for(iter->h, logarithmic->next_value_reporting_level_lowest_equivalent)))
             {
                 return true;
             }
@@ -0,0 +1,534 @@
+/**
+ * hdr_histogram_compact.c
+ * Released to the public domain, as explained at
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <hdr/hdr_histogram_compact.h>
+#include "hdr_atomic.h"
+
+#ifndef HDR_MALLOC_INCLUDE
+#define HDR_MALLOC_INCLUDE "hdr_malloc.h"
+#endif
+
+#include HDR_MALLOC_INCLUDE
+
+/* Private prototypes useful for the compact histogram */
+int32_t counts_index_for(const struct hdr_histogram* h, int64_t value);
+void update_min_max_atomic(struct hdr_histogram* h, int64_t value);
+
+#define OVERFLOW_EMPTY (-1)
+/* A slot's count is its byte plus OVERFLOW_UNIT times its overflow count.  The byte */
+/* of a non-zero slot is kept in 1..255, so the bytes alone say which slots are empty. */
+#define OVERFLOW_UNIT UINT8_MAX
+#define INITIAL_OVERFLOW_CAPACITY 64
+#define MAX_OVERFLOW_PROBE 16
+
+/*  #######  ##     ## ######## ########  ######## ##        #######  ##      ## */
+/* ##     ## ##     ## ##       ##     ## ##       ##       ##     ## ##  ##  ## */
+/* ##     ## ##     ## ##       ##     ## ##       ##       ##     ## ##  ##  ## */
+/* ##     ## ##     ## ######   ########  ######   ##       ##     ## ##  ##  ## */
+/* ##     ##  ##   ##  ##       ##   ##   ##       ##       ##     ## ##  ##  ## */
+/* ##     ##   ## ##   ##       ##    ##  ##       ##       ##     ## ##  ##  ## */
+/*  #######     ###    ######## ##     ## ##       ########  #######   ###  ###  */
+
+static int32_t overflow_home(int32_t index, int32_t capacity)
+{
+    return (int32_t) (((uint32_t) index * UINT32_C(2654435761)) & (uint32_t) (capacity - 1));
+}
+
+static int allocate_overflow(int32_t capacity, int32_t** indexes, int64_t** counts)
+{
+    *indexes = (int32_t*) hdr_malloc(sizeof(int32_t) * (size_t) capacity);
+    *counts = (int64_t*) hdr_calloc((size_t) capacity, sizeof(int64_t));
+    if (!*indexes || !*counts)
+    {
+        hdr_free(*indexes);
+        hdr_free(*counts);
+        return ENOMEM;
+    }
+
+    /* All bits set is OVERFLOW_EMPTY. */
+    memset(*indexes, 0xFF, sizeof(int32_t) * (size_t) capacity);
+
+    return 0;
+}
+
+static int32_t find_overflow(const struct hdr_compact_histogram* h, int32_t index)
+{
+    const int32_t mask = h->overflow_capacity - 1;
+    int32_t slot = overflow_home(index, h->overflow_capacity);
+    int32_t probe;
+
+    for (probe = 0; probe < h->overflow_capacity; probe++, slot = (slot + 1) & mask)
+    {
+        int32_t key = h->overflow_indexes[slot];
+        if (key == index)
+        {
+            return slot;
+        }
+        if (OVERFLOW_EMPTY == key)
+        {
+            break;
+        }
+    }
+
+    return OVERFLOW_EMPTY;
+}
+
+static int grow_overflow(struct hdr_compact_histogram* h)
+{
+    int32_t* old_indexes = h->overflow_indexes;
+    int64_t* old_counts = h->overflow_counts;
+    int32_t old_capacity = h->overflow_capacity;
+    int32_t capacity = old_capacity * 2;
+    int32_t i;
+
+    if (allocate_overflow(capacity, &h->overflow_indexes, &h->overflow_counts))
+    {
+        h->overflow_indexes = old_indexes;
+        h->overflow_counts = old_counts;
+        return ENOMEM;
+    }
+    h->overflow_capacity = capacity;
+
+    for (i = 0; i < old_capacity; i++)
+    {
+        if (OVERFLOW_EMPTY != old_indexes[i])
+        {
+            int32_t slot = overflow_home(old_indexes[i], capacity);
+            while (OVERFLOW_EMPTY != h->overflow_indexes[slot])
+            {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            h->overflow_indexes[slot] = old_indexes[i];
+            h->overflow_counts[slot] = old_counts[i];
+        }
+    }
+
+    hdr_free(old_indexes);
+    hdr_free(old_counts);
+
+    return 0;
+}
+
+/* Probes are kept short by growing the table, which only the non-atomic path can do. */
+static int32_t insert_overflow(struct hdr_compact_histogram* h, int32_t index)
+{
+    for (;;)
+    {
+        const int32_t mask = h->overflow_capacity - 1;
+        int32_t slot = overflow_home(index, h->overflow_capacity);
+        int32_t probe;
+
+        for (probe = 0; probe < MAX_OVERFLOW_PROBE && probe < h->overflow_capacity; probe++, slot = (slot + 1) & mask)
+        {
+            if (h->overflow_indexes[slot] == index)
+            {
+                return slot;
+            }
+            if (OVERFLOW_EMPTY == h->overflow_indexes[slot])
+            {
+                h->overflow_indexes[slot] = index;
+                return slot;
+            }
+        }
+
+        if (grow_overflow(h))
+        {
+            return OVERFLOW_EMPTY;
+        }
+    }
+}
+
+static int32_t insert_overflow_atomic(struct hdr_compact_histogram* h, int32_t index)
+{
+    const int32_t mask = h->overflow_capacity - 1;
+    volatile int32_t* indexes = h->overflow_indexes;
+    int32_t slot = overflow_home(index, h->overflow_capacity);
+    int32_t probe;
+
+    for (probe = 0; probe < h->overflow_capacity; probe++, slot = (slot + 1) & mask)
+    {
+        int32_t key = indexes[slot];
+        if (OVERFLOW_EMPTY == key)
+        {
+            int32_t expected = OVERFLOW_EMPTY;
+            if (hdr_atomic_compare_exchange_32(&indexes[slot], &expected, index))
+            {
+                return slot;
+            }
+            key = indexes[slot];
+        }
+        if (key == index)
+        {
+            return slot;
+        }
+    }
+
+    return OVERFLOW_EMPTY;
+}
+
+/* ##     ## ######## ##     ##  #######  ########  ##    ## */
+/* ###   ### ##       ###   ### ##     ## ##     ##  ##  ##  */
+/* #### #### ##       #### #### ##     ## ##     ##   ####   */
+/* ## ### ## ######   ## ### ## ##     ## ########     ##    */
+/* ##     ## ##       ##     ## ##     ## ##   ##      ##    */
+/* ##     ## ##       ##     ## ##     ## ##    ##     ##    */
+/* ##     ## ######## ##     ##  #######  ##     ##    ##    */
+
+int hdr_compact_init(
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    struct hdr_compact_histogram** result)
+{
+    struct hdr_histogram_bucket_config cfg;
+    struct hdr_compact_histogram* h;
+    int32_t capacity = INITIAL_OVERFLOW_CAPACITY;
+
+    int r = hdr_calculate_bucket_config(lowest_discernible_value, highest_trackable_value, significant_figures, &cfg);
+    if (r)
+    {
+        return r;
+    }
+
+    /* The header and the byte counts share a single allocation. */
+    h = (struct hdr_compact_histogram*) hdr_calloc(1, sizeof(struct hdr_compact_histogram) + (size_t) cfg.counts_len);
+    if (!h)
+    {
+        return ENOMEM;
+    }
+
+    hdr_init_preallocated(&h->shape, &cfg);
+    h->shape.counts = NULL;
+    h->counts = (uint8_t*) (h + 1);
+
+    while (capacity < (cfg.counts_len >> 6))
+    {
+        capacity <<= 1;
+    }
+    h->overflow_capacity = capacity;
+    if (allocate_overflow(capacity, &h->overflow_indexes, &h->overflow_counts))
+    {
+        hdr_free(h);
+        return ENOMEM;
+    }
+
+    *result = h;
+
+    return 0;
+}
+
+void hdr_compact_close(struct hdr_compact_histogram* h)
+{
+    if (h)
+    {
+        hdr_free(h->overflow_indexes);
+        hdr_free(h->overflow_counts);
+        hdr_free(h);
+    }
+}
+
+void hdr_compact_reset(struct hdr_compact_histogram* h)
+{
+    memset(h->counts, 0, (size_t) h->shape.counts_len);
+    memset(h->overflow_indexes, 0xFF, sizeof(int32_t) * (size_t) h->overflow_capacity);
+    memset(h->overflow_counts, 0, sizeof(int64_t) * (size_t) h->overflow_capacity);
+    h->shape.total_count = 0;
+    h->shape.min_value = INT64_MAX;
+    h->shape.max_value = 0;
+}
+
+int hdr_compact_reserve_overflow(struct hdr_compact_histogram* h, int32_t slots)
+{
+    if (slots < 0 || slots > h->shape.counts_len)
+    {
+        return EINVAL;
+    }
+
+    /* Keep the table at most half full, so probes stay short. */
+    while (h->overflow_capacity < 2 * (int64_t) slots)
+    {
+        int rc = grow_overflow(h);
+        if (rc)
+        {
+            return rc;
+        }
+    }
+
+    return 0;
+}
+
+size_t hdr_compact_get_memory_size(const struct hdr_compact_histogram* h)
+{
+    return sizeof(struct hdr_compact_histogram) + (size_t) h->shape.counts_len +
+        (sizeof(int32_t) + sizeof(int64_t)) * (size_t) h->overflow_capacity;
+}
+
+/* ########  ########  ######   #######  ########  ########  #### ##    ##  ######   */
+/* ##     ## ##       ##    ## ##     ## ##     ## ##     ##  ##  ###   ## ##    ##  */
+/* ##     ## ##       ##       ##     ## ##     ## ##     ##  ##  ####  ## ##        */
+/* ########  ######   ##       ##     ## ########  ##     ##  ##  ## ## ## ##   #### */
+/* ##   ##   ##       ##       ##     ## ##   ##   ##     ##  ##  ##  #### ##    ##  */
+/* ##    ##  ##       ##    ## ##     ## ##    ##  ##     ##  ##  ##   ### ##    ##  */
+/* ##     ## ########  ######   #######  ##     ## ########  #### ##    ##  ######   */
+
+static int32_t checked_counts_index(const struct hdr_compact_histogram* h, int64_t value, int64_t count)
+{
+    int32_t counts_index;
+
+    if (value < 0 || count < 0 || h->shape.highest_trackable_value < value)
+    {
+        return -1;
+    }
+
+    counts_index = counts_index_for(&h->shape, value);
+    if ((uint32_t) counts_index >= (uint32_t) h->shape.counts_len)
+    {
+        return -1;
+    }
+
+    return counts_index;
+}
+
+bool hdr_compact_record_values(struct hdr_compact_histogram* h, int64_t value, int64_t count)
+{
+    int64_t sum;
+    int32_t counts_index = checked_counts_index(h, value, count);
+    if (counts_index < 0)
+    {
+        return false;
+    }
+
+    sum = h->counts[counts_index] + count;
+    if (sum > UINT8_MAX)
+    {
+        int32_t slot = insert_overflow(h, counts_index);
+        if (OVERFLOW_EMPTY == slot)
+        {
+            return false;
+        }
+
+        h->overflow_counts[slot] += (sum - 1) / OVERFLOW_UNIT;
+        sum = (sum - 1) % OVERFLOW_UNIT + 1;
+    }
+    h->counts[counts_index] = (uint8_t) sum;
+
+    h->shape.total_count += count;
+    h->shape.min_value = (value < h->shape.min_value && value != 0) ? value : h->shape.min_value;
+    h->shape.max_value = (value > h->shape.max_value) ? value : h->shape.max_value;
+
+    return true;
+}
+
+bool hdr_compact_record_value(struct hdr_compact_histogram* h, int64_t value)
+{
+    return hdr_compact_record_values(h, value, 1);
+}
+
+bool hdr_compact_record_values_atomic(struct hdr_compact_histogram* h, int64_t value, int64_t count)
+{
+    volatile uint8_t* counts = h->counts;
+    int32_t counts_index = checked_counts_index(h, value, count);
+    if (counts_index < 0)
+    {
+        return false;
+    }
+
+    for (;;)
+    {
+        uint8_t current = counts[counts_index];
+        int64_t sum = current + count;
+        int32_t slot;
+
+        if (sum <= UINT8_MAX)
+        {
+            if (hdr_atomic_compare_exchange_8(&counts[counts_index], &current, (uint8_t) sum))
+            {
+                break;
+            }
+            continue;
+        }
+
+        /* Claim the overflow slot first, so a full table leaves nothing half recorded. */
+        slot = insert_overflow_atomic(h, counts_index);
+        if (OVERFLOW_EMPTY == slot)
+        {
+            return false;
+        }
+
+        if (hdr_atomic_compare_exchange_8(&counts[counts_index], &current, (uint8_t) ((sum - 1) % OVERFLOW_UNIT + 1)))
+        {
+            hdr_atomic_add_fetch_64(&h->overflow_counts[slot], (sum - 1) / OVERFLOW_UNIT);
+            break;
+        }
+    }
+
+    hdr_atomic_add_fetch_64(&h->shape.total_count, count);
+    update_min_max_atomic(&h->shape, value);
+
+    return true;
+}
+
+bool hdr_compact_record_value_atomic(struct hdr_compact_histogram* h, int64_t value)
+{
+    return hdr_compact_record_values_atomic(h, value, 1);
+}
+
+/* ##     ##    ###    ##       ##     ## ########  ######  */
+/* ##     ##   ## ##   ##       ##     ## ##       ##    ## */
+/* ##     ##  ##   ##  ##       ##     ## ##       ##       */
+/* ##     ## ##     ## ##       ##     ## ######    ######  */
+/*  ##   ##  ######### ##       ##     ## ##             ## */
+/*   ## ##   ##     ## ##       ##     ## ##       ##    ## */
+/*    ###    ##     ## ######## ########  ########  ######  */
+
+/* Index of the first non-zero slot at or after 'index', counts_len if there is none. */
+static int32_t next_non_zero_slot(const struct hdr_compact_histogram* h, int32_t index)
+{
+    while (index < h->shape.counts_len)
+    {
+        uint64_t word = 0;
+
+        /* Most slots are empty, step over eight of them at a time. */
+        if (index + 8 <= h->shape.counts_len)
+        {
+            memcpy(&word, &h->counts[index], sizeof(word));
+            if (0 == word)
+            {
+                index += 8;
+                continue;
+            }
+        }
+
+        if (0 != h->counts[index])
+        {
+            break;
+        }
+        index++;
+    }
+
+    return index;
+}
+
+static int64_t slot_count(const struct hdr_compact_histogram* h, int32_t counts_index)
+{
+    int32_t slot = find_overflow(h, counts_index);
+
+    return h->counts[counts_index] + (OVERFLOW_EMPTY == slot ? 0 : h->overflow_counts[slot] * OVERFLOW_UNIT);
+}
+
+int64_t hdr_compact_count_at_value(const struct hdr_compact_histogram* h, int64_t value)
+{
+    int32_t counts_index = checked_counts_index(h, value, 0);
+    if (counts_index < 0)
+    {
+        return 0;
+    }
+
+    return slot_count(h, counts_index);
+}
+
+int64_t hdr_compact_add(struct hdr_histogram* h, const struct hdr_compact_histogram* from)
+{
+    struct hdr_compact_iter iter;
+    int64_t dropped = 0;
+
+    hdr_compact_iter_init(&iter, from);
+    while (hdr_compact_iter_next(&iter))
+    {
+        if (!hdr_record_values(h, iter.value, iter.count))
+        {
+            dropped += iter.count;
+        }
+    }
+
+    return dropped;
+}
+
+int64_t hdr_compact_value_at_percentile(const struct hdr_compact_histogram* h, double percentile)
+{
+    struct hdr_compact_iter iter;
+    double requested_percentile = percentile < 100.0 ? percentile : 100.0;
+    int64_t count_at_percentile =
+        (int64_t) (((requested_percentile / 100) * h->shape.total_count) + 0.5);
+    count_at_percentile = count_at_percentile > 0 ? count_at_percentile : 1;
+
+    hdr_compact_iter_init(&iter, h);
+    while (hdr_compact_iter_next(&iter))
+    {
+        if (iter.cumulative_count >= count_at_percentile)
+        {
+            return percentile == 0.0 ? iter.lowest_equivalent_value : iter.highest_equivalent_value;
+        }
+    }
+
+    return 0;
+}
+
+double hdr_compact_mean(const struct hdr_compact_histogram* h)
+{
+    struct hdr_compact_iter iter;
+    int64_t total = 0;
+
+    hdr_compact_iter_init(&iter, h);
+    while (hdr_compact_iter_next(&iter))
+    {
+        total += iter.count * iter.median_equivalent_value;
+    }
+
+    return (total * 1.0) / h->shape.total_count;
+}
+
+/* #### ######## ######## ########     ###    ########  #######  ########  */
+/*  ##     ##    ##       ##     ##   ## ##      ##    ##     ## ##     ## */
+/*  ##     ##    ##       ##     ##  ##   ##     ##    ##     ## ##     ## */
+/*  ##     ##    ######   ########  ##     ##    ##    ##     ## ########  */
+/*  ##     ##    ##       ##   ##   #########    ##    ##     ## ##   ##   */
+/*  ##     ##    ##       ##    ##  ##     ##    ##    ##     ## ##    ##  */
+/* ####    ##    ######## ##     ## ##     ##    ##     #######  ##     ## */
+
+void hdr_compact_iter_init(struct hdr_compact_iter* iter, const struct hdr_compact_histogram* h)
+{
+    iter->h = h;
+    iter->counts_index = -1;
+    iter->total_count = h->shape.total_count;
+    iter->count = 0;
+    iter->cumulative_count = 0;
+    iter->value = 0;
+    iter->lowest_equivalent_value = 0;
+    iter->highest_equivalent_value = 0;
+    iter->median_equivalent_value = 0;
+}
+
+bool hdr_compact_iter_next(struct hdr_compact_iter* iter)
+{
+    const struct hdr_compact_histogram* h = iter->h;
+    int32_t index;
+
+    if (iter->cumulative_count >= iter->total_count)
+    {
+        return false;
+    }
+
+    index = next_non_zero_slot(h, iter->counts_index + 1);
+    if (index >= h->shape.counts_len)
+    {
+        return false;
+    }
+
+    iter->counts_index = index;
+    iter->count = slot_count(h, index);
+    iter->cumulative_count += iter->count;
+    iter->value = hdr_value_at_index(&h->shape, index);
+    iter->lowest_equivalent_value = iter->value;
+    iter->highest_equivalent_value = hdr_next_non_equivalent_value(&h->shape, iter->value) - 1;
+    iter->median_equivalent_value = hdr_median_equivalent_value(&h->shape, iter->value);
+
+    return true;
+}
@@ -0,0 +1,378 @@
+/**
+ * hdr_histogram_corrected.c
+ * Released to the public domain, as explained at
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <hdr/hdr_histogram_corrected.h>
+
+#ifndef HDR_MALLOC_INCLUDE
+#define HDR_MALLOC_INCLUDE "hdr_malloc.h"
+#endif
+
+#include HDR_MALLOC_INCLUDE
+
+/* Private prototypes useful for the corrected view */
+int32_t counts_index_for(const struct hdr_histogram* h, int64_t value);
+
+/* A recorded bucket stands for 'count' values at its lowest equivalent value, each of */
+/* which implies the 'missing' values first_missing, first_missing + expected_interval, */
+/* ... up to the value less expected_interval. */
+struct hdr_corrected_slot
+{
+    int32_t index;
+    int64_t count;
+    int64_t first_missing;
+    int64_t missing;
+};
+
+/* The values of a sequence still to be iterated, next, next + expected_interval, ... */
+/* up to last, each implied 'count' times. */
+struct hdr_corrected_sequence
+{
+    int64_t next;
+    int64_t last;
+    int64_t count;
+};
+
+int hdr_corrected_view_init(struct hdr_corrected_view* view, const struct hdr_histogram* h, int64_t expected_interval)
+{
+    struct hdr_iter iter;
+    int32_t length = 0;
+
+    hdr_iter_recorded_init(&iter, h);
+    while (hdr_iter_next(&iter))
+    {
+        length++;
+    }
+
+    view->histogram = h;
+    view->expected_interval = expected_interval;
+    view->total_count = 0;
+    view->length = 0;
+    view->slots = (struct hdr_corrected_slot*) hdr_calloc(length > 0 ? (size_t) length : 1, sizeof(struct hdr_corrected_slot));
+    if (!view->slots)
+    {
+        return ENOMEM;
+    }
+
+    hdr_iter_recorded_init(&iter, h);
+    while (hdr_iter_next(&iter) && view->length < length)
+    {
+        struct hdr_corrected_slot* slot = &view->slots[view->length++];
+
+        slot->index = counts_index_for(h, iter.value);
+        slot->count = iter.count;
+        if (expected_interval > 0 && iter.value / expected_interval >= 2)
+        {
+            slot->missing = iter.value / expected_interval - 1;
+            slot->first_missing = iter.value - slot->missing * expected_interval;
+        }
+        view->total_count += slot->count * (1 + slot->missing);
+    }
+
+    return 0;
+}
+
+void hdr_corrected_view_close(struct hdr_corrected_view* view)
+{
+    hdr_free(view->slots);
+    view->slots = NULL;
+    view->length = 0;
+}
+
+static int64_t missing_at_or_below(
+    const struct hdr_corrected_view* view, const struct hdr_corrected_slot* slot, int64_t value)
+{
+    int64_t n;
+
+    if (0 == slot->missing || value < slot->first_missing)
+    {
+        return 0;
+    }
+
+    n = (value - slot->first_missing) / view->expected_interval + 1;
+    return n < slot->missing ? n : slot->missing;
+}
+
+static int64_t highest_equivalent_value_at(const struct hdr_histogram* h, int32_t index)
+{
+    return hdr_next_non_equivalent_value(h, hdr_value_at_index(h, index)) - 1;
+}
+
+/* Corrected count of the values in the buckets up to and including 'index'. */
+static int64_t cumulative_count_at(const struct hdr_corrected_view* view, int32_t index)
+{
+    const int64_t highest = highest_equivalent_value_at(view->histogram, index);
+    int64_t total = 0;
+    int32_t i;
+
+    for (i = 0; i < view->length; i++)
+    {
+        const struct hdr_corrected_slot* slot = &view->slots[i];
+        if (slot->index <= index)
+        {
+            total += slot->count;
+        }
+        total += slot->count * missing_at_or_below(view, slot, highest);
+    }
+
+    return total;
+}
+
+/* ##     ##    ###    ##       ##     ## ########  ######  */
+/* ##     ##   ## ##   ##       ##     ## ##       ##    ## */
+/* ##     ##  ##   ##  ##       ##     ## ##       ##       */
+/* ##     ## ##     ## ##       ##     ## ######    ######  */
+/*  ##   ##  ######### ##       ##     ## ##             ## */
+/*   ## ##   ##     ## ##       ##     ## ##       ##    ## */
+/*    ###    ##     ## ########  #######  ########  ######  */
+
+int64_t hdr_corrected_total_count(const struct hdr_corrected_view* view)
+{
+    return view->total_count;
+}
+
+int64_t hdr_corrected_min(const struct hdr_corrected_view* view)
+{
+    int64_t min = hdr_min(view->histogram);
+    int32_t i;
+
+    for (i = 0; i < view->length; i++)
+    {
+        const struct hdr_corrected_slot* slot = &view->slots[i];
+        if (slot->missing > 0)
+        {
+            const int64_t lowest = hdr_lowest_equivalent_value(view->histogram, slot->first_missing);
+            min = lowest < min ? lowest : min;
+        }
+    }
+
+    return min;
+}
+
+int64_t hdr_corrected_max(const struct hdr_corrected_view* view)
+{
+    /* The missing values are all below the value that implies them. */
+    return hdr_max(view->histogram);
+}
+
+double hdr_corrected_mean(const struct hdr_corrected_view* view)
+{
+    const struct hdr_histogram* h = view->histogram;
+    const double interval = (double) view->expected_interval;
+    double total = 0.0;
+    int32_t i;
+
+    for (i = 0; i < view->length; i++)
+    {
+        const struct hdr_corrected_slot* slot = &view->slots[i];
+        const double missing = (double) slot->missing;
+        const double missing_total =
+            missing * (double) slot->first_missing + interval * missing * (missing - 1) / 2;
+
+        total += (double) slot->count *
+            ((double) hdr_median_equivalent_value(h, hdr_value_at_index(h, slot->index)) + missing_total);
+    }
+
+    return total / view->total_count;
+}
+
+int64_t hdr_corrected_value_at_percentile(const struct hdr_corrected_view* view, double percentile)
+{
+    const struct hdr_histogram* h = view->histogram;
+    double requested_percentile = percentile < 100.0 ? percentile : 100.0;
+    int64_t count_at_percentile = (int64_t) (((requested_percentile / 100) * view->total_count) + 0.5);
+    int32_t lo = 0;
+    int32_t hi;
+    int64_t value;
+
+    if (0 == view->length)
+    {
+        return 0;
+    }
+
+    count_at_percentile = count_at_percentile > 0 ? count_at_percentile : 1;
+
+    /* The cumulative count only grows with the index, the recorded max bucket holds all. */
+    hi = view->slots[view->length - 1].index;
+    while (lo < hi)
+    {
+        int32_t mid = lo + ((hi - lo) >> 1);
+        if (cumulative_count_at(view, mid) >= count_at_percentile)
+        {
+            hi = mid;
+        }
+        else
+        {
+            lo = mid + 1;
+        }
+    }
+
+    value = hdr_value_at_index(h, lo);
+    if (percentile == 0.0)
+    {
+        return hdr_lowest_equivalent_value(h, value);
+    }
+    return highest_equivalent_value_at(h, lo);
+}
+
+int64_t hdr_corrected_count_at_value(const struct hdr_corrected_view* view, int64_t value)
+{
+    const int32_t index = counts_index_for(view->histogram, value);
+
+    if (value < 0 || index < 0 || view->histogram->counts_len <= index)
+    {
+        return 0;
+    }
+
+    return cumulative_count_at(view, index) - (index > 0 ? cumulative_count_at(view, index - 1) : 0);
+}
+
+/* #### ######## ######## ########     ###    ########  #######  ########  */
+/*  ##     ##    ##       ##     ##   ## ##      ##    ##     ## ##     ## */
+/*  ##     ##    ##       ##     ##  ##   ##     ##    ##     ## ##     ## */
+/*  ##     ##    ######   ########  ##     ##    ##    ##     ## ########  */
+/*  ##     ##    ##       ##   ##   #########    ##    ##     ## ##   ##   */
+/*  ##     ##    ##       ##    ##  ##     ##    ##    ##     ## ##    ##  */
+/* ####    ##    ######## ##     ## ##     ##    ##     #######  ##     ## */
+
+/* The pending sequences form a binary min-heap on their next value. */
+static void sift_down(struct hdr_corrected_sequence* heap, int32_t length, int32_t i)
+{
+    const struct hdr_corrected_sequence moved = heap[i];
+
+    for (;;)
+    {
+        int32_t child = 2 * i + 1;
+
+        if (child >= length)
+        {
+            break;
+        }
+        if (child + 1 < length && heap[child + 1].next < heap[child].next)
+        {
+            child++;
+        }
+        if (moved.next <= heap[child].next)
+        {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+
+    heap[i] = moved;
+}
+
+int hdr_corrected_iter_init(struct hdr_corrected_iter* iter, const struct hdr_corrected_view* view)
+{
+    int32_t i;
+
+    iter->view = view;
+    iter->counts_index = -1;
+    iter->count = 0;
+    iter->cumulative_count = 0;
+    iter->value = 0;
+    iter->lowest_equivalent_value = 0;
+    iter->highest_equivalent_value = -1;
+    iter->next_slot = 0;
+    iter->pending_length = 0;
+    iter->pending = (struct hdr_corrected_sequence*) hdr_calloc(
+        view->length > 0 ? (size_t) view->length : 1, sizeof(struct hdr_corrected_sequence));
+    if (!iter->pending)
+    {
+        return ENOMEM;
+    }
+
+    for (i = 0; i < view->length; i++)
+    {
+        const struct hdr_corrected_slot* slot = &view->slots[i];
+
+        if (slot->missing > 0)
+        {
+            struct hdr_corrected_sequence* sequence = &iter->pending[iter->pending_length++];
+
+            sequence->next = slot->first_missing;
+            sequence->last = slot->first_missing + (slot->missing - 1) * view->expected_interval;
+            sequence->count = slot->count;
+        }
+    }
+    for (i = iter->pending_length / 2 - 1; i >= 0; i--)
+    {
+        sift_down(iter->pending, iter->pending_length, i);
+    }
+
+    return 0;
+}
+
+void hdr_corrected_iter_close(struct hdr_corrected_iter* iter)
+{
+    hdr_free(iter->pending);
+    iter->pending = NULL;
+    iter->pending_length = 0;
+}
+
+bool hdr_corrected_iter_next(struct hdr_corrected_iter* iter)
+{
+    const struct hdr_corrected_view* view = iter->view;
+    const struct hdr_histogram* h = view->histogram;
+    const int64_t interval = view->expected_interval;
+    struct hdr_corrected_sequence* pending = iter->pending;
+    int32_t next = iter->next_slot < view->length ? view->slots[iter->next_slot].index : h->counts_len;
+    int64_t highest;
+    int64_t count = 0;
+
+    /* The next non-zero bucket holds either the next recorded value or the lowest */
+    /* pending missing value, whichever comes first. */
+    if (iter->pending_length > 0)
+    {
+        const int32_t index = counts_index_for(h, pending[0].next);
+        next = index < next ? index : next;
+    }
+
+    if (next >= h->counts_len)
+    {
+        return false;
+    }
+
+    highest = highest_equivalent_value_at(h, next);
+
+    if (iter->next_slot < view->length && view->slots[iter->next_slot].index == next)
+    {
+        count += view->slots[iter->next_slot++].count;
+    }
+
+    /* Only the sequences with values in this bucket are touched, each is advanced */
+    /* past it or retired. */
+    while (iter->pending_length > 0 && pending[0].next <= highest)
+    {
+        struct hdr_corrected_sequence* sequence = &pending[0];
+        const int64_t upto = sequence->last < highest ? sequence->last : highest;
+        const int64_t n = (upto - sequence->next) / interval + 1;
+
+        count += sequence->count * n;
+        if (upto == sequence->last)
+        {
+            pending[0] = pending[--iter->pending_length];
+        }
+        else
+        {
+            sequence->next += n * interval;
+        }
+        sift_down(pending, iter->pending_length, 0);
+    }
+
+    iter->count = count;
+    iter->cumulative_count += count;
+    iter->counts_index = next;
+    iter->value = hdr_value_at_index(h, next);
+    iter->lowest_equivalent_value = iter->value;
+    iter->highest_equivalent_value = highest;
+
+    return true;
+}
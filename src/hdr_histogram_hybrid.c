@@ -0,0 +1,270 @@
+/**
+ * hdr_histogram_hybrid.c
+ * Released to the public domain, as explained at
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <hdr/hdr_histogram_hybrid.h>
+
+#ifndef HDR_MALLOC_INCLUDE
+#define HDR_MALLOC_INCLUDE "hdr_malloc.h"
+#endif
+
+#include HDR_MALLOC_INCLUDE
+
+int hdr_hybrid_init(
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    int32_t capacity,
+    struct hdr_hybrid_histogram** result)
+{
+    struct hdr_histogram_bucket_config cfg;
+    struct hdr_hybrid_histogram* h;
+
+    int r = hdr_calculate_bucket_config(lowest_discernible_value, highest_trackable_value, significant_figures, &cfg);
+    if (r)
+    {
+        return r;
+    }
+    if (capacity < 0)
+    {
+        return EINVAL;
+    }
+
+    /* The header and the value buffer share a single allocation. */
+    h = (struct hdr_hybrid_histogram*) hdr_malloc(sizeof(struct hdr_hybrid_histogram) + sizeof(int64_t) * (size_t) capacity);
+    if (!h)
+    {
+        return ENOMEM;
+    }
+
+    h->lowest_discernible_value = lowest_discernible_value;
+    h->highest_trackable_value = highest_trackable_value;
+    h->significant_figures = significant_figures;
+    h->capacity = capacity;
+    h->length = 0;
+    h->values = (int64_t*) (h + 1);
+    h->histogram = NULL;
+
+    *result = h;
+
+    return 0;
+}
+
+void hdr_hybrid_close(struct hdr_hybrid_histogram* h)
+{
+    if (h)
+    {
+        hdr_close(h->histogram);
+        hdr_free(h);
+    }
+}
+
+void hdr_hybrid_reset(struct hdr_hybrid_histogram* h)
+{
+    h->length = 0;
+    if (h->histogram)
+    {
+        hdr_reset(h->histogram);
+    }
+}
+
+/* ########  ########  ######   #######  ########  ########  #### ##    ##  ######   */
+/* ##     ## ##       ##    ## ##     ## ##     ## ##     ##  ##  ###   ## ##    ##  */
+/* ##     ## ##       ##       ##     ## ##     ## ##     ##  ##  ####  ## ##        */
+/* ########  ######   ##       ##     ## ########  ##     ##  ##  ## ## ## ##   #### */
+/* ##   ##   ##       ##       ##     ## ##   ##   ##     ##  ##  ##  #### ##    ##  */
+/* ##    ##  ##       ##    ## ##     ## ##    ##  ##     ##  ##  ##   ### ##    ##  */
+/* ##     ## ########  ######   #######  ##     ## ########  #### ##    ##  ######   */
+
+static int promote(struct hdr_hybrid_histogram* h)
+{
+    int32_t i = 0;
+
+    int r = hdr_init(h->lowest_discernible_value, h->highest_trackable_value, h->significant_figures, &h->histogram);
+    if (r)
+    {
+        h->histogram = NULL;
+        return r;
+    }
+
+    /* The buffer is sorted, so equal values are recorded as one run. */
+    while (i < h->length)
+    {
+        int32_t end = i + 1;
+        while (end < h->length && h->values[end] == h->values[i])
+        {
+            end++;
+        }
+        hdr_record_values(h->histogram, h->values[i], end - i);
+        i = end;
+    }
+    h->length = 0;
+
+    return 0;
+}
+
+/* Index of the first buffered value greater than 'value'. */
+static int32_t upper_bound(const struct hdr_hybrid_histogram* h, int64_t value)
+{
+    int32_t lo = 0;
+    int32_t hi = h->length;
+
+    while (lo < hi)
+    {
+        int32_t mid = lo + ((hi - lo) >> 1);
+        if (h->values[mid] <= value)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+bool hdr_hybrid_record_values(struct hdr_hybrid_histogram* h, int64_t value, int64_t count)
+{
+    int32_t position, i;
+
+    if (value < 0 || count < 0 || h->highest_trackable_value < value)
+    {
+        return false;
+    }
+
+    if (!h->histogram && count > h->capacity - h->length && promote(h))
+    {
+        return false;
+    }
+
+    if (h->histogram)
+    {
+        return hdr_record_values(h->histogram, value, count);
+    }
+
+    position = upper_bound(h, value);
+    memmove(&h->values[position + count], &h->values[position], sizeof(int64_t) * (size_t) (h->length - position));
+    for (i = 0; i < count; i++)
+    {
+        h->values[position + i] = value;
+    }
+    h->length += (int32_t) count;
+
+    return true;
+}
+
+bool hdr_hybrid_record_value(struct hdr_hybrid_histogram* h, int64_t value)
+{
+    return hdr_hybrid_record_values(h, value, 1);
+}
+
+/* ##     ##    ###    ##       ##     ## ########  ######  */
+/* ##     ##   ## ##   ##       ##     ## ##       ##    ## */
+/* ##     ##  ##   ##  ##       ##     ## ##       ##       */
+/* ##     ## ##     ## ##       ##     ## ######    ######  */
+/*  ##   ##  ######### ##       ##     ## ##             ## */
+/*   ## ##   ##     ## ##       ##     ## ##       ##    ## */
+/*    ###    ##     ## ######## ########  ########  ######  */
+
+int64_t hdr_hybrid_total_count(const struct hdr_hybrid_histogram* h)
+{
+    return h->histogram ? h->histogram->total_count : h->length;
+}
+
+int64_t hdr_hybrid_min(const struct hdr_hybrid_histogram* h)
+{
+    if (h->histogram)
+    {
+        return hdr_min(h->histogram);
+    }
+
+    return 0 == h->length ? INT64_MAX : h->values[0];
+}
+
+int64_t hdr_hybrid_max(const struct hdr_hybrid_histogram* h)
+{
+    if (h->histogram)
+    {
+        return hdr_max(h->histogram);
+    }
+
+    return 0 == h->length ? 0 : h->values[h->length - 1];
+}
+
+double hdr_hybrid_mean(const struct hdr_hybrid_histogram* h)
+{
+    double total = 0.0;
+    int32_t i;
+
+    if (h->histogram)
+    {
+        return hdr_mean(h->histogram);
+    }
+
+    for (i = 0; i < h->length; i++)
+    {
+        total += (double) h->values[i];
+    }
+
+    return total / h->length;
+}
+
+int64_t hdr_hybrid_value_at_percentile(const struct hdr_hybrid_histogram* h, double percentile)
+{
+    double requested_percentile = percentile < 100.0 ? percentile : 100.0;
+    int64_t count_at_percentile;
+
+    if (h->histogram)
+    {
+        return hdr_value_at_percentile(h->histogram, percentile);
+    }
+    if (0 == h->length)
+    {
+        return 0;
+    }
+
+    /* Rank as hdr_value_at_percentile computes it, but of the exact values. */
+    count_at_percentile = (int64_t) (((requested_percentile / 100) * h->length) + 0.5);
+    count_at_percentile = count_at_percentile > 0 ? count_at_percentile : 1;
+
+    return h->values[count_at_percentile - 1];
+}
+
+int64_t hdr_hybrid_add(struct hdr_histogram* h, const struct hdr_hybrid_histogram* from)
+{
+    int64_t dropped = 0;
+    int32_t i;
+
+    if (from->histogram)
+    {
+        return hdr_add(h, from->histogram);
+    }
+
+    for (i = 0; i < from->length; i++)
+    {
+        if (!hdr_record_value(h, from->values[i]))
+        {
+            dropped++;
+        }
+    }
+
+    return dropped;
+}
+
+size_t hdr_hybrid_get_memory_size(const struct hdr_hybrid_histogram* h)
+{
+    size_t size = sizeof(struct hdr_hybrid_histogram) + sizeof(int64_t) * (size_t) h->capacity;
+    if (h->histogram)
+    {
+        size += hdr_get_memory_size(h->histogram);
+    }
+    return size;
+}
@@ -40,6 +40,7 @@ typedef SSIZE_T ssize_t;
 
 /* Private prototypes useful for the logger */
 int32_t counts_index_for(const struct hdr_histogram* h, int64_t value);
+int32_t counts_next_non_zero_index(const struct hdr_histogram* h, int32_t index, int32_t end);
 
 
 #define FAIL_AND_CLEANUP(label, error_name, error) \
@@ -135,6 +136,22 @@ static uint64_t double_to_int64_bits(double d)
     return x.l;
 }
 
+/* Shifted histograms are encoded by value, as they would be stored with no offset. */
+static int32_t next_non_zero_index(const struct hdr_histogram* h, int32_t index, int32_t end)
+{
+    if (0 == h->normalizing_index_offset)
+    {
+        return counts_next_non_zero_index(h, index, end);
+    }
+
+    while (index < end && 0 == hdr_count_at_index(h, index))
+    {
+        index++;
+    }
+
+    return index;
+}
+
 #pragma pack(push, 1)
 typedef struct /*__attribute__((__packed__))*/
 {
@@ -170,6 +187,30 @@ typedef struct /*__attribute__((__packed__))*/
 #define SIZEOF_ENCODING_FLYWEIGHT_V1 (sizeof(encoding_flyweight_v1_t) - sizeof(uint8_t))
 #define SIZEOF_COMPRESSION_FLYWEIGHT (sizeof(compression_flyweight_t) - sizeof(uint8_t))
 
+/* The wire format only describes the standard layout, so a tiered histogram is */
+/* encoded as one with the precision of its finest tier.  Each tier slot falls within */
+/* one slot of that, the values decoded are the lowest of the tier slots. */
+static int encode_tiered(
+    struct hdr_histogram* h,
+    uint8_t** compressed_histogram,
+    size_t* compressed_len)
+{
+    struct hdr_histogram* standard;
+    int result = hdr_init(
+        h->lowest_discernible_value, h->highest_trackable_value, h->significant_figures, &standard);
+    if (result)
+    {
+        return result;
+    }
+
+    hdr_add(standard, h);
+    standard->conversion_ratio = h->conversion_ratio;
+    result = hdr_encode_compressed(standard, compressed_histogram, compressed_len);
+    hdr_close(standard);
+
+    return result;
+}
+
 int hdr_encode_compressed(
     struct hdr_histogram* h,
     uint8_t** compressed_histogram,
@@ -189,6 +230,12 @@ int hdr_encode_compressed(
     int32_t counts_limit = len_to_max < h->counts_len ? len_to_max : h->counts_len;
 
     const size_t encoded_len = SIZEOF_ENCODING_FLYWEIGHT_V1 + MAX_BYTES_LEB128 * (size_t) counts_limit;
+
+    if (h->layout)
+    {
+        return encode_tiered(h, compressed_histogram, compressed_len);
+    }
+
     if ((encoded = (encoding_flyweight_v1_t*) hdr_calloc(encoded_len, sizeof(uint8_t))) == NULL)
     {
         FAIL_AND_CLEANUP(cleanup, result, ENOMEM);
@@ -196,18 +243,14 @@ int hdr_encode_compressed(
 
     for (i = 0; i < counts_limit;)
     {
-        int64_t value = h->counts[i];
+        int64_t value = 0 == h->normalizing_index_offset ? h->counts[i] : hdr_count_at_index(h, i);
         i++;
 
         if (value == 0)
         {
-            int32_t zeros = 1;
-
-            while (i < counts_limit && 0 == h->counts[i])
-            {
-                zeros++;
-                i++;
-            }
+            int32_t next = next_non_zero_index(h, i, counts_limit);
+            int32_t zeros = 1 + next - i;
+            i = next;
 
             data_index += zig_zag_encode_i64(&encoded->counts[data_index], -zeros);
         }
@@ -362,6 +405,7 @@ static int apply_to_counts(
 static int hdr_decode_compressed_v0(
     compression_flyweight_t* compression_flyweight,
     size_t length,
+    const struct hdr_allocator* allocator,
     struct hdr_histogram** histogram)
 {
     struct hdr_histogram* h = NULL;
@@ -407,10 +451,11 @@ static int hdr_decode_compressed_v0(
     highest_trackable_value = be64toh(encoding_flyweight.highest_trackable_value);
     significant_figures = be32toh(encoding_flyweight.significant_figures);
 
-    if (hdr_init(
+    if (hdr_init_ex(
         lowest_discernible_value,
         highest_trackable_value,
         significant_figures,
+        allocator,
         &h) != 0)
     {
         FAIL_AND_CLEANUP(cleanup, result, ENOMEM);
@@ -451,7 +496,7 @@ cleanup:
     else
     {
         hdr_add(*histogram, h);
-        hdr_free(h);
+        hdr_close(h);
     }
 
     return result;
@@ -460,6 +505,7 @@ cleanup:
 static int hdr_decode_compressed_v1(
     compression_flyweight_t* compression_flyweight,
     size_t length,
+    const struct hdr_allocator* allocator,
     struct hdr_histogram** histogram)
 {
     struct hdr_histogram* h = NULL;
@@ -510,10 +556,11 @@ static int hdr_decode_compressed_v1(
     highest_trackable_value = be64toh(encoding_flyweight.highest_trackable_value);
     significant_figures = be32toh(encoding_flyweight.significant_figures);
 
-    if (hdr_init(
+    if (hdr_init_ex(
         lowest_discernible_value,
         highest_trackable_value,
         significant_figures,
+        allocator,
         &h) != 0)
     {
         FAIL_AND_CLEANUP(cleanup, result, ENOMEM);
@@ -537,7 +584,8 @@ static int hdr_decode_compressed_v1(
 
     apply_to_counts(h, word_size, counts_array, counts_limit);
 
-    h->normalizing_index_offset = be32toh(encoding_flyweight.normalizing_index_offset);
+    /* The counts are encoded in value order, as a histogram with no offset holds them. */
+    h->normalizing_index_offset = 0;
     h->conversion_ratio = int64_bits_to_double(be64toh(encoding_flyweight.conversion_ratio_bits));
     hdr_reset_internal_counters(h);
 
@@ -556,7 +604,7 @@ cleanup:
     else
     {
         hdr_add(*histogram, h);
-        hdr_free(h);
+        hdr_close(h);
     }
 
     return result;
@@ -565,6 +613,7 @@ cleanup:
 static int hdr_decode_compressed_v2(
     compression_flyweight_t* compression_flyweight,
     size_t length,
+    const struct hdr_allocator* allocator,
     struct hdr_histogram** histogram)
 {
     struct hdr_histogram* h = NULL;
@@ -611,7 +660,7 @@ static int hdr_decode_compressed_v2(
     highest_trackable_value = be64toh(encoding_flyweight.highest_trackable_value);
     significant_figures = be32toh(encoding_flyweight.significant_figures);
 
-    rc = hdr_init(lowest_discernible_value, highest_trackable_value, significant_figures, &h);
+    rc = hdr_init_ex(lowest_discernible_value, highest_trackable_value, significant_figures, allocator, &h);
     if (rc)
     {
         FAIL_AND_CLEANUP(cleanup, result, rc);
@@ -639,7 +688,8 @@ static int hdr_decode_compressed_v2(
         FAIL_AND_CLEANUP(cleanup, result, rc);
     }
 
-    h->normalizing_index_offset = be32toh(encoding_flyweight.normalizing_index_offset);
+    /* The counts are encoded in value order, as a histogram with no offset holds them. */
+    h->normalizing_index_offset = 0;
     h->conversion_ratio = int64_bits_to_double(be64toh(encoding_flyweight.conversion_ratio_bits));
     hdr_reset_internal_counters(h);
 
@@ -658,7 +708,7 @@ cleanup:
     else
     {
         hdr_add(*histogram, h);
-        hdr_free(h);
+        hdr_close(h);
     }
 
     return result;
@@ -666,6 +716,12 @@ cleanup:
 
 int hdr_decode_compressed(
     uint8_t* buffer, size_t length, struct hdr_histogram** histogram)
+{
+    return hdr_decode_compressed_ex(buffer, length, NULL, histogram);
+}
+
+int hdr_decode_compressed_ex(
+    uint8_t* buffer, size_t length, const struct hdr_allocator* allocator, struct hdr_histogram** histogram)
 {
     uint32_t compression_cookie;
     compression_flyweight_t* compression_flyweight;
@@ -680,15 +736,15 @@ int hdr_decode_compressed(
     compression_cookie = get_cookie_base(be32toh(compression_flyweight->cookie));
     if (V0_COMPRESSION_COOKIE == compression_cookie)
     {
-        return hdr_decode_compressed_v0(compression_flyweight, length, histogram);
+        return hdr_decode_compressed_v0(compression_flyweight, length, allocator, histogram);
     }
     else if (V1_COMPRESSION_COOKIE == compression_cookie)
     {
-        return hdr_decode_compressed_v1(compression_flyweight, length, histogram);
+        return hdr_decode_compressed_v1(compression_flyweight, length, allocator, histogram);
     }
     else if (V2_COMPRESSION_COOKIE == compression_cookie)
     {
-        return hdr_decode_compressed_v2(compression_flyweight, length, histogram);
+        return hdr_decode_compressed_v2(compression_flyweight, length, allocator, histogram);
     }
 
     return HDR_COMPRESSION_COOKIE_MISMATCH;
@@ -1074,6 +1130,13 @@ enum parse_log_state {
 
 int hdr_log_read_entry(
     struct hdr_log_reader* reader, FILE* file, struct hdr_log_entry *entry, struct hdr_histogram** histogram)
+{
+    return hdr_log_read_entry_ex(reader, file, entry, NULL, histogram);
+}
+
+int hdr_log_read_entry_ex(
+    struct hdr_log_reader* reader, FILE* file, struct hdr_log_entry *entry,
+    const struct hdr_allocator* allocator, struct hdr_histogram** histogram)
 {
     enum parse_log_state state = INIT;
     size_t capacity = 1024;
@@ -1218,7 +1281,7 @@ int hdr_log_read_entry(
         goto cleanup;
     }
 
-    result = hdr_decode_compressed(compressed_histogram, compressed_len, histogram);
+    result = hdr_decode_compressed_ex(compressed_histogram, compressed_len, allocator, histogram);
 
 cleanup:
     hdr_free(base64_histogram);
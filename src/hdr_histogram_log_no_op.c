@@ -65,6 +65,17 @@ int hdr_decode_compressed(
     return -1;
 }
 
+int hdr_decode_compressed_ex(
+    uint8_t* buffer, size_t length, const struct hdr_allocator* allocator, struct hdr_histogram** histogram)
+{
+    UNUSED(buffer);
+    UNUSED(length);
+    UNUSED(allocator);
+    UNUSED(histogram);
+
+    return -1;
+}
+
 int hdr_log_writer_init(struct hdr_log_writer* writer)
 {
     UNUSED(writer);
@@ -153,6 +164,19 @@ int hdr_log_read_entry(
     return -1;
 }
 
+int hdr_log_read_entry_ex(
+    struct hdr_log_reader* reader, FILE* file, struct hdr_log_entry *entry,
+    const struct hdr_allocator* allocator, struct hdr_histogram** histogram)
+{
+    UNUSED(reader);
+    UNUSED(file);
+    UNUSED(entry);
+    UNUSED(allocator);
+    UNUSED(histogram);
+
+    return -1;
+}
+
 int hdr_log_encode(struct hdr_histogram* histogram, char** encoded_histogram)
 {
     UNUSED(histogram);
@@ -0,0 +1,186 @@
+/**
+ * hdr_histogram_pool.c
+ * Released to the public domain, as explained at
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <hdr/hdr_histogram_pool.h>
+
+#ifndef HDR_MALLOC_INCLUDE
+#define HDR_MALLOC_INCLUDE "hdr_malloc.h"
+#endif
+
+#include HDR_MALLOC_INCLUDE
+
+/* Private prototypes useful for the pool */
+void clear_counts_in_allocation(void* allocation, int32_t counts_len);
+
+/* Every block carries a flag in front of the memory handed out, so release can */
+/* tell pooled blocks from ones passed through to the default allocator. */
+struct pool_block
+{
+    struct pool_block* next;
+    int64_t pooled;
+};
+
+#define POOL_BLOCK_PREFIX ((sizeof(struct pool_block) + 15) & ~(size_t) 15)
+
+static struct pool_block* block_of(void* ptr)
+{
+    return (struct pool_block*) ((char*) ptr - POOL_BLOCK_PREFIX);
+}
+
+static void* memory_of(struct pool_block* block)
+{
+    return (char*) block + POOL_BLOCK_PREFIX;
+}
+
+static void push_block(struct hdr_histogram_pool* pool, struct pool_block* block)
+{
+    hdr_mutex_lock(pool->mutex);
+    block->next = (struct pool_block*) pool->free_blocks;
+    pool->free_blocks = block;
+    hdr_mutex_unlock(pool->mutex);
+}
+
+static struct pool_block* pop_block(struct hdr_histogram_pool* pool)
+{
+    struct pool_block* block;
+
+    hdr_mutex_lock(pool->mutex);
+    block = (struct pool_block*) pool->free_blocks;
+    if (block)
+    {
+        pool->free_blocks = block->next;
+    }
+    hdr_mutex_unlock(pool->mutex);
+
+    return block;
+}
+
+static void* pool_allocate(void* context, size_t size)
+{
+    struct hdr_histogram_pool* pool = (struct hdr_histogram_pool*) context;
+    struct pool_block* block = NULL;
+    int64_t pooled = size == pool->block_size;
+
+    if (pooled)
+    {
+        block = pop_block(pool);
+    }
+
+    /* The allocator hands out zeroed memory, pooled blocks are zeroed on release. */
+    if (!block)
+    {
+        block = (struct pool_block*) hdr_calloc(1, POOL_BLOCK_PREFIX + size);
+        if (!block)
+        {
+            return NULL;
+        }
+    }
+
+    block->pooled = pooled;
+
+    return memory_of(block);
+}
+
+static void pool_release(void* context, void* ptr)
+{
+    struct hdr_histogram_pool* pool = (struct hdr_histogram_pool*) context;
+    struct pool_block* block = block_of(ptr);
+
+    if (block->pooled)
+    {
+        clear_counts_in_allocation(ptr, pool->cfg.counts_len);
+        push_block(pool, block);
+    }
+    else
+    {
+        hdr_free(block);
+    }
+}
+
+int hdr_histogram_pool_init(
+    struct hdr_histogram_pool* pool,
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures)
+{
+    int rc = hdr_calculate_bucket_config(
+        lowest_discernible_value, highest_trackable_value, significant_figures, &pool->cfg);
+    if (rc)
+    {
+        return rc;
+    }
+
+    pool->allocator.allocate = pool_allocate;
+    pool->allocator.release = pool_release;
+    pool->allocator.context = pool;
+    pool->allocator.zeroed = true;
+    pool->block_size = hdr_calculate_allocation_size(&pool->cfg);
+    pool->free_blocks = NULL;
+
+    pool->mutex = hdr_mutex_alloc();
+    if (!pool->mutex)
+    {
+        return ENOMEM;
+    }
+
+    rc = hdr_mutex_init(pool->mutex);
+    if (0 != rc)
+    {
+        hdr_mutex_free(pool->mutex);
+        return rc;
+    }
+
+    return 0;
+}
+
+void hdr_histogram_pool_destroy(struct hdr_histogram_pool* pool)
+{
+    struct pool_block* block = (struct pool_block*) pool->free_blocks;
+    while (block)
+    {
+        struct pool_block* next = block->next;
+        hdr_free(block);
+        block = next;
+    }
+    pool->free_blocks = NULL;
+
+    hdr_mutex_destroy(pool->mutex);
+    hdr_mutex_free(pool->mutex);
+}
+
+int hdr_histogram_pool_preallocate(struct hdr_histogram_pool* pool, int count)
+{
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        struct pool_block* block = (struct pool_block*) hdr_malloc(POOL_BLOCK_PREFIX + pool->block_size);
+        if (!block)
+        {
+            return ENOMEM;
+        }
+
+        /* Zero every page now, so the first use of the block does not fault. */
+        memset(block, 0, POOL_BLOCK_PREFIX + pool->block_size);
+        block->pooled = 1;
+        push_block(pool, block);
+    }
+
+    return 0;
+}
+
+int hdr_histogram_pool_acquire(struct hdr_histogram_pool* pool, struct hdr_histogram** result)
+{
+    return hdr_init_ex(
+        pool->cfg.lowest_discernible_value,
+        pool->cfg.highest_trackable_value,
+        (int) pool->cfg.significant_figures,
+        &pool->allocator,
+        result);
+}
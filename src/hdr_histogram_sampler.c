@@ -0,0 +1,120 @@
+/**
+ * hdr_histogram_sampler.c
+ * Released to the public domain, as explained at
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <math.h>
+#include <errno.h>
+
+#include <hdr/hdr_histogram_sampler.h>
+
+/* splitmix64, spreads the bits of a seed so nearby seeds give unrelated sequences. */
+static uint64_t mix_seed(uint64_t seed)
+{
+    uint64_t z = seed + UINT64_C(0x9E3779B97F4A7C15);
+    z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+    z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+    return z ^ (z >> 31);
+}
+
+/* xorshift64*, uniform in (0, 1]. */
+static double next_uniform(struct hdr_sampler* s)
+{
+    uint64_t x = s->random_state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    s->random_state = x;
+    return (double) (((x * UINT64_C(0x2545F4914F6CDD1D)) >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+/* Number of values up to and including the next one sampled. */
+static int64_t next_countdown(struct hdr_sampler* s)
+{
+    double skipped;
+
+    if (0 != s->interval)
+    {
+        return s->interval;
+    }
+
+    skipped = floor(log(next_uniform(s)) / log1p(-s->rate));
+    return skipped < (double) INT64_MAX ? (int64_t) skipped + 1 : INT64_MAX;
+}
+
+/* The count a sample stands for, 1 / rate rounded at random to keep its mean exact. */
+static int64_t sample_count(struct hdr_sampler* s)
+{
+    double weight;
+    int64_t whole;
+
+    if (0 != s->interval)
+    {
+        return s->interval;
+    }
+
+    weight = 1.0 / s->rate;
+    whole = (int64_t) weight;
+    return whole + (next_uniform(s) <= weight - (double) whole ? 1 : 0);
+}
+
+int hdr_sampler_init_interval(struct hdr_sampler* s, struct hdr_histogram* h, int64_t interval)
+{
+    if (interval < 1)
+    {
+        return EINVAL;
+    }
+
+    s->histogram = h;
+    s->interval = interval;
+    s->rate = 1.0 / (double) interval;
+    s->random_state = 0;
+    s->countdown = interval;
+
+    return 0;
+}
+
+int hdr_sampler_init_bernoulli(struct hdr_sampler* s, struct hdr_histogram* h, double rate, uint64_t seed)
+{
+    /* Below 1 / INT64_MAX the count of a sample does not fit in an int64_t. */
+    if (!(rate > 0x1p-63 && rate <= 1.0))
+    {
+        return EINVAL;
+    }
+    if (1.0 == rate)
+    {
+        return hdr_sampler_init_interval(s, h, 1);
+    }
+
+    s->histogram = h;
+    s->interval = 0;
+    s->rate = rate;
+    /* xorshift must not be seeded with zero. */
+    s->random_state = mix_seed(seed) | 1;
+    s->countdown = next_countdown(s);
+
+    return 0;
+}
+
+bool hdr_sampler_record_value(struct hdr_sampler* s, int64_t value)
+{
+    if (--s->countdown > 0)
+    {
+        return true;
+    }
+
+    s->countdown = next_countdown(s);
+    return hdr_record_values(s->histogram, value, sample_count(s));
+}
+
+bool hdr_sampler_record_value_atomic(struct hdr_sampler* s, int64_t value)
+{
+    if (--s->countdown > 0)
+    {
+        return true;
+    }
+
+    s->countdown = next_countdown(s);
+    return hdr_record_values_atomic(s->histogram, value, sample_count(s));
+}
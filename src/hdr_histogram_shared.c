@@ -0,0 +1,695 @@
+/**
+ * hdr_histogram_shared.c
+ * Released to the public domain, as explained at
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include <hdr/hdr_histogram_shared.h>
+#include <hdr/hdr_thread.h>
+#include <hdr/hdr_writer_reader_phaser.h>
+#include "hdr_atomic.h"
+#include "hdr_tests.h"
+
+#define BUFFER_COOKIE  0x1c849380
+#define BUFFER_VERSION 2
+#define SEGMENT_COOKIE INT64_C(0x1c849381)
+
+#define HDR_CACHE_LINE_SIZE 64
+
+/* Wait up to a second for a segment being created by another process. */
+#define OPEN_WAIT_US 1000
+#define OPEN_WAIT_ATTEMPTS 1000
+
+struct buffer_header
+{
+    int32_t cookie;
+    int32_t version;
+    int64_t lowest_discernible_value;
+    int64_t highest_trackable_value;
+    int32_t significant_figures;
+    int32_t counts_len;
+    /* Of the counts, from the start of the buffer. */
+    int64_t counts_offset;
+    /* Stored by hdr_sync_file, the view's are kept in process memory. */
+    int64_t total_count;
+    int64_t min_value;
+    int64_t max_value;
+    uint64_t checksum;
+    /* Set while a process has the file open, not covered by the checksum. */
+    int64_t dirty;
+};
+
+struct shared_segment
+{
+    int64_t cookie;
+    /* Index of the histogram being recorded into. */
+    int64_t active;
+    /* Only the epochs are used, the reader_mutex is left NULL. */
+    struct hdr_writer_reader_phaser phaser;
+    /* Of the two interval histograms, from the start of the segment. */
+    int64_t histogram_offsets[2];
+};
+
+static size_t round_up(size_t size)
+{
+    return (size + HDR_CACHE_LINE_SIZE - 1) & ~(size_t) (HDR_CACHE_LINE_SIZE - 1);
+}
+
+/* ########  ##     ## ######## ######## ######## ########  */
+/* ##     ## ##     ## ##       ##       ##       ##     ## */
+/* ##     ## ##     ## ##       ##       ##       ##     ## */
+/* ########  ##     ## ######   ######   ######   ########  */
+/* ##     ## ##     ## ##       ##       ##       ##   ##   */
+/* ##     ## ##     ## ##       ##       ##       ##    ##  */
+/* ########   #######  ##       ##       ######## ##     ## */
+
+size_t hdr_calculate_buffer_size(const struct hdr_histogram_bucket_config* cfg)
+{
+    return round_up(sizeof(struct buffer_header)) + sizeof(int64_t) * (size_t) cfg->counts_len;
+}
+
+static int init_view(
+    void* buffer, size_t size, struct hdr_histogram_bucket_config* cfg, struct hdr_histogram* view)
+{
+    if (0 != ((uintptr_t) buffer & (sizeof(int64_t) - 1)) || size < hdr_calculate_buffer_size(cfg))
+    {
+        return EINVAL;
+    }
+
+    hdr_init_preallocated(view, cfg);
+    view->counts = (int64_t*) ((char*) buffer + round_up(sizeof(struct buffer_header)));
+    view->allocation = NULL;
+
+    return 0;
+}
+
+int hdr_init_in_buffer(
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    void* buffer,
+    size_t size,
+    struct hdr_histogram* view)
+{
+    struct hdr_histogram_bucket_config cfg;
+    struct buffer_header* header = (struct buffer_header*) buffer;
+
+    int r = hdr_calculate_bucket_config(lowest_discernible_value, highest_trackable_value, significant_figures, &cfg);
+    if (r)
+    {
+        return r;
+    }
+
+    r = init_view(buffer, size, &cfg, view);
+    if (r)
+    {
+        return r;
+    }
+
+    memset(header, 0, round_up(sizeof(struct buffer_header)));
+    memset(view->counts, 0, sizeof(int64_t) * (size_t) cfg.counts_len);
+    header->cookie = BUFFER_COOKIE;
+    header->version = BUFFER_VERSION;
+    header->lowest_discernible_value = cfg.lowest_discernible_value;
+    header->highest_trackable_value = cfg.highest_trackable_value;
+    header->significant_figures = (int32_t) cfg.significant_figures;
+    header->counts_len = cfg.counts_len;
+    header->counts_offset = (int64_t) round_up(sizeof(struct buffer_header));
+
+    return 0;
+}
+
+int hdr_attach_buffer(void* buffer, size_t size, struct hdr_histogram* view)
+{
+    struct hdr_histogram_bucket_config cfg;
+    const struct buffer_header* header = (const struct buffer_header*) buffer;
+    int r;
+
+    if (size < sizeof(struct buffer_header) || BUFFER_COOKIE != header->cookie ||
+        BUFFER_VERSION != header->version)
+    {
+        return EINVAL;
+    }
+
+    r = hdr_calculate_bucket_config(
+        header->lowest_discernible_value,
+        header->highest_trackable_value,
+        header->significant_figures,
+        &cfg);
+    if (r || cfg.counts_len != header->counts_len ||
+        (int64_t) round_up(sizeof(struct buffer_header)) != header->counts_offset)
+    {
+        return EINVAL;
+    }
+
+    r = init_view(buffer, size, &cfg, view);
+    if (r)
+    {
+        return r;
+    }
+
+    hdr_reset_internal_counters(view);
+
+    return 0;
+}
+
+/*  ######  ##     ##    ###    ########  ######## ########  */
+/* ##    ## ##     ##   ## ##   ##     ## ##       ##     ## */
+/* ##       ##     ##  ##   ##  ##     ## ##       ##     ## */
+/*  ######  ######### ##     ## ########  ######   ##     ## */
+/*       ## ##     ## ######### ##   ##   ##       ##     ## */
+/* ##    ## ##     ## ##     ## ##    ##  ##       ##     ## */
+/*  ######  ##     ## ##     ## ##     ## ######## ########  */
+
+#if !defined(_WIN32)
+
+static size_t segment_size(const struct hdr_histogram_bucket_config* cfg)
+{
+    return round_up(sizeof(struct shared_segment)) + 2 * round_up(hdr_calculate_buffer_size(cfg));
+}
+
+static int init_segment(
+    struct shared_segment* segment, size_t size, struct hdr_histogram_bucket_config* cfg, struct hdr_shared_recorder* r)
+{
+    size_t buffer_size = round_up(hdr_calculate_buffer_size(cfg));
+    int i;
+
+    segment->active = 0;
+    segment->phaser.start_epoch = 0;
+    segment->phaser.even_end_epoch = 0;
+    segment->phaser.odd_end_epoch = INT64_MIN;
+    segment->phaser.reader_mutex = NULL;
+
+    for (i = 0; i < 2; i++)
+    {
+        int rc;
+        segment->histogram_offsets[i] = (int64_t) (round_up(sizeof(struct shared_segment)) + (size_t) i * buffer_size);
+        rc = hdr_init_in_buffer(
+            cfg->lowest_discernible_value,
+            cfg->highest_trackable_value,
+            cfg->significant_figures,
+            (char*) segment + segment->histogram_offsets[i],
+            size - (size_t) segment->histogram_offsets[i],
+            &r->histograms[i]);
+        if (rc)
+        {
+            return rc;
+        }
+    }
+
+    /* Published last, other processes wait for it before attaching. */
+    hdr_atomic_store_64(&segment->cookie, SEGMENT_COOKIE);
+
+    return 0;
+}
+
+static int attach_segment(
+    struct shared_segment* segment, size_t size, struct hdr_histogram_bucket_config* cfg, struct hdr_shared_recorder* r)
+{
+    int i;
+
+    for (i = 0; i < OPEN_WAIT_ATTEMPTS && SEGMENT_COOKIE != hdr_atomic_load_64(&segment->cookie); i++)
+    {
+        hdr_usleep(OPEN_WAIT_US);
+    }
+    if (SEGMENT_COOKIE != hdr_atomic_load_64(&segment->cookie))
+    {
+        return EAGAIN;
+    }
+
+    for (i = 0; i < 2; i++)
+    {
+        int64_t offset = segment->histogram_offsets[i];
+        int rc;
+
+        if (offset < 0 || (size_t) offset >= size)
+        {
+            return EINVAL;
+        }
+
+        rc = hdr_attach_buffer((char*) segment + offset, size - (size_t) offset, &r->histograms[i]);
+        if (rc)
+        {
+            return rc;
+        }
+        if (r->histograms[i].counts_len != cfg->counts_len ||
+            r->histograms[i].highest_trackable_value != cfg->highest_trackable_value ||
+            r->histograms[i].lowest_discernible_value != cfg->lowest_discernible_value)
+        {
+            return EINVAL;
+        }
+    }
+
+    return 0;
+}
+
+/* The creator sizes the object straight after creating it, wait for that to happen. */
+static int wait_for_size(int fd, off_t* size)
+{
+    struct stat st;
+    int i;
+
+    for (i = 0; i < OPEN_WAIT_ATTEMPTS; i++)
+    {
+        if (0 != fstat(fd, &st))
+        {
+            return errno;
+        }
+        if (0 != st.st_size)
+        {
+            *size = st.st_size;
+            return 0;
+        }
+        hdr_usleep(OPEN_WAIT_US);
+    }
+
+    return EAGAIN;
+}
+
+int hdr_open_shared(
+    const char* name,
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    struct hdr_shared_recorder* r)
+{
+    struct hdr_histogram_bucket_config cfg;
+    bool created = true;
+    off_t existing_size;
+    size_t size;
+    void* segment;
+    int fd;
+
+    int rc = hdr_calculate_bucket_config(lowest_discernible_value, highest_trackable_value, significant_figures, &cfg);
+    if (rc)
+    {
+        return rc;
+    }
+    size = segment_size(&cfg);
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && EEXIST == errno)
+    {
+        created = false;
+        fd = shm_open(name, O_RDWR, 0600);
+    }
+    if (fd < 0)
+    {
+        return errno;
+    }
+
+    if (created)
+    {
+        rc = 0 == ftruncate(fd, (off_t) size) ? 0 : errno;
+    }
+    else
+    {
+        rc = wait_for_size(fd, &existing_size);
+        if (0 == rc && (size_t) existing_size != size)
+        {
+            rc = EINVAL;
+        }
+    }
+    if (rc)
+    {
+        close(fd);
+        return rc;
+    }
+
+    segment = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    rc = MAP_FAILED == segment ? errno : 0;
+    close(fd);
+    if (rc)
+    {
+        return rc;
+    }
+
+    r->segment = segment;
+    r->size = size;
+    rc = created ?
+        init_segment((struct shared_segment*) segment, size, &cfg, r) :
+        attach_segment((struct shared_segment*) segment, size, &cfg, r);
+    if (rc)
+    {
+        hdr_close_shared(r);
+    }
+
+    return rc;
+}
+
+void hdr_close_shared(struct hdr_shared_recorder* r)
+{
+    if (r->segment)
+    {
+        munmap(r->segment, r->size);
+        r->segment = NULL;
+    }
+}
+
+int hdr_unlink_shared(const char* name)
+{
+    return 0 == shm_unlink(name) ? 0 : errno;
+}
+
+/* ######## #### ##       ########  */
+/* ##        ##  ##       ##        */
+/* ##        ##  ##       ##        */
+/* ######    ##  ##       ######    */
+/* ##        ##  ##       ##        */
+/* ##        ##  ##       ##        */
+/* ##       #### ######## ########  */
+
+static uint64_t checksum_mix(uint64_t hash, uint64_t word)
+{
+    return (hash ^ word) * UINT64_C(0x100000001b3);
+}
+
+/* FNV-1a over 64 bit words of the header fields and the counts. */
+static uint64_t buffer_checksum(const struct buffer_header* header, const int64_t* counts)
+{
+    uint64_t hash = UINT64_C(0xcbf29ce484222325);
+    int32_t i;
+
+    hash = checksum_mix(hash, (uint64_t) (uint32_t) header->cookie << 32 | (uint32_t) header->version);
+    hash = checksum_mix(hash, (uint64_t) header->lowest_discernible_value);
+    hash = checksum_mix(hash, (uint64_t) header->highest_trackable_value);
+    hash = checksum_mix(hash, (uint64_t) (uint32_t) header->significant_figures << 32 | (uint32_t) header->counts_len);
+    hash = checksum_mix(hash, (uint64_t) header->counts_offset);
+    hash = checksum_mix(hash, (uint64_t) header->total_count);
+    hash = checksum_mix(hash, (uint64_t) header->min_value);
+    hash = checksum_mix(hash, (uint64_t) header->max_value);
+
+    for (i = 0; i < header->counts_len; i++)
+    {
+        hash = checksum_mix(hash, (uint64_t) counts[i]);
+    }
+
+    return hash;
+}
+
+static int attach_file(struct hdr_file_histogram* f, const struct hdr_histogram_bucket_config* cfg)
+{
+    struct hdr_histogram* h = &f->histogram;
+    const struct buffer_header* header = (const struct buffer_header*) f->mapping;
+
+    int rc = hdr_attach_buffer(f->mapping, f->size, h);
+    if (rc)
+    {
+        return rc;
+    }
+
+    if (h->lowest_discernible_value != cfg->lowest_discernible_value ||
+        h->highest_trackable_value != cfg->highest_trackable_value ||
+        h->significant_figures != cfg->significant_figures)
+    {
+        return EINVAL;
+    }
+
+    /* A matching file has the exact min and max.  Otherwise, if it was not closed, */
+    /* values were recorded after the last sync: keep the recomputed ones.  A closed */
+    /* file that does not match is corrupt. */
+    if (header->checksum == buffer_checksum(header, h->counts))
+    {
+        h->total_count = header->total_count;
+        h->min_value = header->min_value;
+        h->max_value = header->max_value;
+    }
+    else if (header->dirty)
+    {
+        f->recovered = true;
+    }
+    else
+    {
+        return EINVAL;
+    }
+
+    return 0;
+}
+
+/* The header is at the start of the mapping, so on its first page. */
+static int mark_dirty(struct hdr_file_histogram* f, bool dirty)
+{
+    struct buffer_header* header = (struct buffer_header*) f->mapping;
+
+    header->dirty = dirty ? 1 : 0;
+    return 0 == msync(f->mapping, sizeof(struct buffer_header), MS_SYNC) ? 0 : errno;
+}
+
+int hdr_open_file(
+    const char* path,
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    struct hdr_file_histogram* f)
+{
+    struct hdr_histogram_bucket_config cfg;
+    struct stat st;
+    bool created;
+    size_t size;
+    void* mapping = MAP_FAILED;
+    int fd;
+
+    int rc = hdr_calculate_bucket_config(lowest_discernible_value, highest_trackable_value, significant_figures, &cfg);
+    if (rc)
+    {
+        return rc;
+    }
+    size = hdr_calculate_buffer_size(&cfg);
+
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        return errno;
+    }
+
+    /* Creating and attaching are serialised, so a process opening the file while */
+    /* another creates it waits for the header rather than seeing an empty file. */
+    rc = 0 == flock(fd, LOCK_EX) ? 0 : errno;
+    rc = rc ? rc : (0 == fstat(fd, &st) ? 0 : errno);
+    created = 0 == rc && 0 == st.st_size;
+    if (created)
+    {
+        rc = 0 == ftruncate(fd, (off_t) size) ? 0 : errno;
+    }
+    else if (0 == rc && (size_t) st.st_size != size)
+    {
+        rc = EINVAL;
+    }
+
+    if (0 == rc)
+    {
+        mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        rc = MAP_FAILED == mapping ? errno : 0;
+    }
+
+    if (0 == rc)
+    {
+        /* A creator that died before writing the header left the file zeroed. */
+        created = created || 0 == ((const struct buffer_header*) mapping)->cookie;
+        f->mapping = mapping;
+        f->size = size;
+        f->recovered = false;
+        if (created)
+        {
+            rc = hdr_init_in_buffer(
+                lowest_discernible_value, highest_trackable_value, significant_figures, mapping, size, &f->histogram);
+            rc = rc ? rc : hdr_sync_file(f);
+        }
+        else
+        {
+            rc = attach_file(f, &cfg);
+        }
+
+        if (0 == rc)
+        {
+            rc = mark_dirty(f, true);
+        }
+
+        if (rc)
+        {
+            munmap(mapping, size);
+            f->mapping = NULL;
+        }
+    }
+
+    /* Closing the descriptor releases the lock. */
+    close(fd);
+
+    return rc;
+}
+
+int hdr_sync_file(struct hdr_file_histogram* f)
+{
+    struct buffer_header* header = (struct buffer_header*) f->mapping;
+
+    header->total_count = f->histogram.total_count;
+    header->min_value = f->histogram.min_value;
+    header->max_value = f->histogram.max_value;
+    header->checksum = buffer_checksum(header, f->histogram.counts);
+
+    return 0 == msync(f->mapping, f->size, MS_SYNC) ? 0 : errno;
+}
+
+int hdr_close_file(struct hdr_file_histogram* f)
+{
+    int rc = 0;
+
+    if (f->mapping)
+    {
+        rc = hdr_sync_file(f);
+        rc = rc ? rc : mark_dirty(f, false);
+        munmap(f->mapping, f->size);
+        f->mapping = NULL;
+    }
+
+    return rc;
+}
+
+#else
+
+int hdr_open_shared(
+    const char* name,
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    struct hdr_shared_recorder* r)
+{
+    (void) name;
+    (void) lowest_discernible_value;
+    (void) highest_trackable_value;
+    (void) significant_figures;
+    r->segment = NULL;
+    return ENOSYS;
+}
+
+void hdr_close_shared(struct hdr_shared_recorder* r)
+{
+    (void) r;
+}
+
+int hdr_unlink_shared(const char* name)
+{
+    (void) name;
+    return ENOSYS;
+}
+
+/* The header is at the start of the mapping, so on its first page. */
+static int mark_dirty(struct hdr_file_histogram* f, bool dirty)
+{
+    struct buffer_header* header = (struct buffer_header*) f->mapping;
+
+    header->dirty = dirty ? 1 : 0;
+    return 0 == msync(f->mapping, sizeof(struct buffer_header), MS_SYNC) ? 0 : errno;
+}
+
+int hdr_open_file(
+    const char* path,
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    struct hdr_file_histogram* f)
+{
+    (void) path;
+    (void) lowest_discernible_value;
+    (void) highest_trackable_value;
+    (void) significant_figures;
+    f->mapping = NULL;
+    return ENOSYS;
+}
+
+int hdr_sync_file(struct hdr_file_histogram* f)
+{
+    (void) f;
+    return ENOSYS;
+}
+
+int hdr_close_file(struct hdr_file_histogram* f)
+{
+    (void) f;
+    return 0;
+}
+
+#endif
+
+bool hdr_shared_record_values(struct hdr_shared_recorder* r, int64_t value, int64_t count)
+{
+    struct shared_segment* segment = (struct shared_segment*) r->segment;
+    int64_t val = hdr_phaser_writer_enter(&segment->phaser);
+
+    bool recorded = hdr_record_values_atomic(
+        &r->histograms[hdr_atomic_load_64(&segment->active)], value, count);
+
+    hdr_phaser_writer_exit(&segment->phaser, val);
+
+    return recorded;
+}
+
+bool hdr_shared_record_value(struct hdr_shared_recorder* r, int64_t value)
+{
+    return hdr_shared_record_values(r, value, 1);
+}
+
+struct hdr_writer_reader_phaser* hdr_shared_phaser(struct hdr_shared_recorder* r)
+{
+    return &((struct shared_segment*) r->segment)->phaser;
+}
+
+/* A negative timeout waits for as long as the writers take. */
+static int sample(struct hdr_shared_recorder* r, struct hdr_histogram* into, int64_t timeout_ns, int64_t* dropped)
+{
+    struct shared_segment* segment = (struct shared_segment*) r->segment;
+    int64_t previous = hdr_atomic_load_64(&segment->active);
+    struct hdr_histogram* interval = &r->histograms[previous];
+    int rc;
+
+    hdr_atomic_store_64(&segment->active, 1 - previous);
+    if (timeout_ns < 0)
+    {
+        hdr_phaser_flip_phase(&segment->phaser, 0);
+    }
+    else
+    {
+        /* Writers may still be in the interval histogram, leave it to a later sample. */
+        rc = hdr_phaser_flip_phase_with_timeout(&segment->phaser, 0, timeout_ns);
+        if (rc)
+        {
+            *dropped = 0;
+            return rc;
+        }
+    }
+
+    /* Writers in other processes only updated the shared counts. */
+    hdr_reset_internal_counters(interval);
+    *dropped = hdr_add(into, interval);
+    hdr_reset(interval);
+
+    return 0;
+}
+
+int64_t hdr_shared_sample(struct hdr_shared_recorder* r, struct hdr_histogram* into)
+{
+    int64_t dropped;
+
+    sample(r, into, -1, &dropped);
+
+    return dropped;
+}
+
+int hdr_shared_sample_with_timeout(
+    struct hdr_shared_recorder* r, struct hdr_histogram* into, int64_t timeout_ns, int64_t* dropped)
+{
+    return sample(r, into, timeout_ns, dropped);
+}
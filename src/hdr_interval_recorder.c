@@ -24,13 +24,24 @@ int hdr_interval_recorder_init_all(
     int64_t lowest_discernible_value,
     int64_t highest_trackable_value,
     int significant_figures)
+{
+    return hdr_interval_recorder_init_all_ex(
+        r, lowest_discernible_value, highest_trackable_value, significant_figures, NULL);
+}
+
+int hdr_interval_recorder_init_all_ex(
+    struct hdr_interval_recorder* r,
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    const struct hdr_allocator* allocator)
 {
     int result;
 
     r->active = r->inactive = NULL;
     result = hdr_writer_reader_phaser_init(&r->phaser);
     result = result == 0
-        ? hdr_init(lowest_discernible_value, highest_trackable_value, significant_figures, &r->active)
+        ? hdr_init_ex(lowest_discernible_value, highest_trackable_value, significant_figures, allocator, &r->active)
         : result;
 
     return result;
@@ -58,7 +69,7 @@ struct hdr_histogram* hdr_interval_recorder_sample_and_recycle(
         int64_t lo = r->active->lowest_discernible_value;
         int64_t hi = r->active->highest_trackable_value;
         int significant_figures = r->active->significant_figures;
-        hdr_init(lo, hi, significant_figures, &histogram_to_recycle);
+        hdr_init_ex(lo, hi, significant_figures, r->active->allocator, &histogram_to_recycle);
     }
     else
     {
@@ -225,3 +236,92 @@ int64_t hdr_interval_recorder_record_corrected_values_atomic(
     hdr_interval_recorder_update(r, update_corrected_values_atomic, &params[0]);
     return params[3];
 }
+
+void hdr_interval_recorder_buffer_init(
+    struct hdr_interval_recorder_buffer* b,
+    struct hdr_interval_recorder* r)
+{
+    b->recorder = r;
+    b->length = 0;
+}
+
+struct buffered_values
+{
+    struct hdr_interval_recorder_buffer* buffer;
+    int64_t dropped;
+};
+
+static void update_buffered_values(struct hdr_histogram* data, void* arg)
+{
+    struct hdr_histogram* h = data;
+    struct buffered_values* params = arg;
+    struct hdr_interval_recorder_buffer* b = params->buffer;
+    int32_t i;
+
+    for (i = 0; i < b->length; i++)
+    {
+        if (!hdr_record_values(h, b->values[i], 1))
+        {
+            params->dropped++;
+        }
+    }
+}
+
+static void update_buffered_values_atomic(struct hdr_histogram* data, void* arg)
+{
+    struct hdr_histogram* h = data;
+    struct buffered_values* params = arg;
+    params->dropped = hdr_record_values_atomic_batch(h, params->buffer->values, params->buffer->length);
+}
+
+int64_t hdr_interval_recorder_buffer_flush(struct hdr_interval_recorder_buffer* b)
+{
+    struct buffered_values params;
+    params.buffer = b;
+    params.dropped = 0;
+
+    if (0 == b->length)
+    {
+        return 0;
+    }
+
+    hdr_interval_recorder_update(b->recorder, update_buffered_values, &params);
+    b->length = 0;
+
+    return params.dropped;
+}
+
+int64_t hdr_interval_recorder_buffer_flush_atomic(struct hdr_interval_recorder_buffer* b)
+{
+    struct buffered_values params;
+    params.buffer = b;
+    params.dropped = 0;
+
+    if (0 == b->length)
+    {
+        return 0;
+    }
+
+    hdr_interval_recorder_update(b->recorder, update_buffered_values_atomic, &params);
+    b->length = 0;
+
+    return params.dropped;
+}
+
+bool hdr_interval_recorder_buffer_record_value(
+    struct hdr_interval_recorder_buffer* b,
+    int64_t value
+)
+{
+    b->values[b->length++] = value;
+    return b->length < HDR_INTERVAL_RECORDER_BUFFER_LENGTH || 0 == hdr_interval_recorder_buffer_flush(b);
+}
+
+bool hdr_interval_recorder_buffer_record_value_atomic(
+    struct hdr_interval_recorder_buffer* b,
+    int64_t value
+)
+{
+    b->values[b->length++] = value;
+    return b->length < HDR_INTERVAL_RECORDER_BUFFER_LENGTH || 0 == hdr_interval_recorder_buffer_flush_atomic(b);
+}
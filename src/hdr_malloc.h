@@ -8,7 +8,11 @@
  * This file is used in order to change the HdrHistogram allocator at compile time.
  * Just define the following defines to what you want to use. Also add
  * the include of your alternate allocator if needed (not needed in order
- * to use the default libc allocator). */
+ * to use the default libc allocator).
+ *
+ * hdr_aligned_alloc is optional, with the signature of posix_memalign and its
+ * memory released by hdr_free.  Without it histograms are over-allocated by a
+ * cache line and their header aligned within the allocation. */
 
 #ifndef HDR_MALLOC_H__
 #define HDR_MALLOC_H__
@@ -16,4 +20,7 @@
 #define hdr_calloc calloc
 #define hdr_realloc realloc
 #define hdr_free free
+#if !defined(_WIN32)
+#define hdr_aligned_alloc posix_memalign
+#endif
 #endif
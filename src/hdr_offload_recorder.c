@@ -0,0 +1,255 @@
+/**
+ * hdr_offload_recorder.c
+ * Released to the public domain, as explained at
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+
+#include <hdr/hdr_offload_recorder.h>
+#include "hdr_atomic.h"
+
+#ifndef HDR_MALLOC_INCLUDE
+#define HDR_MALLOC_INCLUDE "hdr_malloc.h"
+#endif
+
+#include HDR_MALLOC_INCLUDE
+
+/* Each cell carries a sequence number, as in Vyukov's bounded queue.  A cell at */
+/* position p is free for the producer claiming p when its sequence is p, and holds */
+/* an entry for the consumer when it is p + 1.  Draining it sets it to p + capacity, */
+/* freeing it for the next lap. */
+struct hdr_offload_cell
+{
+    int64_t sequence;
+    int64_t value;
+    int64_t count;
+};
+
+int hdr_offload_recorder_init(
+    struct hdr_offload_recorder* r,
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    int32_t capacity)
+{
+    return hdr_offload_recorder_init_ex(
+        r, lowest_discernible_value, highest_trackable_value, significant_figures, capacity, NULL);
+}
+
+int hdr_offload_recorder_init_ex(
+    struct hdr_offload_recorder* r,
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    int32_t capacity,
+    const struct hdr_allocator* allocator)
+{
+    int32_t i;
+    int result;
+
+    if (capacity < 2 || 0 != (capacity & (capacity - 1)))
+    {
+        return EINVAL;
+    }
+
+    r->cells = NULL;
+    r->active = r->inactive = NULL;
+
+    result = hdr_init_ex(
+        lowest_discernible_value, highest_trackable_value, significant_figures, allocator, &r->active);
+    if (result)
+    {
+        return result;
+    }
+
+    r->cells = (struct hdr_offload_cell*) hdr_calloc((size_t) capacity, sizeof(struct hdr_offload_cell));
+    if (!r->cells)
+    {
+        hdr_close(r->active);
+        r->active = NULL;
+        return ENOMEM;
+    }
+
+    r->mutex = hdr_mutex_alloc();
+    result = r->mutex ? hdr_mutex_init(r->mutex) : ENOMEM;
+    if (result)
+    {
+        hdr_mutex_free(r->mutex);
+        hdr_free(r->cells);
+        hdr_close(r->active);
+        r->mutex = NULL;
+        r->cells = NULL;
+        r->active = NULL;
+        return result;
+    }
+
+    for (i = 0; i < capacity; i++)
+    {
+        r->cells[i].sequence = i;
+    }
+    r->mask = capacity - 1;
+    r->tail = 0;
+    r->overflow_entries = 0;
+    r->overflow_count = 0;
+    r->head = 0;
+    r->drained_entries = 0;
+    r->out_of_range_count = 0;
+
+    return 0;
+}
+
+void hdr_offload_recorder_destroy(struct hdr_offload_recorder* r)
+{
+    hdr_mutex_destroy(r->mutex);
+    hdr_mutex_free(r->mutex);
+    hdr_free(r->cells);
+    hdr_close(r->active);
+    hdr_close(r->inactive);
+    r->mutex = NULL;
+    r->cells = NULL;
+    r->active = r->inactive = NULL;
+}
+
+/* ########  ########   #######  ########  ##     ##  ######  ######## ########   ######  */
+/* ##     ## ##     ## ##     ## ##     ## ##     ## ##    ## ##       ##     ## ##    ## */
+/* ##     ## ##     ## ##     ## ##     ## ##     ## ##       ##       ##     ## ##       */
+/* ########  ########  ##     ## ##     ## ##     ## ##       ######   ########   ######  */
+/* ##        ##   ##   ##     ## ##     ## ##     ## ##       ##       ##   ##         ## */
+/* ##        ##    ##  ##     ## ##     ## ##     ## ##    ## ##       ##    ##  ##    ## */
+/* ##        ##     ##  #######  ########   #######   ######  ######## ##     ##  ######  */
+
+bool hdr_offload_recorder_record_values(struct hdr_offload_recorder* r, int64_t value, int64_t count)
+{
+    int64_t position = hdr_atomic_load_64(&r->tail);
+
+    for (;;)
+    {
+        struct hdr_offload_cell* cell = &r->cells[position & r->mask];
+        const int64_t difference = hdr_atomic_load_64(&cell->sequence) - position;
+
+        if (0 == difference)
+        {
+            if (hdr_atomic_compare_exchange_64(&r->tail, &position, position + 1))
+            {
+                cell->value = value;
+                cell->count = count;
+                hdr_atomic_store_64(&cell->sequence, position + 1);
+                return true;
+            }
+            /* Lost the race, 'position' now holds the current tail. */
+        }
+        else if (difference < 0)
+        {
+            /* The consumer has yet to drain this cell from the previous lap. */
+            hdr_atomic_add_fetch_64(&r->overflow_entries, 1);
+            hdr_atomic_add_fetch_64(&r->overflow_count, count);
+            return false;
+        }
+        else
+        {
+            position = hdr_atomic_load_64(&r->tail);
+        }
+    }
+}
+
+bool hdr_offload_recorder_record_value(struct hdr_offload_recorder* r, int64_t value)
+{
+    return hdr_offload_recorder_record_values(r, value, 1);
+}
+
+/*  ######   #######  ##    ##  ######  ##     ## ##     ## ######## ########  */
+/* ##    ## ##     ## ###   ## ##    ## ##     ## ###   ### ##       ##     ## */
+/* ##       ##     ## ####  ## ##       ##     ## #### #### ##       ##     ## */
+/* ##       ##     ## ## ## ##  ######  ##     ## ## ### ## ######   ########  */
+/* ##       ##     ## ##  ####       ## ##     ## ##     ## ##       ##   ##   */
+/* ##    ## ##     ## ##   ### ##    ## ##     ## ##     ## ##       ##    ##  */
+/*  ######   #######  ##    ##  ######   #######  ##     ## ######## ##     ## */
+
+static int64_t drain(struct hdr_offload_recorder* r)
+{
+    const int64_t capacity = r->mask + 1;
+    int64_t drained = 0;
+
+    for (;;)
+    {
+        struct hdr_offload_cell* cell = &r->cells[r->head & r->mask];
+
+        if (hdr_atomic_load_64(&cell->sequence) != r->head + 1)
+        {
+            break;
+        }
+
+        if (!hdr_record_values(r->active, cell->value, cell->count))
+        {
+            r->out_of_range_count += cell->count;
+        }
+        hdr_atomic_store_64(&cell->sequence, r->head + capacity);
+        r->head++;
+        drained++;
+    }
+
+    r->drained_entries += drained;
+    return drained;
+}
+
+int64_t hdr_offload_recorder_drain(struct hdr_offload_recorder* r)
+{
+    int64_t drained;
+
+    hdr_mutex_lock(r->mutex);
+    drained = drain(r);
+    hdr_mutex_unlock(r->mutex);
+
+    return drained;
+}
+
+struct hdr_histogram* hdr_offload_recorder_sample_and_recycle(
+    struct hdr_offload_recorder* r,
+    struct hdr_histogram* histogram_to_recycle)
+{
+    struct hdr_histogram* old_active;
+
+    if (NULL == histogram_to_recycle)
+    {
+        int64_t lo = r->active->lowest_discernible_value;
+        int64_t hi = r->active->highest_trackable_value;
+        int significant_figures = r->active->significant_figures;
+
+        /* Without a histogram to swap in, the active one keeps recording. */
+        if (0 != hdr_init_ex(lo, hi, significant_figures, r->active->allocator, &histogram_to_recycle))
+        {
+            return NULL;
+        }
+    }
+    else
+    {
+        hdr_reset(histogram_to_recycle);
+    }
+
+    hdr_mutex_lock(r->mutex);
+    drain(r);
+    old_active = r->active;
+    r->active = histogram_to_recycle;
+    hdr_mutex_unlock(r->mutex);
+
+    return old_active;
+}
+
+struct hdr_histogram* hdr_offload_recorder_sample(struct hdr_offload_recorder* r)
+{
+    r->inactive = hdr_offload_recorder_sample_and_recycle(r, r->inactive);
+    return r->inactive;
+}
+
+void hdr_offload_recorder_get_stats(struct hdr_offload_recorder* r, struct hdr_offload_recorder_stats* stats)
+{
+    hdr_mutex_lock(r->mutex);
+    stats->drained_entries = r->drained_entries;
+    stats->out_of_range_count = r->out_of_range_count;
+    hdr_mutex_unlock(r->mutex);
+
+    stats->overflow_entries = hdr_atomic_load_64(&r->overflow_entries);
+    stats->overflow_count = hdr_atomic_load_64(&r->overflow_count);
+}
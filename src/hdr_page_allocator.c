@@ -0,0 +1,220 @@
+/**
+ * hdr_page_allocator.c
+ * Released to the public domain, as explained at
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include <hdr/hdr_page_allocator.h>
+
+#ifndef HDR_MALLOC_INCLUDE
+#define HDR_MALLOC_INCLUDE "hdr_malloc.h"
+#endif
+
+#include HDR_MALLOC_INCLUDE
+
+/* The length of the mapping is kept in front of the memory handed out, */
+/* one cache line so that the histogram header stays aligned.  A length of 0 */
+/* tags a block taken from hdr_calloc rather than mapped. */
+#define PAGE_BLOCK_PREFIX 64
+
+#if defined(__linux__)
+
+/* Anonymous mappings are demand-zero, a page is only committed when first written. */
+#define PAGES_ARE_ZEROED true
+
+#define HDR_HUGE_PAGE_SIZE ((size_t) 2 * 1024 * 1024)
+
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+
+static size_t round_up(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+static void* map_anonymous(size_t length, int flags)
+{
+    void* addr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+    return MAP_FAILED == addr ? NULL : addr;
+}
+
+/* Transparent huge pages need the mapping to be 2MB aligned, so over map and trim. */
+static void* map_huge_aligned(size_t length)
+{
+    char* addr = (char*) map_anonymous(length + HDR_HUGE_PAGE_SIZE, 0);
+    char* aligned;
+
+    if (!addr)
+    {
+        return NULL;
+    }
+
+    aligned = (char*) round_up((uintptr_t) addr, HDR_HUGE_PAGE_SIZE);
+    if (aligned != addr)
+    {
+        munmap(addr, (size_t) (aligned - addr));
+    }
+    munmap(aligned + length, HDR_HUGE_PAGE_SIZE - (size_t) (aligned - addr));
+
+#if defined(MADV_HUGEPAGE)
+    madvise(aligned, length, MADV_HUGEPAGE);
+#endif
+
+    return aligned;
+}
+
+static void bind_to_node(void* addr, size_t length, int node)
+{
+#if defined(SYS_mbind)
+    unsigned long nodemask[16] = { 0 };
+    const int bits = (int) (sizeof(nodemask[0]) * 8);
+
+    if (node < 0 || node >= (int) (sizeof(nodemask) * 8) - 1)
+    {
+        return;
+    }
+
+    nodemask[node / bits] |= 1UL << (node % bits);
+    (void) syscall(SYS_mbind, addr, length, MPOL_BIND, nodemask, (unsigned long) (sizeof(nodemask) * 8), 0);
+#else
+    (void) addr;
+    (void) length;
+    (void) node;
+#endif
+}
+
+static void* page_allocate(void* context, size_t size)
+{
+    const struct hdr_page_allocator* pages = (const struct hdr_page_allocator*) context;
+    size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    size_t length;
+    char* addr = NULL;
+
+    /* The side allocations (occupancy bitmap, moments) are too small to be worth a */
+    /* mapping of their own, let alone a huge page. */
+    if (PAGE_BLOCK_PREFIX + size < (pages->huge_pages ? HDR_HUGE_PAGE_SIZE : page_size))
+    {
+        addr = (char*) hdr_calloc(1, PAGE_BLOCK_PREFIX + size);
+        if (!addr)
+        {
+            return NULL;
+        }
+        *(size_t*) addr = 0;
+        return addr + PAGE_BLOCK_PREFIX;
+    }
+
+    if (pages->huge_pages)
+    {
+        length = round_up(PAGE_BLOCK_PREFIX + size, HDR_HUGE_PAGE_SIZE);
+#if defined(MAP_HUGETLB)
+        addr = (char*) map_anonymous(length, MAP_HUGETLB);
+#endif
+        if (!addr)
+        {
+            addr = (char*) map_huge_aligned(length);
+        }
+    }
+
+    if (!addr)
+    {
+        length = round_up(PAGE_BLOCK_PREFIX + size, page_size);
+        addr = (char*) map_anonymous(length, 0);
+        if (!addr)
+        {
+            return NULL;
+        }
+    }
+
+    /* Bind before the pages are first touched, so they are faulted in on the node. */
+    if (HDR_NO_NUMA_NODE != pages->numa_node)
+    {
+        bind_to_node(addr, length, pages->numa_node);
+    }
+
+    *(size_t*) addr = length;
+
+    return addr + PAGE_BLOCK_PREFIX;
+}
+
+static void page_release(void* context, void* ptr)
+{
+    char* addr = (char*) ptr - PAGE_BLOCK_PREFIX;
+    const size_t length = *(size_t*) addr;
+    (void) context;
+
+    if (0 == length)
+    {
+        hdr_free(addr);
+    }
+    else
+    {
+        munmap(addr, length);
+    }
+}
+
+#else
+
+#define PAGES_ARE_ZEROED false
+
+static void* page_allocate(void* context, size_t size)
+{
+    char* addr = (char*) hdr_malloc(PAGE_BLOCK_PREFIX + size);
+    (void) context;
+
+    return addr ? addr + PAGE_BLOCK_PREFIX : NULL;
+}
+
+static void page_release(void* context, void* ptr)
+{
+    (void) context;
+    hdr_free((char*) ptr - PAGE_BLOCK_PREFIX);
+}
+
+#endif
+
+void hdr_page_allocator_init(struct hdr_page_allocator* allocator, bool huge_pages, int numa_node)
+{
+    allocator->allocator.allocate = page_allocate;
+    allocator->allocator.release = page_release;
+    allocator->allocator.context = allocator;
+    allocator->allocator.zeroed = PAGES_ARE_ZEROED;
+    allocator->huge_pages = huge_pages;
+    allocator->numa_node = numa_node;
+}
+
+static struct hdr_page_allocator lazy_pages =
+{
+    { page_allocate, page_release, &lazy_pages, PAGES_ARE_ZEROED }, false, HDR_NO_NUMA_NODE
+};
+
+int hdr_init_lazy(
+    int64_t lowest_discernible_value,
+    int64_t highest_trackable_value,
+    int significant_figures,
+    struct hdr_histogram** result)
+{
+    int rc = hdr_init_ex(
+        lowest_discernible_value, highest_trackable_value, significant_figures, &lazy_pages.allocator, result);
+    if (rc)
+    {
+        return rc;
+    }
+
+    rc = hdr_enable_occupancy_bitmap(*result);
+    if (rc)
+    {
+        hdr_close(*result);
+    }
+
+    return rc;
+}
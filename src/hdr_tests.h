@@ -4,16 +4,24 @@
 /* These are functions used in tests and are not intended for normal usage. */
 
 #include <hdr/hdr_histogram.h>
+#include <hdr/hdr_histogram_shared.h>
+#include <hdr/hdr_writer_reader_phaser.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 int32_t counts_index_for(const struct hdr_histogram* h, int64_t value);
+int32_t counts_next_non_zero_index(const struct hdr_histogram* h, int32_t index, int32_t end);
+void update_min_max_atomic(struct hdr_histogram* h, int64_t value);
+void clear_counts_in_allocation(void* allocation, int32_t counts_len);
 int hdr_encode_compressed(struct hdr_histogram* h, uint8_t** compressed_histogram, size_t* compressed_len);
 int hdr_decode_compressed(uint8_t* buffer, size_t length, struct hdr_histogram** histogram);
+int hdr_decode_compressed_ex(
+    uint8_t* buffer, size_t length, const struct hdr_allocator* allocator, struct hdr_histogram** histogram);
 void hdr_base64_decode_block(const char* input, uint8_t* output);
 void hdr_base64_encode_block(const uint8_t* input, char* output);
+struct hdr_writer_reader_phaser* hdr_shared_phaser(struct hdr_shared_recorder* r);
 
 #ifdef __cplusplus
 }
@@ -9,6 +9,7 @@
 #include <errno.h>
 
 #include <hdr/hdr_thread.h>
+#include <hdr/hdr_time.h>
 #include <hdr/hdr_writer_reader_phaser.h>
 #include "hdr_atomic.h"
 
@@ -91,11 +92,21 @@ void hdr_phaser_reader_unlock(struct hdr_writer_reader_phaser* p)
     hdr_mutex_unlock(p->reader_mutex);
 }
 
-void hdr_phaser_flip_phase(
-    struct hdr_writer_reader_phaser* p, int64_t sleep_time_ns)
+static int64_t elapsed_ns(const hdr_timespec* since)
+{
+    hdr_timespec now;
+    hdr_gettime(&now);
+    return ((int64_t) now.tv_sec - (int64_t) since->tv_sec) * 1000000000 +
+        ((int64_t) now.tv_nsec - (int64_t) since->tv_nsec);
+}
+
+/* A negative timeout waits for as long as the writers take. */
+static int flip_phase(
+    struct hdr_writer_reader_phaser* p, int64_t sleep_time_ns, int64_t timeout_ns)
 {
     bool caught_up;
     int64_t start_value_at_flip;
+    hdr_timespec start_time;
     /* TODO: is_held_by_current_thread */
     unsigned int sleep_time_us = sleep_time_ns < 1000000000 ? (unsigned int) (sleep_time_ns / 1000) : 1000000;
 
@@ -119,6 +130,11 @@ void hdr_phaser_flip_phase(
     /* Reset start value, indicating new phase.*/
     start_value_at_flip = _hdr_phaser_reset_epoch(&p->start_epoch, initial_start_value);
 
+    if (timeout_ns >= 0)
+    {
+        hdr_gettime(&start_time);
+    }
+
     do
     {
         int64_t* end_epoch =
@@ -128,6 +144,10 @@ void hdr_phaser_flip_phase(
 
         if (!caught_up)
         {
+            if (timeout_ns >= 0 && elapsed_ns(&start_time) >= timeout_ns)
+            {
+                return ETIMEDOUT;
+            }
             if (sleep_time_us <= 0)
             {
                 hdr_yield();
@@ -139,4 +159,18 @@ void hdr_phaser_flip_phase(
         }
     }
     while (!caught_up);
+
+    return 0;
+}
+
+void hdr_phaser_flip_phase(
+    struct hdr_writer_reader_phaser* p, int64_t sleep_time_ns)
+{
+    flip_phase(p, sleep_time_ns, -1);
+}
+
+int hdr_phaser_flip_phase_with_timeout(
+    struct hdr_writer_reader_phaser* p, int64_t sleep_time_ns, int64_t timeout_ns)
+{
+    return flip_phase(p, sleep_time_ns, timeout_ns);
 }
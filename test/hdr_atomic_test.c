@@ -70,12 +70,49 @@ static char* test_add(void)
     return 0;
 }
 
+static char* test_or(void)
+{
+    int64_t val1 = 0x0F0F;
+    int64_t val2 = 0x30F0;
+    int64_t expected = 0x3FFF;
+
+    int64_t result = hdr_atomic_or_fetch_64(&val1, val2);
+    mu_assert("Failed hdr_atomic_or_fetch_64", compare_int64(result, expected));
+    mu_assert("Failed hdr_atomic_or_fetch_64", compare_int64(val1, expected));
+
+    return 0;
+}
+
+static char* test_compare_exchange_small(void)
+{
+    int32_t val32 = 7;
+    int32_t expected32 = 7;
+    uint8_t val8 = 200;
+    uint8_t expected8 = 200;
+
+    mu_assert("Failed hdr_atomic_compare_exchange_32", hdr_atomic_compare_exchange_32(&val32, &expected32, 9));
+    mu_assert("Failed hdr_atomic_compare_exchange_32", compare_int64(val32, 9));
+    expected32 = 7;
+    mu_assert("Failed hdr_atomic_compare_exchange_32", !hdr_atomic_compare_exchange_32(&val32, &expected32, 11));
+    mu_assert("Failed hdr_atomic_compare_exchange_32", compare_int64(val32, 9));
+
+    mu_assert("Failed hdr_atomic_compare_exchange_8", hdr_atomic_compare_exchange_8(&val8, &expected8, 255));
+    mu_assert("Failed hdr_atomic_compare_exchange_8", compare_int64(val8, 255));
+    expected8 = 200;
+    mu_assert("Failed hdr_atomic_compare_exchange_8", !hdr_atomic_compare_exchange_8(&val8, &expected8, 1));
+    mu_assert("Failed hdr_atomic_compare_exchange_8", compare_int64(val8, 255));
+
+    return 0;
+}
+
 static struct mu_result all_tests(void)
 {
     mu_run_test(test_store_load_64);
     mu_run_test(test_store_load_pointer);
     mu_run_test(test_exchange);
     mu_run_test(test_add);
+    mu_run_test(test_or);
+    mu_run_test(test_compare_exchange_small);
 
     mu_ok;
 }
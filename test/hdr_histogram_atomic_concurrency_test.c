@@ -11,6 +11,10 @@
 
 #include <stdio.h>
 #include <hdr/hdr_histogram.h>
+#include <hdr/hdr_histogram_compact.h>
+#include <hdr/hdr_interval_recorder.h>
+#include <hdr/hdr_offload_recorder.h>
+#include <hdr/hdr_thread.h>
 #include <pthread.h>
 
 #include "minunit.h"
@@ -85,9 +89,255 @@ static char* test_recording_concurrently(void)
     return compare_histograms(expected_histogram, actual_histogram);
 }
 
+struct test_compact_data
+{
+    struct hdr_compact_histogram* histogram;
+    int64_t* values;
+    int values_len;
+};
+
+static void* record_compact_values(void* thread_context)
+{
+    int i;
+    struct test_compact_data* thread_data = (struct test_compact_data*) thread_context;
+
+    for (i = 0; i < thread_data->values_len; i++)
+    {
+        hdr_compact_record_value_atomic(thread_data->histogram, thread_data->values[i]);
+    }
+
+    pthread_exit(NULL);
+}
+
+static char* test_compact_recording_concurrently(void)
+{
+    const int value_count = 4000000;
+    int64_t* values = calloc(value_count, sizeof(int64_t));
+    struct hdr_histogram* expected_histogram;
+    struct hdr_histogram* actual_histogram;
+    struct hdr_histogram* added_histogram;
+    struct hdr_compact_histogram* compact;
+    struct test_compact_data thread_data[2];
+    pthread_t threads[2];
+    char* result;
+    int i;
+
+    mu_assert("init", 0 == hdr_init(1, 10000000, 2, &expected_histogram));
+    mu_assert("init", 0 == hdr_init(1, 10000000, 2, &actual_histogram));
+    mu_assert("init", 0 == hdr_compact_init(1, 10000000, 2, &compact));
+    mu_assert("reserve", 0 == hdr_compact_reserve_overflow(compact, compact->shape.counts_len));
+
+    /* Few enough distinct values that most slots overflow 8 bits. */
+    for (i = 0; i < value_count; i++)
+    {
+        values[i] = rand() % 20000;
+        hdr_record_value(expected_histogram, values[i]);
+    }
+
+    for (i = 0; i < 2; i++)
+    {
+        thread_data[i].histogram = compact;
+        thread_data[i].values = &values[i * (value_count / 2)];
+        thread_data[i].values_len = value_count / 2;
+        pthread_create(&threads[i], NULL, record_compact_values, &thread_data[i]);
+    }
+
+    pthread_join(threads[0], NULL);
+    pthread_join(threads[1], NULL);
+
+    /* Adding reduces min and max to their bucket, as hdr_add does. */
+    mu_assert("add", 0 == hdr_compact_add(actual_histogram, compact));
+    mu_assert("init", 0 == hdr_init(1, 10000000, 2, &added_histogram));
+    hdr_add(added_histogram, expected_histogram);
+    result = compare_histograms(added_histogram, actual_histogram);
+
+    hdr_compact_close(compact);
+    hdr_close(added_histogram);
+    hdr_close(actual_histogram);
+    hdr_close(expected_histogram);
+    free(values);
+
+    return result;
+}
+
+struct test_buffered_data
+{
+    struct hdr_interval_recorder* recorder;
+    int64_t* values;
+    int values_len;
+};
+
+static void* record_buffered_values(void* thread_context)
+{
+    int i;
+    struct test_buffered_data* thread_data = (struct test_buffered_data*) thread_context;
+    struct hdr_interval_recorder_buffer buffer;
+
+    hdr_interval_recorder_buffer_init(&buffer, thread_data->recorder);
+    for (i = 0; i < thread_data->values_len; i++)
+    {
+        hdr_interval_recorder_buffer_record_value_atomic(&buffer, thread_data->values[i]);
+    }
+    hdr_interval_recorder_buffer_flush_atomic(&buffer);
+
+    pthread_exit(NULL);
+}
+
+static char* test_buffered_recording_concurrently(void)
+{
+    const int value_count = 4000000;
+    int64_t* values = calloc(value_count, sizeof(int64_t));
+    struct hdr_histogram* expected_histogram;
+    struct hdr_histogram* actual_histogram;
+    struct hdr_histogram* added_histogram;
+    struct hdr_interval_recorder recorder;
+    struct test_buffered_data thread_data[2];
+    pthread_t threads[2];
+    char* result;
+    int i;
+
+    mu_assert("init", 0 == hdr_init(1, 10000000, 2, &expected_histogram));
+    mu_assert("init", 0 == hdr_init(1, 10000000, 2, &actual_histogram));
+    mu_assert("init", 0 == hdr_interval_recorder_init_all(&recorder, 1, 10000000, 2));
+
+    for (i = 0; i < value_count; i++)
+    {
+        values[i] = rand() % 20000;
+        hdr_record_value(expected_histogram, values[i]);
+    }
+
+    for (i = 0; i < 2; i++)
+    {
+        thread_data[i].recorder = &recorder;
+        thread_data[i].values = &values[i * (value_count / 2)];
+        thread_data[i].values_len = value_count / 2;
+        pthread_create(&threads[i], NULL, record_buffered_values, &thread_data[i]);
+    }
+
+    /* Sampling while the writers drain must neither lose nor double count values. */
+    for (i = 0; i < 100; i++)
+    {
+        hdr_add(actual_histogram, hdr_interval_recorder_sample(&recorder));
+    }
+
+    pthread_join(threads[0], NULL);
+    pthread_join(threads[1], NULL);
+    hdr_add(actual_histogram, hdr_interval_recorder_sample(&recorder));
+
+    /* The samples were added, which reduces min and max to their bucket. */
+    mu_assert("init", 0 == hdr_init(1, 10000000, 2, &added_histogram));
+    hdr_add(added_histogram, expected_histogram);
+    result = compare_histograms(added_histogram, actual_histogram);
+
+    hdr_interval_recorder_destroy(&recorder);
+    hdr_close(added_histogram);
+    hdr_close(actual_histogram);
+    hdr_close(expected_histogram);
+    free(values);
+
+    return result;
+}
+
+struct test_offload_data
+{
+    struct hdr_offload_recorder* recorder;
+    int64_t* values;
+    int values_len;
+};
+
+static void* record_offload_values(void* thread_context)
+{
+    int i;
+    struct test_offload_data* thread_data = (struct test_offload_data*) thread_context;
+
+    for (i = 0; i < thread_data->values_len; i++)
+    {
+        /* Retry on overflow, so every value reaches the histogram. */
+        while (!hdr_offload_recorder_record_value(thread_data->recorder, thread_data->values[i]))
+        {
+            hdr_yield();
+        }
+    }
+
+    pthread_exit(NULL);
+}
+
+static char* test_offload_recording_concurrently(void)
+{
+    const int value_count = 2000000;
+    int64_t* values = calloc(value_count, sizeof(int64_t));
+    struct hdr_histogram* expected_histogram;
+    struct hdr_histogram* actual_histogram;
+    struct hdr_histogram* added_histogram;
+    struct hdr_offload_recorder recorder;
+    struct hdr_offload_recorder_stats stats;
+    struct test_offload_data thread_data[2];
+    pthread_t threads[2];
+    int64_t drained = 0;
+    char* result;
+    int i;
+
+    mu_assert("init", 0 == hdr_init(1, 10000000, 2, &expected_histogram));
+    mu_assert("init", 0 == hdr_init(1, 10000000, 2, &actual_histogram));
+    mu_assert("init", 0 == hdr_offload_recorder_init(&recorder, 1, 10000000, 2, 1024));
+
+    for (i = 0; i < value_count; i++)
+    {
+        values[i] = rand() % 20000;
+        hdr_record_value(expected_histogram, values[i]);
+    }
+
+    for (i = 0; i < 2; i++)
+    {
+        thread_data[i].recorder = &recorder;
+        thread_data[i].values = &values[i * (value_count / 2)];
+        thread_data[i].values_len = value_count / 2;
+        pthread_create(&threads[i], NULL, record_offload_values, &thread_data[i]);
+    }
+
+    /* This thread consumes, sampling now and then as a reporting thread would.  A */
+    /* sample drains the ring too, so count the entries drained from the stats. */
+    for (i = 0; drained < value_count; i++)
+    {
+        if (0 == hdr_offload_recorder_drain(&recorder))
+        {
+            hdr_yield();
+        }
+        if (0 == i % 1000)
+        {
+            hdr_add(actual_histogram, hdr_offload_recorder_sample(&recorder));
+        }
+        hdr_offload_recorder_get_stats(&recorder, &stats);
+        drained = stats.drained_entries;
+    }
+
+    pthread_join(threads[0], NULL);
+    pthread_join(threads[1], NULL);
+    hdr_add(actual_histogram, hdr_offload_recorder_sample(&recorder));
+
+    hdr_offload_recorder_get_stats(&recorder, &stats);
+    mu_assert("drained", compare_int64(value_count, stats.drained_entries));
+
+    /* The samples were added, which reduces min and max to their bucket. */
+    mu_assert("init", 0 == hdr_init(1, 10000000, 2, &added_histogram));
+    hdr_add(added_histogram, expected_histogram);
+    result = compare_histograms(added_histogram, actual_histogram);
+
+    hdr_offload_recorder_destroy(&recorder);
+    hdr_close(added_histogram);
+    hdr_close(actual_histogram);
+    hdr_close(expected_histogram);
+    free(values);
+
+    return result;
+}
+
 static struct mu_result all_tests(void)
 {
     mu_run_test(test_recording_concurrently);
+    mu_run_test(test_compact_recording_concurrently);
+    mu_run_test(test_buffered_recording_concurrently);
+    mu_run_test(test_offload_recording_concurrently);
 
     mu_ok;
 }
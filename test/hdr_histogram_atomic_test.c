@@ -45,28 +45,28 @@ static void load_histograms(void)
     int i;
     if (raw_histogram)
     {
-        free(raw_histogram);
+        hdr_close(raw_histogram);
     }
 
     hdr_init(1, highest_trackable_value, significant_figures, &raw_histogram);
 
     if (cor_histogram)
     {
-        free(cor_histogram);
+        hdr_close(cor_histogram);
     }
 
     hdr_init(1, highest_trackable_value, significant_figures, &cor_histogram);
 
     if (scaled_raw_histogram)
     {
-        free(scaled_raw_histogram);
+        hdr_close(scaled_raw_histogram);
     }
 
     hdr_init(1000, highest_trackable_value * 512, significant_figures, &scaled_raw_histogram);
 
     if (scaled_cor_histogram)
     {
-        free(scaled_cor_histogram);
+        hdr_close(scaled_cor_histogram);
     }
 
     hdr_init(1000, highest_trackable_value * 512, significant_figures, &scaled_cor_histogram);
@@ -96,7 +96,7 @@ static char* test_create(void)
     mu_assert("Failed to allocate hdr_histogram", h != NULL);
     mu_assert("Incorrect array length", compare_int64(h->counts_len, 23552));
 
-    free(h);
+    hdr_close(h);
 
     return 0;
 }
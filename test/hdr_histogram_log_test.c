@@ -163,8 +163,8 @@ static void load_histograms(void)
 {
     int i;
 
-    free(raw_histogram);
-    free(cor_histogram);
+    hdr_close(raw_histogram);
+    hdr_close(cor_histogram);
 
     hdr_alloc(INT64_C(3600) * 1000 * 1000, 3, &raw_histogram);
     hdr_alloc(INT64_C(3600) * 1000 * 1000, 3, &cor_histogram);
@@ -223,7 +223,7 @@ static char* test_encode_and_decode_compressed(void)
         "Comparison did not match",
         compare_histogram(expected, actual));
 
-    free(actual);
+    hdr_close(actual);
 
     return 0;
 }
@@ -252,7 +252,182 @@ static char* test_encode_and_decode_compressed2(void)
             "Comparison did not match",
             compare_histogram(expected, actual));
 
-    free(actual);
+    hdr_close(actual);
+
+    return 0;
+}
+
+static char* test_encode_with_occupancy_bitmap(void)
+{
+    uint8_t* expected_buffer = NULL;
+    uint8_t* actual_buffer = NULL;
+    size_t expected_len = 0;
+    size_t actual_len = 0;
+    struct hdr_histogram* actual = NULL;
+
+    load_histograms();
+
+    mu_assert("Did not clone", validate_return_code(hdr_clone(cor_histogram, &actual)));
+    mu_assert("Did not enable bitmap", validate_return_code(hdr_enable_occupancy_bitmap(actual)));
+
+    mu_assert("Did not encode", validate_return_code(
+        hdr_encode_compressed(cor_histogram, &expected_buffer, &expected_len)));
+    mu_assert("Did not encode", validate_return_code(
+        hdr_encode_compressed(actual, &actual_buffer, &actual_len)));
+
+    mu_assert("Lengths should match", expected_len == actual_len);
+    mu_assert("Encoding should match", 0 == memcmp(expected_buffer, actual_buffer, expected_len));
+
+    free(expected_buffer);
+    free(actual_buffer);
+    hdr_close(actual);
+
+    return 0;
+}
+
+static char* test_encode_shifted(void)
+{
+    uint8_t* buffer = NULL;
+    size_t len = 0;
+    struct hdr_histogram* shifted = NULL;
+    struct hdr_histogram* expected = NULL;
+    struct hdr_histogram* actual = NULL;
+    int64_t v;
+
+    hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &shifted);
+    hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &expected);
+    for (v = 3000; v < 1000000; v += 777)
+    {
+        hdr_record_value(shifted, v);
+        hdr_record_value(expected, v << 4);
+    }
+    mu_assert("Did not shift", 0 == hdr_shift_values_left(shifted, 4));
+
+    mu_assert("Did not encode", validate_return_code(hdr_encode_compressed(shifted, &buffer, &len)));
+    mu_assert("Did not decode", validate_return_code(hdr_decode_compressed(buffer, len, &actual)));
+    mu_assert("Comparison did not match", compare_histogram(expected, actual));
+
+    free(buffer);
+    hdr_close(actual);
+    hdr_close(expected);
+    hdr_close(shifted);
+
+    return 0;
+}
+
+static char* test_encode_tiered(void)
+{
+    const struct hdr_precision_tier tiers[] = { { 0, 1 }, { 100000, 3 } };
+    uint8_t* buffer = NULL;
+    size_t len = 0;
+    struct hdr_histogram* tiered = NULL;
+    struct hdr_histogram* actual = NULL;
+    struct hdr_iter iter;
+    int64_t v;
+
+    hdr_init_tiered(1, INT64_C(3600) * 1000 * 1000, tiers, 2, &tiered);
+    for (v = 3; v < 100000000; v += v / 5 + 1)
+    {
+        hdr_record_value(tiered, v);
+    }
+
+    mu_assert("Did not encode", validate_return_code(hdr_encode_compressed(tiered, &buffer, &len)));
+    mu_assert("Did not decode", validate_return_code(hdr_decode_compressed(buffer, len, &actual)));
+    mu_assert("Should decode the finest tier", compare_int64(3, actual->significant_figures));
+    mu_assert("Total", compare_int64(tiered->total_count, actual->total_count));
+
+    /* Each tier slot decodes to a count at its lowest value. */
+    hdr_iter_recorded_init(&iter, tiered);
+    while (hdr_iter_next(&iter))
+    {
+        mu_assert("Count", compare_int64(iter.count, hdr_count_at_value(actual, iter.value)));
+    }
+
+    free(buffer);
+    hdr_close(actual);
+    hdr_close(tiered);
+
+    return 0;
+}
+
+struct counting_allocator
+{
+    int64_t allocated;
+    int64_t live;
+};
+
+static void* counting_allocate(void* context, size_t size)
+{
+    struct counting_allocator* a = (struct counting_allocator*) context;
+    a->allocated++;
+    a->live++;
+    return malloc(size);
+}
+
+static void counting_release(void* context, void* ptr)
+{
+    struct counting_allocator* a = (struct counting_allocator*) context;
+    a->live--;
+    free(ptr);
+}
+
+static char* log_reader_uses_supplied_allocator(void)
+{
+    const char* file_name = "histogram.log";
+    hdr_timespec timestamp;
+    hdr_timespec interval;
+    struct hdr_log_writer writer;
+    struct hdr_log_reader reader;
+    struct hdr_log_entry entry;
+    struct counting_allocator counts = { 0, 0 };
+    struct hdr_allocator allocator;
+    struct hdr_histogram* histogram = NULL;
+    FILE* log_file;
+    int rc;
+
+    allocator.allocate = counting_allocate;
+    allocator.release = counting_release;
+    allocator.context = &counts;
+    allocator.zeroed = false;
+
+    load_histograms();
+
+    hdr_gettime(&timestamp);
+    interval.tv_sec = 5;
+    interval.tv_nsec = 2000000;
+
+    hdr_log_writer_init(&writer);
+    hdr_log_reader_init(&reader);
+
+    log_file = fopen(file_name, "w+");
+    hdr_log_write_header(&writer, log_file, "Test log", &timestamp);
+    hdr_log_write(&writer, log_file, &timestamp, &interval, raw_histogram);
+    hdr_log_write(&writer, log_file, &timestamp, &interval, cor_histogram);
+    fclose(log_file);
+
+    log_file = fopen(file_name, "r");
+    rc = hdr_log_read_header(&reader, log_file);
+    mu_assert("Failed header read", validate_return_code(rc));
+
+    memset(&entry, 0, sizeof(entry));
+    rc = hdr_log_read_entry_ex(&reader, log_file, &entry, &allocator, &histogram);
+    mu_assert("Failed raw read", validate_return_code(rc));
+    mu_assert("Should use allocator", histogram->allocator == &allocator);
+    mu_assert("Should allocate the histogram", compare_int64(1, counts.live));
+
+    rc = hdr_log_read_entry_ex(&reader, log_file, &entry, &allocator, &histogram);
+    mu_assert("Failed corrected read", validate_return_code(rc));
+    mu_assert("Should release merged histogram", compare_int64(1, counts.live));
+    mu_assert(
+        "Total counts incorrect",
+        compare_int64(raw_histogram->total_count + cor_histogram->total_count, histogram->total_count));
+
+    fclose(log_file);
+    remove(file_name);
+
+    hdr_close(histogram);
+    mu_assert("Should allocate through allocator", compare_int64(2, counts.allocated));
+    mu_assert("Should release everything", compare_int64(0, counts.live));
 
     return 0;
 }
@@ -316,7 +491,7 @@ static char* test_encode_and_decode_empty(void)
     size_t encoded_len;
     size_t decoded_len;
 
-    free(raw_histogram);
+    hdr_close(raw_histogram);
 
     mu_assert("allocation should be valid", 0 == hdr_init(1, 1000000, 1, &raw_histogram));
 
@@ -366,8 +541,8 @@ static char* test_encode_and_decode_compressed_large(void)
         "Comparison did not match",
         compare_histogram(expected, actual));
 
-    free(expected);
-    free(actual);
+    hdr_close(expected);
+    hdr_close(actual);
 
     return 0;
 }
@@ -645,7 +820,7 @@ static char* log_reader_aggregates_into_single_histogram(void)
 
     fclose(log_file);
     remove(file_name);
-    free(histogram);
+    hdr_close(histogram);
 
     return 0;
 }
@@ -689,8 +864,8 @@ static char* test_encode_decode_empty(void)
     mu_assert("Failed to encode histogram data", hdr_log_encode(histogram, &data) == 0);
     mu_assert("Failed to decode histogram data", hdr_log_decode(&hdr_new, data, strlen(data)) == 0);
     mu_assert("Histograms should be the same", compare_histogram(histogram, hdr_new));
-    free(histogram);
-    free(hdr_new);
+    hdr_close(histogram);
+    hdr_close(hdr_new);
     free(data);
     return 0;
 }
@@ -773,7 +948,7 @@ static char* decode_v1_log(void)
         dropped = hdr_add(accum, h);
         mu_assert("Dropped events", compare_int64(dropped, 0));
 
-        free(h);
+        hdr_close(h);
         h = NULL;
     }
 
@@ -820,7 +995,7 @@ static char* decode_v2_log(void)
         dropped = hdr_add(accum, h);
         mu_assert("Dropped events", compare_int64(dropped, 0));
 
-        free(h);
+        hdr_close(h);
         h = NULL;
     }
 
@@ -870,7 +1045,7 @@ static char* decode_v3_log(void)
         dropped = hdr_add(accum, h);
         mu_assert("Dropped events", compare_int64(dropped, 0));
 
-        free(h);
+        hdr_close(h);
         h = NULL;
     }
 
@@ -945,7 +1120,7 @@ static char* decode_v0_log(void)
         dropped = hdr_add(accum, h);
         mu_assert("Dropped events", compare_int64(dropped, 0));
 
-        free(h);
+        hdr_close(h);
         h = NULL;
     }
 
@@ -990,6 +1165,9 @@ static struct mu_result all_tests(void)
     mu_run_test(test_encode_and_decode_compressed_large);
     mu_run_test(test_encode_and_decode_base64);
     mu_run_test(test_bounds_check_on_decode);
+    mu_run_test(test_encode_with_occupancy_bitmap);
+    mu_run_test(test_encode_shifted);
+    mu_run_test(test_encode_tiered);
 
     mu_run_test(base64_decode_block_decodes_4_chars);
     mu_run_test(base64_decode_fails_with_invalid_lengths);
@@ -1004,6 +1182,7 @@ static struct mu_result all_tests(void)
     mu_run_test(writes_and_reads_log);
     mu_run_test(log_reader_aggregates_into_single_histogram);
     mu_run_test(log_reader_fails_with_incorrect_version);
+    mu_run_test(log_reader_uses_supplied_allocator);
 
     mu_run_test(test_string_encode_decode);
     mu_run_test(test_string_encode_decode_2);
@@ -1018,8 +1197,8 @@ static struct mu_result all_tests(void)
     mu_run_test(test_encode_and_decode_empty);
 
 
-    free(raw_histogram);
-    free(cor_histogram);
+    hdr_close(raw_histogram);
+    hdr_close(cor_histogram);
 
     mu_ok;
 }
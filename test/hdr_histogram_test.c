@@ -10,11 +10,28 @@
 #include <errno.h>
 
 #include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#endif
 #include <hdr/hdr_histogram.h>
 #include <hdr/hdr_interval_recorder.h>
+#include <hdr/hdr_offload_recorder.h>
+#include <hdr/hdr_histogram_compact.h>
+#include <hdr/hdr_histogram_corrected.h>
+#include <hdr/hdr_histogram_hybrid.h>
+#include <hdr/hdr_histogram_pool.h>
+#include <hdr/hdr_histogram_sampler.h>
+#include <hdr/hdr_histogram_shared.h>
+#include <hdr/hdr_page_allocator.h>
 
 #include "minunit.h"
 #include "hdr_test_util.h"
+#include "hdr_tests.h"
 
 static bool compare_values(double a, double b, double variation)
 {
@@ -45,28 +62,28 @@ static void load_histograms(void)
     int i;
     if (raw_histogram)
     {
-        free(raw_histogram);
+        hdr_close(raw_histogram);
     }
 
     hdr_init(1, highest_trackable_value, significant_figures, &raw_histogram);
 
     if (cor_histogram)
     {
-        free(cor_histogram);
+        hdr_close(cor_histogram);
     }
 
     hdr_init(1, highest_trackable_value, significant_figures, &cor_histogram);
 
     if (scaled_raw_histogram)
     {
-        free(scaled_raw_histogram);
+        hdr_close(scaled_raw_histogram);
     }
 
     hdr_init(1000, highest_trackable_value * 512, significant_figures, &scaled_raw_histogram);
 
     if (scaled_cor_histogram)
     {
-        free(scaled_cor_histogram);
+        hdr_close(scaled_cor_histogram);
     }
 
     hdr_init(1000, highest_trackable_value * 512, significant_figures, &scaled_cor_histogram);
@@ -96,7 +113,7 @@ static char* test_create(void)
     mu_assert("Failed to allocate hdr_histogram", h != NULL);
     mu_assert("Incorrect array length", compare_int64(h->counts_len, 23552));
 
-    free(h);
+    hdr_close(h);
 
     return 0;
 }
@@ -536,6 +553,140 @@ static char* test_interval_recording(void)
     return 0;
 }
 
+static char* test_atomic_batch(void)
+{
+    struct hdr_histogram* expected;
+    struct hdr_histogram* actual;
+    int64_t values[1000];
+    int i;
+
+    hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &expected);
+    hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &actual);
+    hdr_enable_moments(expected);
+    hdr_enable_moments(actual);
+
+    /* More distinct slots than a chunk holds, with many repeats. */
+    for (i = 0; i < 1000; i++)
+    {
+        values[i] = (i % 3) ? 1000 + i % 7 : i * 997;
+    }
+    values[10] = 0;
+    values[11] = -1;
+    values[20] = INT64_C(3600) * 1000 * 1000 * 2;
+    for (i = 0; i < 1000; i++)
+    {
+        hdr_record_value(expected, values[i]);
+    }
+
+    mu_assert("Should drop", compare_int64(2, hdr_record_values_atomic_batch(actual, values, 1000)));
+    mu_assert("Empty batch", 0 == hdr_record_values_atomic_batch(actual, values, 0));
+    mu_assert("Total count", compare_int64(expected->total_count, actual->total_count));
+    mu_assert("Min", compare_int64(expected->min_value, actual->min_value));
+    mu_assert("Max", compare_int64(expected->max_value, actual->max_value));
+    mu_assert("Mean", compare_double(hdr_mean(expected), hdr_mean(actual), 0.000001));
+    mu_assert("Stddev", compare_double(hdr_stddev(expected), hdr_stddev(actual), 0.000001));
+    for (i = 0; i < 1000; i += 3)
+    {
+        mu_assert("Count", compare_int64(hdr_count_at_value(expected, i * 997), hdr_count_at_value(actual, i * 997)));
+    }
+    mu_assert("Count", compare_int64(hdr_count_at_value(expected, 1003), hdr_count_at_value(actual, 1003)));
+
+    hdr_close(actual);
+    hdr_close(expected);
+
+    return 0;
+}
+
+static char* test_buffered_interval_recording(void)
+{
+    struct hdr_interval_recorder recorder;
+    struct hdr_interval_recorder_buffer buffer;
+    struct hdr_histogram* expected_histogram;
+    struct hdr_histogram* recorder_histogram;
+    int i;
+
+    hdr_interval_recorder_init_all(&recorder, 1, INT64_C(24) * 60 * 60 * 1000000, 3);
+    hdr_init(1, INT64_C(24) * 60 * 60 * 1000000, 3, &expected_histogram);
+    hdr_interval_recorder_buffer_init(&buffer, &recorder);
+
+    for (i = 0; i < 1000; i++)
+    {
+        int64_t value = rand() % 20000;
+        hdr_record_value(expected_histogram, value);
+        mu_assert("Should record", hdr_interval_recorder_buffer_record_value(&buffer, value));
+    }
+
+    /* Whole buffers have been drained, the rest waits for a flush. */
+    recorder_histogram = hdr_interval_recorder_sample_and_recycle(&recorder, NULL);
+    mu_assert(
+        "Drained count",
+        compare_int64((1000 / HDR_INTERVAL_RECORDER_BUFFER_LENGTH) * HDR_INTERVAL_RECORDER_BUFFER_LENGTH,
+        recorder_histogram->total_count));
+    mu_assert("Nothing pending", 0 == hdr_interval_recorder_sample(&recorder)->total_count);
+
+    mu_assert("Should flush", 0 == hdr_interval_recorder_buffer_flush(&buffer));
+    hdr_add(recorder_histogram, hdr_interval_recorder_sample(&recorder));
+    mu_assert("Empty after flush", 0 == hdr_interval_recorder_buffer_flush(&buffer));
+    mu_assert("Total count", compare_int64(expected_histogram->total_count, recorder_histogram->total_count));
+    mu_assert(
+        "p99",
+        compare_int64(hdr_value_at_percentile(expected_histogram, 99.0), hdr_value_at_percentile(recorder_histogram, 99.0)));
+
+    hdr_interval_recorder_buffer_record_value_atomic(&buffer, 100);
+    hdr_interval_recorder_buffer_record_value_atomic(&buffer, -1);
+    hdr_interval_recorder_buffer_record_value_atomic(&buffer, INT64_C(24) * 60 * 60 * 1000000 * 2);
+    mu_assert("Should drop", 2 == hdr_interval_recorder_buffer_flush_atomic(&buffer));
+
+    hdr_close(recorder_histogram);
+    hdr_close(expected_histogram);
+    hdr_interval_recorder_destroy(&recorder);
+
+    return 0;
+}
+
+static char* test_offload_recording(void)
+{
+    struct hdr_offload_recorder recorder;
+    struct hdr_offload_recorder_stats stats;
+    struct hdr_histogram* sample;
+    int i;
+
+    mu_assert("Should reject capacity", EINVAL == hdr_offload_recorder_init(&recorder, 1, 1000000, 3, 6));
+    mu_assert("Should init", 0 == hdr_offload_recorder_init(&recorder, 1, 1000000, 3, 8));
+
+    /* The ring holds 8 entries, the rest are dropped until it is drained. */
+    for (i = 0; i < 10; i++)
+    {
+        mu_assert("Should enqueue", (i < 8) == hdr_offload_recorder_record_values(&recorder, 100 + i, 2));
+    }
+    mu_assert("Nothing recorded yet", 0 == recorder.active->total_count);
+    mu_assert("Should drain", 8 == hdr_offload_recorder_drain(&recorder));
+    mu_assert("Recorded", compare_int64(16, recorder.active->total_count));
+
+    hdr_offload_recorder_record_value(&recorder, 5000000);
+    for (i = 0; i < 20; i++)
+    {
+        mu_assert("Should enqueue after drain", hdr_offload_recorder_record_value(&recorder, 1000));
+        hdr_offload_recorder_drain(&recorder);
+    }
+
+    sample = hdr_offload_recorder_sample_and_recycle(&recorder, NULL);
+    mu_assert("Sampled", compare_int64(36, sample->total_count));
+    mu_assert("Max", hdr_values_are_equivalent(sample, 1000, hdr_max(sample)));
+    mu_assert("Next interval empty", 0 == hdr_offload_recorder_sample(&recorder)->total_count);
+
+    hdr_offload_recorder_get_stats(&recorder, &stats);
+    mu_assert("Drained", compare_int64(29, stats.drained_entries));
+    mu_assert("Overflow entries", compare_int64(2, stats.overflow_entries));
+    mu_assert("Overflow count", compare_int64(4, stats.overflow_count));
+    mu_assert("Out of range", compare_int64(1, stats.out_of_range_count));
+
+    hdr_close(sample);
+    hdr_offload_recorder_destroy(&recorder);
+
+    return 0;
+}
+
 static char* reset_histogram_on_sample_and_recycle(void)
 {
     struct hdr_interval_recorder recorder;
@@ -561,6 +712,1650 @@ static char* reset_histogram_on_sample_and_recycle(void)
     return 0;
 }
 
+static char* test_copy_into(void)
+{
+    struct hdr_histogram* same;
+    struct hdr_histogram* coarse;
+    char* result;
+
+    load_histograms();
+    cor_histogram->conversion_ratio = 0.5;
+
+    hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &same);
+    hdr_record_value(same, 42);
+
+    mu_assert("Should not drop values", compare_int64(0, hdr_copy_into(same, cor_histogram)));
+    result = compare_histograms(cor_histogram, same);
+    if (result)
+    {
+        return result;
+    }
+    mu_assert("Conversion ratio should be copied", compare_double(0.5, same->conversion_ratio, 0.0001));
+
+    hdr_init(1, INT64_C(3600) * 1000 * 1000, 2, &coarse);
+    hdr_record_value(coarse, 42);
+
+    mu_assert("Should not drop values", compare_int64(0, hdr_copy_into(coarse, cor_histogram)));
+    mu_assert("Total count", compare_int64(cor_histogram->total_count, coarse->total_count));
+    mu_assert("Should not keep previous values", compare_int64(0, hdr_count_at_value(coarse, 42)));
+    mu_assert(
+        "99th percentile should be equivalent",
+        hdr_values_are_equivalent(
+            coarse, hdr_value_at_percentile(cor_histogram, 99.0), hdr_value_at_percentile(coarse, 99.0)));
+    mu_assert("Conversion ratio should be copied", compare_double(0.5, coarse->conversion_ratio, 0.0001));
+
+    hdr_close(same);
+    hdr_close(coarse);
+
+    return 0;
+}
+
+static char* test_clone(void)
+{
+    struct hdr_histogram* clone = NULL;
+    char* result;
+
+    load_histograms();
+
+    mu_assert("Should clone", 0 == hdr_clone(cor_histogram, &clone));
+    mu_assert("Counts should not be shared", clone->counts != cor_histogram->counts);
+
+    result = compare_histograms(cor_histogram, clone);
+    if (result)
+    {
+        return result;
+    }
+
+    hdr_record_value(clone, 1000);
+    mu_assert("Source should be unchanged", compare_int64(20000, cor_histogram->total_count));
+
+    hdr_close(clone);
+
+    return 0;
+}
+
+static char* test_recorded_values_from_value(void)
+{
+    struct hdr_iter iter;
+    int index = 0;
+
+    load_histograms();
+
+    hdr_iter_recorded_init_at_value(&iter, raw_histogram, 1001);
+    while (hdr_iter_next(&iter))
+    {
+        mu_assert("Should only see the outlier",
+                  hdr_values_are_equivalent(raw_histogram, 100000000, iter.value));
+        mu_assert("Count should be 1", compare_int64(1, iter.count));
+        mu_assert("Cumulative count should include values below",
+                  compare_int64(10001, iter.cumulative_count));
+        index++;
+    }
+    mu_assert("Should have encountered 1 value", index == 1);
+
+    hdr_iter_recorded_init_at_value(&iter, raw_histogram, 100000001);
+    mu_assert("Should be nothing above the max", !hdr_iter_next(&iter));
+
+    return 0;
+}
+
+static char* test_recorded_values_from_percentile(void)
+{
+    struct hdr_iter iter;
+    int64_t total_count = 0;
+    int64_t expected_first;
+
+    load_histograms();
+
+    expected_first = hdr_value_at_percentile(cor_histogram, 99.0);
+
+    hdr_iter_recorded_init_at_percentile(&iter, cor_histogram, 99.0);
+    mu_assert("Should have values", hdr_iter_next(&iter));
+    mu_assert("Should start at the 99th percentile",
+              hdr_values_are_equivalent(cor_histogram, expected_first, iter.value));
+    mu_assert("Should reach the percentile",
+              iter.cumulative_count >= (int64_t) (0.99 * cor_histogram->total_count));
+    mu_assert("Should not start past the percentile",
+              iter.cumulative_count - iter.count < (int64_t) (0.99 * cor_histogram->total_count));
+
+    do
+    {
+        total_count = iter.cumulative_count;
+    }
+    while (hdr_iter_next(&iter));
+
+    mu_assert("Should finish at the total count", compare_int64(cor_histogram->total_count, total_count));
+
+    return 0;
+}
+
+static char* test_reverse_values(void)
+{
+    struct hdr_iter forward;
+    struct hdr_iter reverse;
+    int64_t values[128];
+    int count = 0;
+
+    load_histograms();
+    hdr_record_value(raw_histogram, 0);
+    hdr_record_value(raw_histogram, 2047);
+    hdr_record_value(raw_histogram, 2048);
+    hdr_record_values(raw_histogram, 123456, 3);
+
+    hdr_iter_recorded_init(&forward, raw_histogram);
+    while (hdr_iter_next(&forward) && count < 128)
+    {
+        values[count++] = forward.value;
+    }
+    mu_assert("Should have fitted all values", count < 128);
+
+    hdr_iter_reverse_init(&reverse, raw_histogram);
+    while (hdr_iter_next(&reverse))
+    {
+        count--;
+        mu_assert("Should not see more values than forward", count >= 0);
+        mu_assert("Values should be reversed", compare_int64(values[count], reverse.value));
+        mu_assert("Highest equivalent", compare_int64(
+            hdr_next_non_equivalent_value(raw_histogram, reverse.value) - 1, reverse.highest_equivalent_value));
+    }
+
+    mu_assert("Should have visited all values", count == 0);
+    mu_assert("Should have visited all counts", compare_int64(raw_histogram->total_count, reverse.cumulative_count));
+
+    return 0;
+}
+
+static char* test_add(void)
+{
+    struct hdr_histogram* same;
+    struct hdr_histogram* wider;
+    char* result;
+
+    load_histograms();
+
+    hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &same);
+    hdr_init(1, INT64_C(3600) * 1000 * 1000 * 1000, 3, &wider);
+
+    mu_assert("Should not drop values", compare_int64(0, hdr_add(same, cor_histogram)));
+    mu_assert("Should not drop values", compare_int64(0, hdr_add(wider, cor_histogram)));
+
+    result = compare_histograms(same, wider);
+    if (result)
+    {
+        return result;
+    }
+
+    mu_assert("Should not drop values", compare_int64(0, hdr_add(same, raw_histogram)));
+    mu_assert("Total count", compare_int64(30001, same->total_count));
+    mu_assert("Mean", compare_values(
+        hdr_mean(same), (hdr_mean(cor_histogram) * 20000 + hdr_mean(raw_histogram) * 10001) / 30001, 0.000001));
+
+    hdr_close(same);
+    hdr_close(wider);
+
+    /* A value below the lowest discernible value shares slot 0 with 0, the fast path */
+    /* must give the min that recording each bucket gives. */
+    hdr_init(1000, INT64_C(3600) * 1000 * 1000, 3, &same);
+    hdr_init(1000, INT64_C(3600) * 1000 * 1000, 3, &wider);
+    hdr_record_value(wider, 500);
+    hdr_record_value(wider, 20000);
+    hdr_record_value(wider, 90000000);
+    mu_assert("Should not drop values", compare_int64(0, hdr_add(same, wider)));
+    mu_assert("Min", hdr_values_are_equivalent(same, 20000, same->min_value));
+    mu_assert("Max", hdr_values_are_equivalent(same, 90000000, same->max_value));
+
+    hdr_reset(wider);
+    hdr_record_value(wider, 500);
+    hdr_add(same, wider);
+    mu_assert("Min of slot 0 only", hdr_values_are_equivalent(same, 20000, same->min_value));
+
+    hdr_close(same);
+    hdr_close(wider);
+
+    return 0;
+}
+
+static char* test_occupancy_bitmap(void)
+{
+    struct hdr_histogram* h;
+    struct hdr_histogram* sum;
+    struct hdr_iter expected_iter;
+    struct hdr_iter actual_iter;
+    char* result;
+    int i;
+
+    load_histograms();
+
+    hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &h);
+    mu_assert("Should enable bitmap", 0 == hdr_enable_occupancy_bitmap(h));
+
+    for (i = 0; i < 10000; i++)
+    {
+        hdr_record_corrected_value(h, 1000, 10000);
+    }
+    hdr_record_corrected_value(h, 100000000, 10000);
+
+    result = compare_histograms(cor_histogram, h);
+    if (result)
+    {
+        return result;
+    }
+
+    hdr_iter_recorded_init(&expected_iter, cor_histogram);
+    hdr_iter_recorded_init(&actual_iter, h);
+    while (hdr_iter_next(&expected_iter))
+    {
+        mu_assert("Should have next", hdr_iter_next(&actual_iter));
+        mu_assert("Value mismatch", compare_int64(expected_iter.value, actual_iter.value));
+        mu_assert("Count mismatch", compare_int64(expected_iter.count, actual_iter.count));
+    }
+    mu_assert("Should not have next", !hdr_iter_next(&actual_iter));
+
+    mu_assert("Value at 99% should match", compare_int64(
+        hdr_value_at_percentile(cor_histogram, 99.0), hdr_value_at_percentile(h, 99.0)));
+
+    hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &sum);
+    hdr_enable_occupancy_bitmap(sum);
+    hdr_add(sum, h);
+    hdr_add(sum, raw_histogram);
+    mu_assert("Total count", compare_int64(30001, sum->total_count));
+    mu_assert("Count at 1000", compare_int64(20000, hdr_count_at_value(sum, 1000)));
+
+    hdr_reset(h);
+    mu_assert("Should be empty", compare_int64(0, hdr_count_at_value(h, 1000)));
+    mu_assert("Should be empty", compare_int64(0, hdr_count_at_value(h, 100000000)));
+    hdr_iter_recorded_init(&actual_iter, h);
+    mu_assert("Should not have next", !hdr_iter_next(&actual_iter));
+
+    hdr_close(h);
+    hdr_close(sum);
+
+    return 0;
+}
+
+static char* test_export_and_import_recorded(void)
+{
+    int64_t values[16];
+    int64_t counts[16];
+    int64_t highest[16];
+    int64_t median[16];
+    size_t length = 0;
+    size_t i = 0;
+    struct hdr_iter iter;
+    struct hdr_histogram* h;
+
+    load_histograms();
+    hdr_record_value(raw_histogram, 0);
+    hdr_record_values(raw_histogram, 2049, 7);
+
+    mu_assert("Should report required length", ERANGE == hdr_export_recorded(raw_histogram, NULL, NULL, 0, &length));
+    mu_assert("Length", length == 4);
+
+    mu_assert("Should export", 0 == hdr_export_recorded_equivalents(
+        raw_histogram, values, counts, NULL, highest, median, 16, &length));
+    mu_assert("Length", length == 4);
+
+    hdr_iter_recorded_init(&iter, raw_histogram);
+    while (hdr_iter_next(&iter))
+    {
+        mu_assert("Value", compare_int64(iter.value, values[i]));
+        mu_assert("Count", compare_int64(iter.count, counts[i]));
+        mu_assert("Highest", compare_int64(iter.highest_equivalent_value, highest[i]));
+        mu_assert("Median", compare_int64(iter.median_equivalent_value, median[i]));
+        i++;
+    }
+    mu_assert("Should export every recorded value", i == length);
+
+    hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &h);
+    mu_assert("Should not drop", compare_int64(0, hdr_import_counts(h, values, counts, length)));
+
+    hdr_iter_recorded_init(&iter, raw_histogram);
+    while (hdr_iter_next(&iter))
+    {
+        mu_assert("Imported count", compare_int64(iter.count, hdr_count_at_value(h, iter.value)));
+    }
+    mu_assert("Total count", compare_int64(raw_histogram->total_count, h->total_count));
+    mu_assert("Min", compare_int64(hdr_min(raw_histogram), hdr_min(h)));
+    mu_assert("Max", compare_int64(hdr_max(raw_histogram), hdr_max(h)));
+
+    values[0] = INT64_C(3600) * 1000 * 1000 * 1000;
+    counts[0] = 3;
+    mu_assert("Should drop out of range values", compare_int64(3, hdr_import_counts(h, values, counts, 1)));
+
+    hdr_close(h);
+
+    return 0;
+}
+
+static bool counts_are_zero(const struct hdr_histogram* h)
+{
+    int32_t i;
+    for (i = 0; i < h->counts_len; i++)
+    {
+        if (0 != h->counts[i])
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static char* test_reset_only_touched_range(void)
+{
+    struct hdr_histogram* h;
+    struct hdr_histogram* interval;
+
+    hdr_init(1, INT64_C(24) * 60 * 60 * 1000000, 4, &h);
+
+    hdr_record_value(h, 0);
+    hdr_record_value(h, 1);
+    hdr_record_value(h, 123456);
+    hdr_record_value(h, INT64_C(24) * 60 * 60 * 1000000);
+    hdr_reset(h);
+    mu_assert("Counts should be zero", counts_are_zero(h));
+    mu_assert("Total count", compare_int64(0, h->total_count));
+
+    hdr_record_value(h, 0);
+    hdr_reset(h);
+    mu_assert("Counts should be zero", counts_are_zero(h));
+
+    h->counts[42] = 3;
+    h->counts[h->counts_len - 1] = 5;
+    hdr_reset_internal_counters(h);
+    hdr_reset(h);
+    mu_assert("Counts should be zero", counts_are_zero(h));
+
+    hdr_record_values(h, 1000, 10);
+    hdr_record_values(h, INT64_C(3600) * 1000000, 10);
+    hdr_reset_release_pages(h);
+    mu_assert("Counts should be zero", counts_are_zero(h));
+    mu_assert("Min", compare_int64(INT64_MAX, h->min_value));
+    mu_assert("Max", compare_int64(0, h->max_value));
+
+    hdr_record_value(h, 1000);
+    mu_assert("Should record after release", compare_int64(1, hdr_count_at_value(h, 1000)));
+
+    hdr_close(h);
+
+    /* Add an interval into a total, then reset, with values below the unit. */
+    hdr_init(1000, INT64_C(3600) * 1000 * 1000, 3, &h);
+    hdr_init(1000, INT64_C(3600) * 1000 * 1000, 3, &interval);
+    hdr_record_value(interval, 500);
+    hdr_record_value(interval, 20000);
+    hdr_record_value(interval, 90000000);
+    hdr_add(h, interval);
+    hdr_reset(h);
+    mu_assert("Counts should be zero", counts_are_zero(h));
+    hdr_add(h, interval);
+    mu_assert("Count at 20000", compare_int64(1, hdr_count_at_value(h, 20000)));
+    mu_assert("Total count", compare_int64(3, h->total_count));
+    hdr_reset(h);
+    hdr_reset(interval);
+    mu_assert("Counts should be zero", counts_are_zero(h));
+    mu_assert("Counts should be zero", counts_are_zero(interval));
+
+    hdr_close(interval);
+    hdr_close(h);
+
+    return 0;
+}
+
+struct bump_arena
+{
+    char buffer[1 << 20];
+    size_t used;
+    int allocations;
+};
+
+static void* bump_allocate(void* context, size_t size)
+{
+    struct bump_arena* arena = (struct bump_arena*) context;
+    void* ptr;
+
+    size = (size + 15) & ~(size_t) 15;
+    if (arena->used + size > sizeof(arena->buffer))
+    {
+        return NULL;
+    }
+
+    ptr = &arena->buffer[arena->used];
+    arena->used += size;
+    arena->allocations++;
+
+    return ptr;
+}
+
+static char* test_init_with_allocator(void)
+{
+    const struct hdr_precision_tier tiers[] = { { 0, 1 }, { 1000000, 3 } };
+    static struct bump_arena arena;
+    struct hdr_allocator allocator;
+    struct hdr_histogram* h;
+    struct hdr_histogram* copy;
+    struct hdr_interval_recorder recorder;
+    struct hdr_offload_recorder offload;
+    struct hdr_histogram* sample;
+    struct hdr_histogram* active;
+
+    memset(arena.buffer, 0xAB, sizeof(arena.buffer));
+    arena.used = 0;
+    arena.allocations = 0;
+    allocator.allocate = bump_allocate;
+    allocator.release = NULL;
+    allocator.context = &arena;
+    allocator.zeroed = false;
+
+    mu_assert("Should init", 0 == hdr_init_ex(1, INT64_C(3600) * 1000 * 1000, 3, &allocator, &h));
+    mu_assert("Should allocate once", compare_int64(1, arena.allocations));
+    mu_assert("Counts should be zeroed", counts_are_zero(h));
+
+    hdr_record_values(h, 1000, 10);
+    hdr_record_value(h, 100000);
+    mu_assert("Should enable bitmap", 0 == hdr_enable_occupancy_bitmap(h));
+    mu_assert("Should clone", 0 == hdr_clone(h, &copy));
+    mu_assert("Should allocate from arena", compare_int64(4, arena.allocations));
+    mu_assert("Clone should keep allocator", copy->allocator == &allocator);
+    mu_assert("Clone should match", compare_int64(10, hdr_count_at_value(copy, 1000)));
+
+    hdr_close(copy);
+    hdr_close(h);
+
+    arena.used = 0;
+    arena.allocations = 0;
+    mu_assert("Should init tiered", 0 == hdr_init_tiered_ex(1, INT64_C(3600) * 1000 * 1000, tiers, 2, &allocator, &h));
+    mu_assert("Tiered should allocate from arena", compare_int64(1, arena.allocations));
+    mu_assert("Tiered should keep allocator", h->allocator == &allocator);
+    mu_assert("Tiered counts should be zeroed", counts_are_zero(h));
+    hdr_close(h);
+
+    mu_assert(
+        "Too large for arena",
+        ENOMEM == hdr_init_ex(1, INT64_C(24) * 60 * 60 * 1000000, 5, &allocator, &h));
+
+    arena.used = 0;
+    arena.allocations = 0;
+    hdr_interval_recorder_init_all_ex(&recorder, 1, INT64_C(3600) * 1000 * 1000, 3, &allocator);
+    hdr_interval_recorder_record_value(&recorder, 1000);
+    sample = hdr_interval_recorder_sample(&recorder);
+    mu_assert("Sample should have the value", compare_int64(1, hdr_count_at_value(sample, 1000)));
+    mu_assert("Recorder should allocate from arena", compare_int64(2, arena.allocations));
+    hdr_interval_recorder_destroy(&recorder);
+
+    arena.used = 0;
+    arena.allocations = 0;
+    mu_assert(
+        "Should init offload recorder",
+        0 == hdr_offload_recorder_init_ex(&offload, 1, INT64_C(3600) * 1000 * 1000, 3, 8, &allocator));
+    hdr_offload_recorder_record_value(&offload, 1000);
+    sample = hdr_offload_recorder_sample_and_recycle(&offload, NULL);
+    mu_assert("Offload sample should have the value", compare_int64(1, hdr_count_at_value(sample, 1000)));
+    mu_assert("Offload recorder should allocate from arena", compare_int64(2, arena.allocations));
+    hdr_offload_recorder_record_value(&offload, 2000);
+    hdr_offload_recorder_drain(&offload);
+
+    /* With the arena exhausted the active histogram is kept. */
+    arena.used = sizeof(arena.buffer);
+    active = offload.active;
+    hdr_offload_recorder_record_value(&offload, 3000);
+    mu_assert("Should fail to sample", NULL == hdr_offload_recorder_sample_and_recycle(&offload, NULL));
+    mu_assert("Should keep active", offload.active == active);
+    hdr_offload_recorder_record_value(&offload, 4000);
+    hdr_offload_recorder_drain(&offload);
+    mu_assert("Active should keep recording", compare_int64(3, offload.active->total_count));
+    mu_assert("Should recycle", active == hdr_offload_recorder_sample_and_recycle(&offload, sample));
+    mu_assert("Recycled should be active", offload.active == sample);
+    hdr_close(active);
+    hdr_offload_recorder_destroy(&offload);
+
+    return 0;
+}
+
+static char* test_single_allocation_layout(void)
+{
+    struct hdr_histogram* h;
+    struct hdr_histogram* copy;
+
+    hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &h);
+    mu_assert("Header should be cache line aligned", 0 == ((uintptr_t) h & 63));
+    mu_assert("Counts should follow header", h->counts == (int64_t*) (h + 1));
+    mu_assert(
+        "Hot fields should share a cache line",
+        offsetof(struct hdr_histogram, max_value) + sizeof(int64_t) <= 64);
+
+    hdr_record_value(h, 1000);
+    hdr_clone(h, &copy);
+    mu_assert("Clone should be cache line aligned", 0 == ((uintptr_t) copy & 63));
+    mu_assert("Clone counts should follow header", copy->counts == (int64_t*) (copy + 1));
+    mu_assert("Clone should match", compare_int64(1, hdr_count_at_value(copy, 1000)));
+
+    hdr_close(copy);
+    hdr_close(h);
+
+#if !defined(_WIN32)
+    /* The header starts the allocation, so callers freeing it directly still work. */
+    hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &h);
+    mu_assert("Header should start the allocation", h->allocation == (void*) h);
+    hdr_record_value(h, 1000);
+    free(h);
+#endif
+
+    return 0;
+}
+
+static int64_t resident_pages(void)
+{
+#if defined(__linux__)
+    long size = 0;
+    long resident = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+
+    if (statm)
+    {
+        if (2 != fscanf(statm, "%ld %ld", &size, &resident))
+        {
+            resident = 0;
+        }
+        fclose(statm);
+    }
+
+    return resident;
+#else
+    return 0;
+#endif
+}
+
+static char* test_page_allocator(void)
+{
+    struct hdr_page_allocator pages;
+    struct hdr_histogram* h;
+    struct hdr_histogram* small[16];
+    int64_t resident;
+    size_t memory_size;
+    int huge;
+    int i;
+
+    for (huge = 0; huge < 2; huge++)
+    {
+        hdr_page_allocator_init(&pages, huge, huge ? 0 : HDR_NO_NUMA_NODE);
+
+        mu_assert("Should init", 0 == hdr_init_ex(1, INT64_C(3600) * 1000000000, 4, &pages.allocator, &h));
+        mu_assert("Header should be cache line aligned", 0 == ((uintptr_t) h & 63));
+        mu_assert("Counts should be zeroed", counts_are_zero(h));
+
+        hdr_record_values(h, 1000, 99);
+        hdr_record_value(h, INT64_C(3600) * 1000000000);
+        mu_assert("p50", hdr_values_are_equivalent(h, 1000, hdr_value_at_percentile(h, 50.0)));
+        mu_assert("max", hdr_values_are_equivalent(h, INT64_C(3600) * 1000000000, hdr_max(h)));
+
+        hdr_close(h);
+    }
+
+    /* Moments are not given a (huge) page of their own.  The value recorded shares */
+    /* its page with the header, so that enabling moments reads no untouched counts, */
+    /* and the first histogram and reading the resident size fault in their code */
+    /* before measuring. */
+    hdr_page_allocator_init(&pages, true, HDR_NO_NUMA_NODE);
+    for (i = 0; i < 16; i++)
+    {
+        mu_assert("Should init", 0 == hdr_init_ex(1, INT64_C(3600) * 1000000000, 3, &pages.allocator, &small[i]));
+        hdr_record_value(small[i], 100);
+    }
+    memory_size = hdr_get_memory_size(small[0]);
+    mu_assert("Should enable moments", 0 == hdr_enable_moments(small[0]));
+    mu_assert("Should only grow by the moments", hdr_get_memory_size(small[0]) - memory_size < 64);
+    resident_pages();
+    resident = resident_pages();
+    for (i = 1; i < 16; i++)
+    {
+        mu_assert("Should enable moments", 0 == hdr_enable_moments(small[i]));
+    }
+    mu_assert("Should not map pages for moments", resident_pages() - resident < 8);
+    mu_assert("Mean", compare_double(100.0, hdr_mean(small[0]), 1.0));
+    for (i = 0; i < 16; i++)
+    {
+        hdr_close(small[i]);
+    }
+
+    return 0;
+}
+
+static int64_t resident_counts_pages(const struct hdr_histogram* h)
+{
+#if defined(__linux__)
+    size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t) h->counts & ~(uintptr_t) (page_size - 1);
+    size_t length = (uintptr_t) &h->counts[h->counts_len] - start;
+    size_t pages = (length + page_size - 1) / page_size;
+    unsigned char* vec = (unsigned char*) calloc(pages, 1);
+    int64_t resident = 0;
+    size_t i;
+
+    if (0 == mincore((void*) start, length, vec))
+    {
+        for (i = 0; i < pages; i++)
+        {
+            resident += vec[i] & 1;
+        }
+    }
+    free(vec);
+
+    return resident;
+#else
+    (void) h;
+    return 0;
+#endif
+}
+
+static char* test_lazy_counts(void)
+{
+    struct hdr_histogram* h;
+    struct hdr_histogram* dense;
+    struct hdr_iter iter;
+    const int64_t day = INT64_C(24) * 60 * 60 * 1000000000;
+    int64_t values = 0;
+
+    mu_assert("Should init", 0 == hdr_init_lazy(1, day, 3, &h));
+    mu_assert("Should track occupancy", NULL != h->occupancy);
+
+    hdr_record_values(h, 1000, 10);
+    hdr_record_values(h, 2000000, 5);
+    hdr_record_value(h, day);
+    mu_assert(
+        "Should only commit touched pages",
+        resident_counts_pages(h) <= 4);
+
+    mu_assert("p50", hdr_values_are_equivalent(h, 1000, hdr_value_at_percentile(h, 50.0)));
+    mu_assert("p90", hdr_values_are_equivalent(h, 2000000, hdr_value_at_percentile(h, 90.0)));
+    mu_assert("max", hdr_values_are_equivalent(h, day, hdr_max(h)));
+
+    hdr_iter_recorded_init(&iter, h);
+    while (hdr_iter_next(&iter))
+    {
+        values++;
+    }
+    mu_assert("Should iterate recorded values", compare_int64(3, values));
+
+    hdr_init(1, day, 3, &dense);
+    mu_assert("Should add", compare_int64(0, hdr_add(dense, h)));
+    mu_assert("Should match", compare_int64(5, hdr_count_at_value(dense, 2000000)));
+    mu_assert("Should add back", compare_int64(0, hdr_add(h, dense)));
+    mu_assert("Should double", compare_int64(32, h->total_count));
+    mu_assert("Adding should not commit untouched pages", resident_counts_pages(h) <= 4);
+
+    hdr_reset(h);
+    mu_assert("Counts should be zero", counts_are_zero(h));
+
+    hdr_close(dense);
+    hdr_close(h);
+
+    return 0;
+}
+
+static char* test_compact_histogram(void)
+{
+    struct hdr_compact_histogram* c;
+    struct hdr_histogram* expected;
+    struct hdr_histogram* actual;
+    struct hdr_compact_iter compact_iter;
+    struct hdr_iter iter;
+    const int64_t highest = INT64_C(3600) * 1000 * 1000;
+    const double percentiles[] = { 0.0, 1.0, 50.0, 90.0, 99.99, 100.0 };
+    int64_t v;
+    int i;
+
+    mu_assert("Should init", 0 == hdr_compact_init(1, highest, 3, &c));
+    hdr_init(1, highest, 3, &expected);
+    hdr_init(1, highest, 3, &actual);
+
+    mu_assert(
+        "Should be much smaller",
+        hdr_compact_get_memory_size(c) * 4 < hdr_get_memory_size(expected));
+
+    /* Enough distinct overflowing slots to force the overflow table to grow. */
+    for (v = 1; v <= 5000; v++)
+    {
+        mu_assert("Should record", hdr_compact_record_values(c, v * 37, 300));
+        hdr_record_values(expected, v * 37, 300);
+    }
+    for (v = 0; v < 255; v++)
+    {
+        mu_assert("Should record", hdr_compact_record_value(c, 12345));
+        hdr_record_value(expected, 12345);
+    }
+    mu_assert("Should record", hdr_compact_record_value(c, 12345));
+    hdr_record_value(expected, 12345);
+    mu_assert("Should record", hdr_compact_record_values(c, highest, INT64_C(1) << 40));
+    hdr_record_values(expected, highest, INT64_C(1) << 40);
+
+    mu_assert("Should reject out of range", !hdr_compact_record_value(c, highest * 2));
+    mu_assert("Should reject negative counts", !hdr_compact_record_values(c, 10, -1));
+
+    mu_assert("Count with overflow", compare_int64(256, hdr_compact_count_at_value(c, 12345)));
+    mu_assert(
+        "Count with overflow",
+        compare_int64(hdr_count_at_value(expected, 37 * 4000), hdr_compact_count_at_value(c, 37 * 4000)));
+    mu_assert("Should record", hdr_compact_record_values(c, 1000000, 512));
+    hdr_record_values(expected, 1000000, 512);
+    mu_assert("Large count", compare_int64(INT64_C(1) << 40, hdr_compact_count_at_value(c, highest)));
+    mu_assert("Multiple of 256", compare_int64(512, hdr_compact_count_at_value(c, 1000000)));
+    mu_assert("Total count", compare_int64(expected->total_count, c->shape.total_count));
+
+    mu_assert("Should not drop", compare_int64(0, hdr_compact_add(actual, c)));
+    mu_assert("Total count", compare_int64(expected->total_count, actual->total_count));
+    for (v = 1; v <= 5000; v++)
+    {
+        mu_assert(
+            "Counts should match",
+            compare_int64(hdr_count_at_value(expected, v * 37), hdr_count_at_value(actual, v * 37)));
+    }
+    mu_assert(
+        "p50 should match",
+        compare_int64(hdr_value_at_percentile(expected, 50.0), hdr_value_at_percentile(actual, 50.0)));
+
+    /* Queried in place, the compact histogram agrees with the dense copy. */
+    for (i = 0; i < (int) (sizeof(percentiles) / sizeof(percentiles[0])); i++)
+    {
+        mu_assert(
+            "Percentile should match",
+            compare_int64(
+                hdr_value_at_percentile(actual, percentiles[i]),
+                hdr_compact_value_at_percentile(c, percentiles[i])));
+    }
+
+    hdr_iter_recorded_init(&iter, actual);
+    hdr_compact_iter_init(&compact_iter, c);
+    while (hdr_iter_next(&iter))
+    {
+        mu_assert("Should iterate", hdr_compact_iter_next(&compact_iter));
+        mu_assert("Value should match", compare_int64(iter.value, compact_iter.value));
+        mu_assert("Count should match", compare_int64(iter.count, compact_iter.count));
+        mu_assert(
+            "Cumulative count should match",
+            compare_int64(iter.cumulative_count, compact_iter.cumulative_count));
+        mu_assert(
+            "Highest equivalent value should match",
+            compare_int64(iter.highest_equivalent_value, compact_iter.highest_equivalent_value));
+    }
+    mu_assert("Should be exhausted", !hdr_compact_iter_next(&compact_iter));
+
+    hdr_compact_reset(c);
+    mu_assert("Should be empty", compare_int64(0, hdr_compact_count_at_value(c, 12345)));
+    mu_assert("Should be empty", compare_int64(0, c->shape.total_count));
+
+    /* The mean is checked without the huge count, whose sum would not fit. */
+    hdr_reset(actual);
+    for (v = 1; v <= 5000; v++)
+    {
+        hdr_compact_record_values(c, v * 37, 300);
+        hdr_record_values(actual, v * 37, 300);
+    }
+    mu_assert("Mean should match", compare_double(hdr_mean(actual), hdr_compact_mean(c), 0.0001));
+
+    hdr_close(actual);
+    hdr_close(expected);
+    hdr_compact_close(c);
+
+    return 0;
+}
+
+static char* test_hybrid_histogram(void)
+{
+    struct hdr_hybrid_histogram* h;
+    struct hdr_histogram* expected;
+    struct hdr_histogram* merged;
+    const int64_t values[] = { 1234567, 7, 99999, 7, 424242, 0, 31415926 };
+    const double percentiles[] = { 0.0, 10.0, 50.0, 90.0, 99.0, 100.0 };
+    int i;
+
+    mu_assert("Should init", 0 == hdr_hybrid_init(1, INT64_C(3600) * 1000 * 1000, 3, 8, &h));
+    hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &expected);
+    hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &merged);
+
+    mu_assert("Should be small", hdr_hybrid_get_memory_size(h) < 256);
+    for (i = 0; i < (int) (sizeof(values) / sizeof(values[0])); i++)
+    {
+        mu_assert("Should record", hdr_hybrid_record_value(h, values[i]));
+        hdr_record_value(expected, values[i]);
+    }
+    mu_assert("Should reject out of range", !hdr_hybrid_record_value(h, INT64_C(3600) * 1000 * 1000 + 1));
+    mu_assert("Should not promote", NULL == h->histogram);
+
+    /* Exact while buffered: sorted, 0 7 7 99999 424242 1234567 31415926 */
+    mu_assert("Total", compare_int64(7, hdr_hybrid_total_count(h)));
+    mu_assert("Min", compare_int64(0, hdr_hybrid_min(h)));
+    mu_assert("Max", compare_int64(31415926, hdr_hybrid_max(h)));
+    mu_assert("p50", compare_int64(99999, hdr_hybrid_value_at_percentile(h, 50.0)));
+    mu_assert("p90", compare_int64(1234567, hdr_hybrid_value_at_percentile(h, 90.0)));
+    mu_assert("p99", compare_int64(31415926, hdr_hybrid_value_at_percentile(h, 99.0)));
+    mu_assert("Mean", compare_double(33174748.0 / 7, hdr_hybrid_mean(h), 0.001));
+    for (i = 0; i < (int) (sizeof(percentiles) / sizeof(percentiles[0])); i++)
+    {
+        mu_assert(
+            "Percentile within precision",
+            hdr_values_are_equivalent(
+                expected,
+                hdr_value_at_percentile(expected, percentiles[i]),
+                hdr_hybrid_value_at_percentile(h, percentiles[i])));
+    }
+
+    mu_assert("Should not drop", compare_int64(0, hdr_hybrid_add(merged, h)));
+    mu_assert("Merged", compare_int64(2, hdr_count_at_value(merged, 7)));
+
+    /* Overflowing the buffer promotes, keeping what was buffered. */
+    mu_assert("Should record", hdr_hybrid_record_values(h, 500, 2));
+    hdr_record_values(expected, 500, 2);
+    mu_assert("Should promote", NULL != h->histogram);
+    mu_assert("Total", compare_int64(9, hdr_hybrid_total_count(h)));
+    mu_assert("Counts", compare_int64(2, hdr_count_at_value(h->histogram, 7)));
+    mu_assert(
+        "p50", compare_int64(hdr_value_at_percentile(expected, 50.0), hdr_hybrid_value_at_percentile(h, 50.0)));
+    mu_assert("Max", compare_int64(hdr_max(expected), hdr_hybrid_max(h)));
+
+    hdr_hybrid_reset(h);
+    mu_assert("Should stay promoted", NULL != h->histogram);
+    mu_assert("Should be empty", compare_int64(0, hdr_hybrid_total_count(h)));
+
+    hdr_close(merged);
+    hdr_close(expected);
+    hdr_hybrid_close(h);
+
+    return 0;
+}
+
+static char* test_tiered_histogram(void)
+{
+    /* Nanosecond latencies: 1 significant figure below 1ms, 2 to 10ms, 3 to 10s, 2 above. */
+    const struct hdr_precision_tier tiers[] = {
+        { 0, 1 }, { INT64_C(1000000), 2 }, { INT64_C(10000000), 3 }, { INT64_C(10000000000), 2 } };
+    const struct hdr_precision_tier unordered[] = { { INT64_C(1000000), 1 }, { 1000, 3 } };
+    const int64_t highest = INT64_C(3600) * 1000 * 1000 * 1000;
+    const double percentiles[] = { 1.0, 25.0, 50.0, 90.0, 99.0, 99.99, 100.0 };
+    struct hdr_histogram* h;
+    struct hdr_histogram* standard;
+    struct hdr_histogram* copy;
+    struct hdr_iter iter;
+    int64_t v, previous, total = 0;
+    int32_t steps = 0;
+    int i;
+
+    mu_assert("Should reject unordered tiers", EINVAL == hdr_init_tiered(1, highest, unordered, 2, &h));
+    mu_assert("Should reject no tiers", EINVAL == hdr_init_tiered(1, highest, tiers, 0, &h));
+    mu_assert("Should init", 0 == hdr_init_tiered(1, highest, tiers, 4, &h));
+    hdr_init(1, highest, 3, &standard);
+
+    mu_assert("Should be smaller", h->counts_len * 2 < standard->counts_len);
+    mu_assert("Should encode at the finest tier", compare_int64(3, h->significant_figures));
+
+    for (v = 1; v < highest; v += v / 7 + 1)
+    {
+        int64_t precision = v < 1000000 ? 10 : v < 10000000 ? 100 : v < INT64_C(10000000000) ? 1000 : 100;
+        int64_t size = hdr_size_of_equivalent_value_range(h, v);
+
+        mu_assert("Should record", hdr_record_values(h, v, 2));
+        hdr_record_values(standard, v, 2);
+        total += 2;
+
+        mu_assert("Within tier precision", size <= (v / precision > 1 ? v / precision : 1));
+        mu_assert("Should be in range", hdr_next_non_equivalent_value(h, v) - size <= v);
+        mu_assert("Should count", hdr_count_at_value(h, v) >= 2);
+    }
+    mu_assert("Should reject out of range", !hdr_record_value(h, highest * 2));
+
+    mu_assert("Total", compare_int64(total, h->total_count));
+    mu_assert("Min", hdr_values_are_equivalent(h, 1, hdr_min(h)));
+    mu_assert("Max", hdr_values_are_equivalent(h, hdr_max(standard), hdr_max(h)));
+    for (i = 0; i < (int) (sizeof(percentiles) / sizeof(percentiles[0])); i++)
+    {
+        mu_assert(
+            "Percentile within tier precision",
+            hdr_values_are_equivalent(
+                h, hdr_value_at_percentile(standard, percentiles[i]), hdr_value_at_percentile(h, percentiles[i])));
+    }
+
+    /* Every slot is visited once and the slots tile the values without gaps. */
+    previous = -1;
+    hdr_iter_init(&iter, h);
+    while (hdr_iter_next(&iter))
+    {
+        mu_assert("Contiguous", compare_int64(previous + 1, iter.lowest_equivalent_value));
+        mu_assert("Slot", compare_int64(iter.highest_equivalent_value + 1, hdr_next_non_equivalent_value(h, iter.value)));
+        previous = iter.highest_equivalent_value;
+        steps++;
+    }
+    mu_assert("Should visit every slot", compare_int64(h->counts_len, steps));
+
+    previous = INT64_MAX;
+    hdr_iter_reverse_init(&iter, h);
+    while (hdr_iter_next(&iter))
+    {
+        mu_assert("Descending", iter.value < previous);
+        mu_assert("Reverse counts", compare_int64(iter.count, hdr_count_at_value(h, iter.value)));
+        previous = iter.value;
+    }
+
+    mu_assert("Should clone", 0 == hdr_clone(h, &copy));
+    mu_assert("Should add all", compare_int64(0, hdr_add(copy, h)));
+    mu_assert("Added", compare_int64(2 * total, copy->total_count));
+    mu_assert("Added p50", compare_int64(hdr_value_at_percentile(h, 50.0), hdr_value_at_percentile(copy, 50.0)));
+
+    mu_assert("Should not shift", EINVAL == hdr_shift_values_left(h, 1));
+    mu_assert("Should not downsample", EINVAL == hdr_downsample(standard, h));
+
+    hdr_close(copy);
+    hdr_close(standard);
+    hdr_close(h);
+
+    return 0;
+}
+
+static char* test_moments(void)
+{
+    struct hdr_histogram* h;
+    struct hdr_histogram* merged;
+    struct hdr_histogram* plain;
+    struct hdr_histogram* copy;
+    int64_t v;
+
+    hdr_init(1, INT64_C(3600) * 1000 * 1000 * 1000, 3, &h);
+    hdr_init(1, INT64_C(3600) * 1000 * 1000 * 1000, 3, &merged);
+    hdr_init(1, INT64_C(3600) * 1000 * 1000 * 1000, 3, &plain);
+    mu_assert("Should enable", 0 == hdr_enable_moments(h));
+    mu_assert("Should enable", 0 == hdr_enable_moments(merged));
+
+    for (v = 1; v <= 10000; v++)
+    {
+        hdr_record_value(v % 2 ? h : merged, v);
+        hdr_record_value_atomic(plain, v);
+    }
+    mu_assert("Approximate mean", fabs(5000.5 - hdr_mean(plain)) > 0.1);
+
+    mu_assert("Should add", compare_int64(0, hdr_add(merged, h)));
+    mu_assert("Exact mean", compare_double(5000.5, hdr_mean(merged), 0.0000001));
+    mu_assert("Exact stddev", compare_double(sqrt((1e8 - 1) / 12), hdr_stddev(merged), 0.0000001));
+
+    /* Without moments the added values are estimated from their buckets. */
+    hdr_reset(merged);
+    mu_assert("Should be empty", compare_int64(0, merged->total_count));
+    hdr_add(merged, plain);
+    mu_assert("Estimated mean", compare_double(hdr_mean(plain), hdr_mean(merged), 0.0000001));
+
+    /* Large values with a small spread, exact despite the squares cancelling. */
+    hdr_reset(h);
+    for (v = 0; v < 1000; v++)
+    {
+        hdr_record_values(h, INT64_C(1000000000000) + v, 1000);
+        hdr_record_values_atomic(h, INT64_C(1000000000000) + v, 1000);
+    }
+    mu_assert("Large mean", compare_double(1000000000499.5, hdr_mean(h), 0.0000001));
+    mu_assert("Large stddev", compare_double(sqrt((1e6 - 1) / 12), hdr_stddev(h), 0.0000001));
+
+    mu_assert("Should clone", 0 == hdr_clone(h, &copy));
+    mu_assert("Clone mean", compare_double(1000000000499.5, hdr_mean(copy), 0.0000001));
+    mu_assert("Should shift", 0 == hdr_shift_values_left(copy, 2));
+    mu_assert("Shifted mean", compare_double(4000000001998.0, hdr_mean(copy), 0.0000001));
+    mu_assert("Shifted stddev", compare_double(4 * sqrt((1e6 - 1) / 12), hdr_stddev(copy), 0.0000001));
+
+    hdr_close(copy);
+    hdr_close(plain);
+    hdr_close(merged);
+    hdr_close(h);
+
+    return 0;
+}
+
+static char* test_bulk_corrected_values(void)
+{
+    const int64_t intervals[] = { 1, 7, 100, 4096, 999999 };
+    struct hdr_histogram* bulk;
+    struct hdr_histogram* atomic;
+    struct hdr_histogram* expected;
+    int32_t i, j;
+
+    hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &bulk);
+    hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &atomic);
+    hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &expected);
+    hdr_enable_moments(bulk);
+    hdr_enable_moments(atomic);
+    hdr_enable_moments(expected);
+
+    for (i = 0; i < (int32_t) (sizeof(intervals) / sizeof(intervals[0])); i++)
+    {
+        /* A 1s stall in microseconds, the missing values one at a time for comparison. */
+        const int64_t value = INT64_C(1000000) + i;
+        int64_t missing_value;
+
+        mu_assert("Should record", hdr_record_corrected_values(bulk, value, 3, intervals[i]));
+        mu_assert("Should record", hdr_record_corrected_values_atomic(atomic, value, 3, intervals[i]));
+        hdr_record_values(expected, value, 3);
+        for (missing_value = value - intervals[i]; missing_value >= intervals[i]; missing_value -= intervals[i])
+        {
+            hdr_record_values(expected, missing_value, 3);
+        }
+    }
+
+    mu_assert("Total", compare_int64(expected->total_count, bulk->total_count));
+    mu_assert("Total", compare_int64(expected->total_count, atomic->total_count));
+    mu_assert("Min", compare_int64(hdr_min(expected), hdr_min(bulk)));
+    mu_assert("Max", compare_int64(hdr_max(expected), hdr_max(atomic)));
+    for (j = 0; j < expected->counts_len; j++)
+    {
+        mu_assert("Counts", compare_int64(hdr_count_at_index(expected, j), hdr_count_at_index(bulk, j)));
+        mu_assert("Counts", compare_int64(hdr_count_at_index(expected, j), hdr_count_at_index(atomic, j)));
+    }
+    mu_assert("Mean", compare_double(hdr_mean(expected), hdr_mean(bulk), 0.0000001));
+    mu_assert("Stddev", compare_double(hdr_stddev(expected), hdr_stddev(atomic), 0.0000001));
+
+    hdr_close(expected);
+    hdr_close(atomic);
+    hdr_close(bulk);
+
+    return 0;
+}
+
+static char* test_corrected_view(void)
+{
+    const double percentiles[] = { 0.0, 1.0, 25.0, 50.0, 90.0, 99.0, 99.9, 100.0 };
+    struct hdr_histogram* raw;
+    struct hdr_histogram* corrected;
+    struct hdr_corrected_view view;
+    struct hdr_corrected_iter view_iter;
+    struct hdr_iter iter;
+    int64_t v;
+    int i;
+
+    hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &raw);
+    hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &corrected);
+
+    for (v = 1; v <= 10000; v++)
+    {
+        hdr_record_value(raw, 800 + v % 400);
+    }
+    hdr_record_values(raw, 100000000, 2);
+    hdr_record_value(raw, 2500000);
+    hdr_add_while_correcting_for_coordinated_omission(corrected, raw, 10000);
+
+    mu_assert("Should init", 0 == hdr_corrected_view_init(&view, raw, 10000));
+    mu_assert("Total", compare_int64(corrected->total_count, hdr_corrected_total_count(&view)));
+    mu_assert("Min", compare_int64(hdr_min(corrected), hdr_corrected_min(&view)));
+    mu_assert("Max", compare_int64(hdr_max(corrected), hdr_corrected_max(&view)));
+    mu_assert("Mean", compare_values(hdr_mean(corrected), hdr_corrected_mean(&view), 0.001));
+    for (i = 0; i < (int) (sizeof(percentiles) / sizeof(percentiles[0])); i++)
+    {
+        mu_assert(
+            "Percentile",
+            compare_int64(
+                hdr_value_at_percentile(corrected, percentiles[i]),
+                hdr_corrected_value_at_percentile(&view, percentiles[i])));
+    }
+    mu_assert("Count", compare_int64(hdr_count_at_value(corrected, 50000), hdr_corrected_count_at_value(&view, 50000)));
+
+    hdr_iter_recorded_init(&iter, corrected);
+    mu_assert("Should init iterator", 0 == hdr_corrected_iter_init(&view_iter, &view));
+    while (hdr_iter_next(&iter))
+    {
+        mu_assert("Should iterate", hdr_corrected_iter_next(&view_iter));
+        mu_assert("Iterated value", compare_int64(iter.value, view_iter.value));
+        mu_assert("Iterated count", compare_int64(iter.count, view_iter.count));
+    }
+    mu_assert("Should end", !hdr_corrected_iter_next(&view_iter));
+    mu_assert("Cumulative", compare_int64(hdr_corrected_total_count(&view), view_iter.cumulative_count));
+    hdr_corrected_iter_close(&view_iter);
+
+    hdr_corrected_view_close(&view);
+
+    /* An interval of 0 corrects nothing. */
+    mu_assert("Should init", 0 == hdr_corrected_view_init(&view, raw, 0));
+    mu_assert("Uncorrected", compare_int64(raw->total_count, hdr_corrected_total_count(&view)));
+    mu_assert(
+        "Uncorrected p50",
+        compare_int64(hdr_value_at_percentile(raw, 50.0), hdr_corrected_value_at_percentile(&view, 50.0)));
+    mu_assert("Should init iterator", 0 == hdr_corrected_iter_init(&view_iter, &view));
+    hdr_iter_recorded_init(&iter, raw);
+    while (hdr_iter_next(&iter))
+    {
+        mu_assert("Should iterate", hdr_corrected_iter_next(&view_iter));
+        mu_assert("Uncorrected count", compare_int64(iter.count, view_iter.count));
+    }
+    mu_assert("Should end", !hdr_corrected_iter_next(&view_iter));
+    hdr_corrected_iter_close(&view_iter);
+    hdr_corrected_view_close(&view);
+
+    hdr_close(corrected);
+    hdr_close(raw);
+
+    return 0;
+}
+
+static char* test_sampled_recording(void)
+{
+    const double percentiles[] = { 50.0, 90.0, 99.0 };
+    const double variations[] = { 0.05, 0.05, 0.1 };
+    struct hdr_histogram* full;
+    struct hdr_histogram* every;
+    struct hdr_histogram* bernoulli;
+    struct hdr_histogram* scaled;
+    struct hdr_sampler every_sampler;
+    struct hdr_sampler bernoulli_sampler;
+    uint64_t x = 42;
+    int64_t expected_scaled;
+    int i;
+
+    hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &full);
+    hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &every);
+    hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &bernoulli);
+    hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &scaled);
+
+    mu_assert("Should reject interval", EINVAL == hdr_sampler_init_interval(&every_sampler, every, 0));
+    mu_assert("Should reject rate", EINVAL == hdr_sampler_init_bernoulli(&bernoulli_sampler, bernoulli, 0.0, 1));
+    mu_assert("Should reject rate", EINVAL == hdr_sampler_init_bernoulli(&bernoulli_sampler, bernoulli, 1.5, 1));
+    mu_assert("Should reject rate", EINVAL == hdr_sampler_init_bernoulli(&bernoulli_sampler, bernoulli, 0x1p-63, 1));
+    mu_assert("Should reject rate", EINVAL == hdr_sampler_init_bernoulli(&bernoulli_sampler, bernoulli, 1e-30, 1));
+    mu_assert("Should init", 0 == hdr_sampler_init_interval(&every_sampler, every, 10));
+    mu_assert("Should init", 0 == hdr_sampler_init_bernoulli(&bernoulli_sampler, bernoulli, 0.1, 7));
+
+    /* A long tailed latency distribution, from 1us to 1s.  The standard error of a */
+    /* sampled percentile grows with the tail, at p99 here it is about 3% at rate 0.1. */
+    for (i = 0; i < 1000000; i++)
+    {
+        int64_t value;
+
+        x = x * UINT64_C(6364136223846793005) + UINT64_C(1442695040888963407);
+        value = (int64_t) (1000.0 / (1.0 - 0.999 * ((double) (x >> 11) / 9007199254740992.0)));
+        hdr_record_value(full, value);
+        mu_assert("Should record", hdr_sampler_record_value(&every_sampler, value));
+        mu_assert("Should record", hdr_sampler_record_value(&bernoulli_sampler, value));
+    }
+
+    mu_assert("Total count", compare_int64(full->total_count, every->total_count));
+    mu_assert("Total count", compare_values((double) bernoulli->total_count, (double) full->total_count, 0.05));
+    for (i = 0; i < (int) (sizeof(percentiles) / sizeof(percentiles[0])); i++)
+    {
+        const double expected = (double) hdr_value_at_percentile(full, percentiles[i]);
+
+        mu_assert(
+            "Every Nth percentile",
+            compare_values((double) hdr_value_at_percentile(every, percentiles[i]), expected, variations[i]));
+        mu_assert(
+            "Bernoulli percentile",
+            compare_values((double) hdr_value_at_percentile(bernoulli, percentiles[i]), expected, variations[i]));
+    }
+
+    /* Rounding carries between buckets, so the scaled total is off by at most one. */
+    mu_assert("Should add", 0 == hdr_add_scaled(scaled, full, 0.3));
+    expected_scaled = (int64_t) (0.3 * (double) full->total_count + 0.5);
+    mu_assert("Scaled count", llabs(scaled->total_count - expected_scaled) <= 1);
+    mu_assert(
+        "Scaled p90",
+        compare_values((double) hdr_value_at_percentile(scaled, 90.0), (double) hdr_value_at_percentile(full, 90.0), 0.01));
+
+    /* Invalid scales add nothing. */
+    expected_scaled = scaled->total_count;
+    mu_assert("Negative scale", compare_int64(full->total_count, hdr_add_scaled(scaled, full, -1.0)));
+    mu_assert("NaN scale", compare_int64(full->total_count, hdr_add_scaled(scaled, full, nan(""))));
+    mu_assert("Infinite scale", compare_int64(full->total_count, hdr_add_scaled(scaled, full, HUGE_VAL)));
+    mu_assert("Overflowing scale", compare_int64(full->total_count, hdr_add_scaled(scaled, full, 1e300)));
+    mu_assert(
+        "Overflowing total",
+        compare_int64(full->total_count, hdr_add_scaled(scaled, full, 0x1p63 / (double) full->total_count)));
+    mu_assert("Unchanged", compare_int64(expected_scaled, scaled->total_count));
+
+    /* Moments are estimated from the bucket medians, as hdr_add does. */
+    hdr_reset(scaled);
+    hdr_reset(every);
+    hdr_enable_moments(scaled);
+    hdr_enable_moments(every);
+    hdr_add_scaled(scaled, full, 1.0);
+    hdr_add(every, full);
+    mu_assert("Scaled mean", compare_double(hdr_mean(every), hdr_mean(scaled), 0.000001));
+
+    hdr_close(scaled);
+    hdr_close(bernoulli);
+    hdr_close(every);
+    hdr_close(full);
+
+    return 0;
+}
+
+static size_t allocation_size_of(const struct hdr_histogram* h)
+{
+    struct hdr_histogram_bucket_config cfg;
+
+    hdr_calculate_bucket_config(h->lowest_discernible_value, h->highest_trackable_value, h->significant_figures, &cfg);
+    return hdr_calculate_allocation_size(&cfg);
+}
+
+static char* test_downsample(void)
+{
+    struct hdr_histogram* src;
+    struct hdr_histogram* dst;
+    struct hdr_histogram* coarse;
+    struct hdr_histogram* rollup;
+    const double percentiles[] = { 1.0, 50.0, 90.0, 99.0, 99.9, 100.0 };
+    int64_t v;
+    int i;
+
+    hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &src);
+    hdr_init(1, INT64_C(3600) * 1000 * 1000, 1, &dst);
+    hdr_init(1024, INT64_C(3600) * 1000 * 1000, 2, &coarse);
+
+    for (v = 1; v < 100000000; v += v / 3 + 1)
+    {
+        hdr_record_values(src, v, v % 7 + 1);
+    }
+
+    mu_assert("Should downsample", 0 == hdr_downsample(dst, src));
+    mu_assert("Should downsample", 0 == hdr_downsample(coarse, src));
+    mu_assert("Should not refine", EINVAL == hdr_downsample(src, dst));
+    mu_assert("Total count", compare_int64(src->total_count, dst->total_count));
+    mu_assert("Total count", compare_int64(src->total_count, coarse->total_count));
+
+    /* Grouping slots keeps their order, so percentiles only lose precision. */
+    for (i = 0; i < (int) (sizeof(percentiles) / sizeof(percentiles[0])); i++)
+    {
+        int64_t expected = hdr_value_at_percentile(src, percentiles[i]);
+        mu_assert("Percentile", hdr_values_are_equivalent(dst, expected, hdr_value_at_percentile(dst, percentiles[i])));
+        mu_assert(
+            "Percentile", hdr_values_are_equivalent(coarse, expected, hdr_value_at_percentile(coarse, percentiles[i])));
+    }
+
+    mu_assert("Should fit budget", 0 == hdr_downsample_to_budget(src, 16 * 1024, &rollup));
+    mu_assert("Within budget", allocation_size_of(rollup) <= 16 * 1024);
+    mu_assert("Fewer figures", rollup->significant_figures < src->significant_figures);
+    mu_assert("Total count", compare_int64(src->total_count, rollup->total_count));
+    hdr_close(rollup);
+
+    mu_assert("Should keep config within budget", 0 == hdr_downsample_to_budget(src, allocation_size_of(src), &rollup));
+    mu_assert("Same figures", compare_int64(3, rollup->significant_figures));
+    mu_assert("Same counts", compare_int64(src->total_count, rollup->total_count));
+    hdr_close(rollup);
+
+    /* The alignment slack counts against the budget. */
+    mu_assert("Should fit budget", 0 == hdr_downsample_to_budget(src, allocation_size_of(src) - 1, &rollup));
+    mu_assert("Fewer figures", rollup->significant_figures < src->significant_figures);
+    hdr_close(rollup);
+
+    mu_assert("Should raise lowest value", 0 == hdr_init_budgeted(1, INT64_C(3600) * 1000 * 1000, 3, 2048, &rollup));
+    mu_assert("Within budget", allocation_size_of(rollup) <= 2048);
+    mu_assert("One figure", compare_int64(1, rollup->significant_figures));
+    mu_assert("Raised lowest value", rollup->lowest_discernible_value > 1);
+    hdr_close(rollup);
+
+    mu_assert("Should reject tiny budget", EINVAL == hdr_init_budgeted(1, INT64_C(3600) * 1000 * 1000, 3, 64, &rollup));
+
+    hdr_close(coarse);
+    hdr_close(dst);
+    hdr_close(src);
+
+    return 0;
+}
+
+static char* test_shift_values(void)
+{
+    struct hdr_histogram* h;
+    struct hdr_histogram* expected;
+    struct hdr_histogram* sum;
+    const int64_t values[] = { 1, 5, 1000, 5000, 100000, 3000000 };
+    const double percentiles[] = { 10.0, 50.0, 75.0, 90.0, 100.0 };
+    struct hdr_iter iter;
+    int64_t count = 0;
+    int i, pass;
+
+    for (pass = 0; pass < 2; pass++)
+    {
+        hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &h);
+        hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &expected);
+        if (1 == pass)
+        {
+            hdr_enable_occupancy_bitmap(h);
+        }
+
+        hdr_record_values(h, 0, 2);
+        hdr_record_values(expected, 0, 2);
+        for (i = 0; i < (int) (sizeof(values) / sizeof(values[0])); i++)
+        {
+            hdr_record_values(h, values[i], i + 1);
+            hdr_record_values(expected, values[i] << 3, i + 1);
+        }
+
+        /* Includes values in the lowest half bucket, which are moved individually. */
+        mu_assert("Should shift left", 0 == hdr_shift_values_left(h, 3));
+        mu_assert("Offset", h->normalizing_index_offset != 0);
+        mu_assert("Total", compare_int64(expected->total_count, h->total_count));
+        mu_assert("Zero count", compare_int64(2, hdr_count_at_value(h, 0)));
+        mu_assert("Min", compare_int64(8, h->min_value));
+        mu_assert("Max", compare_int64(24000000, h->max_value));
+        for (i = 0; i < (int) (sizeof(values) / sizeof(values[0])); i++)
+        {
+            mu_assert("Count", compare_int64(i + 1, hdr_count_at_value(h, values[i] << 3)));
+        }
+        for (i = 0; i < (int) (sizeof(percentiles) / sizeof(percentiles[0])); i++)
+        {
+            mu_assert(
+                "Percentile",
+                compare_int64(
+                    hdr_value_at_percentile(expected, percentiles[i]), hdr_value_at_percentile(h, percentiles[i])));
+        }
+
+        hdr_iter_recorded_init(&iter, h);
+        while (hdr_iter_next(&iter))
+        {
+            count += iter.count;
+        }
+        mu_assert("Iterated count", compare_int64(h->total_count, count));
+        count = 0;
+
+        hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &sum);
+        hdr_add(sum, h);
+        mu_assert("Added", compare_int64(6, hdr_count_at_value(sum, 3000000 << 3)));
+        hdr_close(sum);
+
+        mu_assert("Should reject underflow", EINVAL == hdr_shift_values_right(h, 4));
+        mu_assert("Should be unchanged", compare_int64(8, h->min_value));
+
+        hdr_reset(h);
+        mu_assert("Reset offset", compare_int64(0, h->normalizing_index_offset));
+        mu_assert("Reset counts", compare_int64(0, hdr_count_at_value(h, 0)));
+
+        hdr_close(expected);
+        hdr_close(h);
+    }
+
+    /* Above the lowest half bucket a right shift is exact and the inverse of a left shift. */
+    hdr_init(1, INT64_C(3600) * 1000 * 1000, 3, &h);
+    hdr_record_values(h, 40000, 3);
+    hdr_record_values(h, 4000000, 4);
+    mu_assert("Should shift right", 0 == hdr_shift_values_right(h, 2));
+    mu_assert("Count", compare_int64(3, hdr_count_at_value(h, 10000)));
+    mu_assert("Count", compare_int64(4, hdr_count_at_value(h, 1000000)));
+    mu_assert("Max", compare_int64(1000000, h->max_value));
+    mu_assert("Should shift left", 0 == hdr_shift_values_left(h, 2));
+    mu_assert("Offset", compare_int64(0, h->normalizing_index_offset));
+    mu_assert("Count", compare_int64(3, hdr_count_at_value(h, 40000)));
+    mu_assert("p100", hdr_values_are_equivalent(h, 4000000, hdr_value_at_percentile(h, 100.0)));
+
+    mu_assert("Should reject overflow", EINVAL == hdr_shift_values_left(h, 20));
+    mu_assert("Should reject negative", EINVAL == hdr_shift_values_left(h, -1));
+    mu_assert("Should be unchanged", compare_int64(4, hdr_count_at_value(h, 4000000)));
+    hdr_close(h);
+
+    return 0;
+}
+
+static char* test_init_in_buffer(void)
+{
+    struct hdr_histogram_bucket_config cfg;
+    struct hdr_histogram view;
+    struct hdr_histogram moved;
+    int64_t* buffer;
+    int64_t* copy;
+    size_t size;
+    int64_t i;
+
+    hdr_calculate_bucket_config(1, INT64_C(3600) * 1000 * 1000, 3, &cfg);
+    size = hdr_calculate_buffer_size(&cfg);
+    buffer = (int64_t*) malloc(size);
+    copy = (int64_t*) malloc(size);
+
+    mu_assert("Should reject small buffer", EINVAL == hdr_init_in_buffer(
+        1, INT64_C(3600) * 1000 * 1000, 3, buffer, size - 1, &view));
+    mu_assert("Should init", 0 == hdr_init_in_buffer(
+        1, INT64_C(3600) * 1000 * 1000, 3, buffer, size, &view));
+
+    for (i = 1; i <= 1000; i++)
+    {
+        hdr_record_value_atomic(&view, i * 100);
+    }
+    hdr_record_values(&view, 5000000, 10);
+
+    /* The layout holds no pointers, so it can be read at another address. */
+    memcpy(copy, buffer, size);
+    mu_assert("Should attach", 0 == hdr_attach_buffer(copy, size, &moved));
+    mu_assert("Total count", compare_int64(view.total_count, moved.total_count));
+    mu_assert("Counts", compare_int64(10, hdr_count_at_value(&moved, 5000000)));
+    mu_assert(
+        "p50", compare_int64(hdr_value_at_percentile(&view, 50.0), hdr_value_at_percentile(&moved, 50.0)));
+
+    hdr_record_value(&moved, 100);
+    mu_assert("Should not share the copy", compare_int64(1, hdr_count_at_value(&view, 100)));
+
+    mu_assert("Should reject truncated", EINVAL == hdr_attach_buffer(copy, size / 2, &moved));
+    memset(copy, 0, size);
+    mu_assert("Should reject empty", EINVAL == hdr_attach_buffer(copy, size, &moved));
+
+    free(copy);
+    free(buffer);
+
+    return 0;
+}
+
+#if defined(__linux__)
+static char* test_shared_histogram(void)
+{
+    struct hdr_shared_recorder r;
+    struct hdr_histogram* h;
+    char name[64];
+    pid_t children[2];
+    int64_t dropped;
+    int i;
+
+    snprintf(name, sizeof(name), "/hdr_histogram_test_%d", (int) getpid());
+    mu_assert("Should open", 0 == hdr_open_shared(name, 1, 3600000000, 3, &r));
+
+    for (i = 0; i < 2; i++)
+    {
+        children[i] = fork();
+        if (0 == children[i])
+        {
+            struct hdr_shared_recorder worker;
+            int64_t v;
+
+            if (0 != hdr_open_shared(name, 1, 3600000000, 3, &worker))
+            {
+                _exit(1);
+            }
+            for (v = 1; v <= 10000; v++)
+            {
+                hdr_shared_record_value(&worker, v);
+            }
+            hdr_close_shared(&worker);
+            _exit(0);
+        }
+    }
+
+    for (i = 0; i < 2; i++)
+    {
+        int status = 0;
+        waitpid(children[i], &status, 0);
+        mu_assert("Worker should succeed", WIFEXITED(status) && 0 == WEXITSTATUS(status));
+    }
+
+    hdr_init(1, 3600000000, 3, &h);
+    mu_assert("Should not drop", compare_int64(0, hdr_shared_sample(&r, h)));
+    mu_assert("Total count", compare_int64(20000, h->total_count));
+    mu_assert("Counts", compare_int64(2, hdr_count_at_value(h, 1000)));
+    mu_assert("Max", compare_int64(10000, hdr_lowest_equivalent_value(h, h->max_value)));
+
+    hdr_shared_record_values(&r, 42, 3);
+    hdr_reset(h);
+    hdr_shared_sample(&r, h);
+    mu_assert("Only the new interval", compare_int64(3, h->total_count));
+    hdr_reset(h);
+    hdr_shared_sample(&r, h);
+    mu_assert("Interval should be cleared", compare_int64(0, h->total_count));
+
+    /* A writer that died while recording holds back only the interval it entered. */
+    hdr_phaser_writer_enter(hdr_shared_phaser(&r));
+    hdr_shared_record_values(&r, 42, 5);
+    hdr_reset(h);
+    mu_assert("Should time out", ETIMEDOUT == hdr_shared_sample_with_timeout(&r, h, 1000000, &dropped));
+    mu_assert("Nothing sampled", compare_int64(0, h->total_count));
+    hdr_shared_record_values(&r, 7, 3);
+    mu_assert("Should sample", 0 == hdr_shared_sample_with_timeout(&r, h, 1000000, &dropped));
+    mu_assert("Next interval", compare_int64(3, h->total_count));
+    hdr_reset(h);
+    mu_assert("Should sample", 0 == hdr_shared_sample_with_timeout(&r, h, 1000000, &dropped));
+    mu_assert("Held back interval", compare_int64(5, hdr_count_at_value(h, 42)));
+    mu_assert("Should not drop", compare_int64(0, dropped));
+
+    mu_assert(
+        "Should reject other configuration", EINVAL == hdr_open_shared(name, 1, 3600000000, 2, &r));
+
+    hdr_close(h);
+    hdr_close_shared(&r);
+    mu_assert("Should unlink", 0 == hdr_unlink_shared(name));
+
+    return 0;
+}
+
+static char* test_file_histogram(void)
+{
+    struct hdr_file_histogram f;
+    char path[64];
+    pid_t child;
+    pid_t children[4];
+    struct hdr_histogram_bucket_config cfg;
+    size_t counts_offset;
+    int status = 0;
+    int64_t v;
+    int i;
+    FILE* file;
+
+    snprintf(path, sizeof(path), "/tmp/hdr_histogram_test_%d.hdr", (int) getpid());
+    unlink(path);
+
+    mu_assert("Should create", 0 == hdr_open_file(path, 1, 3600000000, 3, &f));
+    mu_assert("Should not be recovered", !f.recovered);
+    for (v = 1; v <= 1000; v++)
+    {
+        hdr_record_value(&f.histogram, v * 7 + 123456);
+    }
+    mu_assert("Should close", 0 == hdr_close_file(&f));
+
+    mu_assert("Should reopen", 0 == hdr_open_file(path, 1, 3600000000, 3, &f));
+    mu_assert("Should be clean", !f.recovered);
+    mu_assert("Total count", compare_int64(1000, f.histogram.total_count));
+    mu_assert("Exact min", compare_int64(123463, f.histogram.min_value));
+    mu_assert("Exact max", compare_int64(130456, f.histogram.max_value));
+    hdr_close_file(&f);
+
+    /* A crash after recording, without a sync, keeps the values in the file. */
+    child = fork();
+    if (0 == child)
+    {
+        if (0 != hdr_open_file(path, 1, 3600000000, 3, &f))
+        {
+            _exit(1);
+        }
+        hdr_record_values(&f.histogram, 5000000, 500);
+        _exit(0);
+    }
+    waitpid(child, &status, 0);
+    mu_assert("Child should succeed", WIFEXITED(status) && 0 == WEXITSTATUS(status));
+
+    mu_assert("Should reopen", 0 == hdr_open_file(path, 1, 3600000000, 3, &f));
+    mu_assert("Should be recovered", f.recovered);
+    mu_assert("Total count", compare_int64(1500, f.histogram.total_count));
+    mu_assert("Counts", compare_int64(500, hdr_count_at_value(&f.histogram, 5000000)));
+    hdr_close_file(&f);
+
+    mu_assert("Should reject other configuration", EINVAL == hdr_open_file(path, 1, 3600000000, 2, &f));
+    mu_assert("Should reject other range", EINVAL == hdr_open_file(path, 10, 3600000000, 3, &f));
+
+    /* A count changed in a closed file is corruption, not values to recover. */
+    hdr_calculate_bucket_config(1, 3600000000, 3, &cfg);
+    file = fopen(path, "r+b");
+    counts_offset = hdr_calculate_buffer_size(&cfg) - sizeof(int64_t) * (size_t) cfg.counts_len;
+    fseek(file, (long) (counts_offset + sizeof(int64_t) * (size_t) counts_index_for(&f.histogram, 5000000)), SEEK_SET);
+    fputc(0x7f, file);
+    fclose(file);
+    mu_assert("Should reject corrupt counts", EINVAL == hdr_open_file(path, 1, 3600000000, 3, &f));
+
+    file = fopen(path, "r+b");
+    fputs("not a histogram", file);
+    fclose(file);
+    mu_assert("Should reject corrupt file", EINVAL == hdr_open_file(path, 1, 3600000000, 3, &f));
+
+    unlink(path);
+
+    /* Processes racing to create the file all attach to the one histogram. */
+    for (i = 0; i < 4; i++)
+    {
+        children[i] = fork();
+        if (0 == children[i])
+        {
+            _exit(0 == hdr_open_file(path, 1, 3600000000, 3, &f) && 0 == hdr_close_file(&f) ? 0 : 1);
+        }
+    }
+    for (i = 0; i < 4; i++)
+    {
+        waitpid(children[i], &status, 0);
+        mu_assert("Racing opener should succeed", WIFEXITED(status) && 0 == WEXITSTATUS(status));
+    }
+    mu_assert("Should open created file", 0 == hdr_open_file(path, 1, 3600000000, 3, &f));
+    mu_assert("Should be empty", compare_int64(0, f.histogram.total_count));
+    hdr_close_file(&f);
+
+    /* A creator that died before writing the header leaves a zeroed file to recreate. */
+    mu_assert("Should truncate", 0 == truncate(path, 0));
+    mu_assert("Should size", 0 == truncate(path, (off_t) f.size));
+    mu_assert("Should recreate zeroed file", 0 == hdr_open_file(path, 1, 3600000000, 3, &f));
+    hdr_close_file(&f);
+
+    unlink(path);
+
+    return 0;
+}
+#endif
+
+static char* test_histogram_pool(void)
+{
+    struct hdr_histogram_pool pool;
+    struct hdr_histogram* a;
+    struct hdr_histogram* b;
+    struct hdr_histogram* reused;
+    struct hdr_histogram* other;
+    int64_t* counts;
+
+    mu_assert("Should init", 0 == hdr_histogram_pool_init(&pool, 1, INT64_C(3600) * 1000 * 1000, 3));
+    mu_assert("Should preallocate", 0 == hdr_histogram_pool_preallocate(&pool, 2));
+
+    mu_assert("Should acquire", 0 == hdr_histogram_pool_acquire(&pool, &a));
+    mu_assert("Should acquire", 0 == hdr_histogram_pool_acquire(&pool, &b));
+    mu_assert("Should take from pool", a->allocator == &pool.allocator);
+    mu_assert("Should drain pool", NULL == pool.free_blocks);
+
+    hdr_record_values(a, 1000, 5);
+    hdr_record_value(a, 3000000);
+    mu_assert("Should enable bitmap", 0 == hdr_enable_occupancy_bitmap(a));
+    counts = a->counts;
+    hdr_close(a);
+
+    mu_assert("Should acquire", 0 == hdr_histogram_pool_acquire(&pool, &reused));
+    mu_assert("Should reuse counts", reused->counts == counts);
+    mu_assert("Reused counts should be zero", counts_are_zero(reused));
+    mu_assert("Reused should be empty", compare_int64(0, reused->total_count));
+    mu_assert("Reused should be empty", compare_int64(0, hdr_max(reused)));
+
+    /* Shifted counts are cleared in full. */
+    hdr_record_value(reused, 2000);
+    mu_assert("Should shift", 0 == hdr_shift_values_left(reused, 3));
+    hdr_close(reused);
+    mu_assert("Should acquire", 0 == hdr_histogram_pool_acquire(&pool, &reused));
+    mu_assert("Reused counts should be zero", counts_are_zero(reused));
+
+    mu_assert("Other configurations pass through", 0 == hdr_init_ex(1, 1000, 2, &pool.allocator, &other));
+    mu_assert("Pass through counts should be zero", counts_are_zero(other));
+    hdr_record_value(other, 10);
+    hdr_close(other);
+
+    hdr_close(reused);
+    hdr_close(b);
+    hdr_histogram_pool_destroy(&pool);
+
+    return 0;
+}
+
 static struct mu_result all_tests(void)
 {
     mu_run_test(test_create);
@@ -580,7 +2375,38 @@ static struct mu_result all_tests(void)
     mu_run_test(test_out_of_range_values);
     mu_run_test(test_linear_iter_buckets_correctly);
     mu_run_test(test_interval_recording);
+    mu_run_test(test_atomic_batch);
+    mu_run_test(test_buffered_interval_recording);
+    mu_run_test(test_offload_recording);
     mu_run_test(reset_histogram_on_sample_and_recycle);
+    mu_run_test(test_copy_into);
+    mu_run_test(test_clone);
+    mu_run_test(test_recorded_values_from_value);
+    mu_run_test(test_recorded_values_from_percentile);
+    mu_run_test(test_reverse_values);
+    mu_run_test(test_add);
+    mu_run_test(test_occupancy_bitmap);
+    mu_run_test(test_export_and_import_recorded);
+    mu_run_test(test_reset_only_touched_range);
+    mu_run_test(test_init_with_allocator);
+    mu_run_test(test_histogram_pool);
+    mu_run_test(test_single_allocation_layout);
+    mu_run_test(test_page_allocator);
+    mu_run_test(test_lazy_counts);
+    mu_run_test(test_compact_histogram);
+    mu_run_test(test_hybrid_histogram);
+    mu_run_test(test_downsample);
+    mu_run_test(test_tiered_histogram);
+    mu_run_test(test_moments);
+    mu_run_test(test_bulk_corrected_values);
+    mu_run_test(test_corrected_view);
+    mu_run_test(test_sampled_recording);
+    mu_run_test(test_shift_values);
+    mu_run_test(test_init_in_buffer);
+#if defined(__linux__)
+    mu_run_test(test_shared_histogram);
+    mu_run_test(test_file_histogram);
+#endif
 
     mu_ok;
 }
@@ -0,0 +1,75 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <hdr/hdr_histogram.h>
+#include <hdr/hdr_page_allocator.h>
+#include <hdr/hdr_time.h>
+
+/* Sweeps counts_len by significant figures over a 1ns to 1 hour range and compares */
+/* default allocation with huge page backed counts.  Values are drawn uniformly over */
+/* the counts array, so every record is likely to land on a different page. */
+
+static double secs_between(hdr_timespec s, hdr_timespec e) {
+    return (double)(e.tv_sec - s.tv_sec) + (double)(e.tv_nsec - s.tv_nsec) / 1e9;
+}
+
+static uint64_t next_random(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+static void run(int significant_figures, struct hdr_allocator* allocator, const char* label) {
+    struct hdr_histogram* h;
+    const int64_t records = 20000000;
+    const int64_t queries = 2000;
+    const double percentiles[] = {50.0, 90.0, 99.0, 99.9};
+    hdr_timespec t0, t1, t2;
+    uint64_t state = 88172645463325252u;
+    volatile int64_t sink = 0;
+    int64_t i;
+
+    if (hdr_init_ex(1, INT64_C(3600) * 1000000000, significant_figures, allocator, &h) != 0) {
+        printf("%-8s sf=%d: allocation failed\n", label, significant_figures);
+        return;
+    }
+
+    /* Fault every page in before timing. */
+    for (i = 0; i < h->counts_len; i++)
+        h->counts[i] = 0;
+
+    hdr_gettime(&t0);
+    for (i = 0; i < records; i++) {
+        int32_t index = (int32_t)(next_random(&state) % (uint64_t)h->counts_len);
+        hdr_record_value(h, hdr_value_at_index(h, index));
+    }
+    hdr_gettime(&t1);
+    for (i = 0; i < queries; i++)
+        sink += hdr_value_at_percentile(h, percentiles[i % 4]);
+    hdr_gettime(&t2);
+
+    printf("%-8s sf=%d counts_len=%9d (%7.1f MB)  record: %6.2f ns  percentile: %9.1f us  (sink=%lld)\n",
+           label, significant_figures, h->counts_len, h->counts_len * 8.0 / (1024 * 1024),
+           secs_between(t0, t1) * 1e9 / (double)records,
+           secs_between(t1, t2) * 1e6 / (double)queries,
+           (long long)sink);
+
+    hdr_close(h);
+}
+
+int main(void) {
+    struct hdr_page_allocator huge;
+    int sf;
+
+    hdr_page_allocator_init(&huge, true, HDR_NO_NUMA_NODE);
+
+    for (sf = 2; sf <= 5; sf++) {
+        run(sf, NULL, "default");
+        run(sf, &huge.allocator, "huge");
+    }
+
+    return 0;
+}